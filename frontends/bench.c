@@ -0,0 +1,726 @@
+/*
+A benchmark suite for the emulator core: the cost of each instruction on its
+own, end to end throughput in each execution mode on synthetic ROMs (and any
+ROMs given on the command line), and the cost of setting up and tearing down
+an emulator. Results are written as JSON, and can be compared against a
+previous run to catch regressions.
+
+The instruction benchmarks call the op_* functions directly on a prepared
+emulator, so they include the cost of the call but not of fetching and
+decoding. Each call is preceded by resetting the program counter, stack
+pointer, I and any key wait, so every call sees the same state;
+"op/illegal" (which does nothing) is the cost of that and the call.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8.h"
+#include "chip8_priv.h"
+#include "instructions.h"
+#include "roms.h"
+
+#define DEFAULT_MIN_SECONDS 0.1
+#define DEFAULT_REPS 5
+#define DEFAULT_THRESHOLD 10.0
+#define MAX_RESULTS 256
+#define MAX_NAME 128
+#define TRACE_CAPACITY (1u << 16)
+
+/* an instruction and the state it is run from */
+struct op_case
+{
+    const char *name;
+    uint16_t opcode;
+    uint8_t vx;                             /* V[x] */
+    uint8_t vy;                             /* V[y] */
+    uint16_t I;
+};
+
+/* a synthetic ROM for the end to end benchmarks */
+struct synthetic_rom
+{
+    const char *name;
+    uint8_t *data;
+    uint16_t num_bytes;
+};
+
+struct result
+{
+    char name[MAX_NAME];
+    const char *unit;                       /* "ns" (lower is better) or "MIPS" (higher is better) */
+    double value;
+};
+
+struct settings
+{
+    double min_seconds;                     /* spent on each benchmark, spread over the reps */
+    int reps;                               /* the best rep is reported */
+    const char *filter;                     /* only run benchmarks with this in their name */
+};
+
+/* what a timed body works on */
+struct context
+{
+    struct chip8 *p;
+    const struct op_case *c;
+    void (*handler)(struct chip8 *, uint16_t);
+    struct chip8_pool *pool;
+    void *mem;
+    struct chip8_trace *trace;
+    struct chip8_trace_record *records;
+};
+
+static const struct op_case op_cases[] =
+{
+    { "op/illegal",             0xFFFF, 0, 0, 0x300 },
+    { "op/0nnn",                0x0123, 0, 0, 0x300 },
+    { "op/00E0",                0x00E0, 0, 0, 0x300 },
+    { "op/00EE",                0x00EE, 0, 0, 0x300 },
+    { "op/1nnn",                0x1246, 0, 0, 0x300 },
+    { "op/2nnn",                0x2246, 0, 0, 0x300 },
+    { "op/3xkk",                0x3A12, 0x12, 0, 0x300 },
+    { "op/4xkk",                0x4A12, 0x12, 0, 0x300 },
+    { "op/5xy0",                0x5AB0, 0x12, 0x12, 0x300 },
+    { "op/6xkk",                0x6A12, 0, 0, 0x300 },
+    { "op/7xkk",                0x7A12, 0x34, 0, 0x300 },
+    { "op/8xy0",                0x8AB0, 0x12, 0x34, 0x300 },
+    { "op/8xy1",                0x8AB1, 0x12, 0x34, 0x300 },
+    { "op/8xy2",                0x8AB2, 0x12, 0x34, 0x300 },
+    { "op/8xy3",                0x8AB3, 0x12, 0x34, 0x300 },
+    { "op/8xy4",                0x8AB4, 0xF0, 0x34, 0x300 },
+    { "op/8xy5",                0x8AB5, 0x12, 0x34, 0x300 },
+    { "op/8xy6",                0x8AB6, 0x12, 0x35, 0x300 },
+    { "op/8xy7",                0x8AB7, 0x12, 0x34, 0x300 },
+    { "op/8xyE",                0x8ABE, 0x12, 0xB4, 0x300 },
+    { "op/9xy0",                0x9AB0, 0x12, 0x34, 0x300 },
+    { "op/Annn",                0xA246, 0, 0, 0x300 },
+    { "op/Bnnn",                0xB246, 0, 0, 0x300 },
+    { "op/Cxkk",                0xCAFF, 0, 0, 0x300 },
+    { "op/Ex9E",                0xEA9E, 0x5, 0, 0x300 },
+    { "op/ExA1",                0xEAA1, 0x5, 0, 0x300 },
+    { "op/Fx07",                0xFA07, 0, 0, 0x300 },
+    { "op/Fx0A",                0xFA0A, 0, 0, 0x300 },
+    { "op/Fx15",                0xFA15, 0x3C, 0, 0x300 },
+    { "op/Fx18",                0xFA18, 0x3C, 0, 0x300 },
+    { "op/Fx1E",                0xFA1E, 0x12, 0, 0x300 },
+    { "op/Fx29",                0xFA29, 0x7, 0, 0x300 },
+    /* the BCD loops go round once for each hundred and each ten */
+    { "op/Fx33/0",              0xFA33, 0, 0, 0x300 },
+    { "op/Fx33/99",             0xFA33, 99, 0, 0x300 },
+    { "op/Fx33/255",            0xFA33, 255, 0, 0x300 },
+    { "op/Fx55/x0",             0xF055, 0x12, 0, 0x300 },
+    { "op/Fx55/x7",             0xF755, 0x12, 0, 0x300 },
+    { "op/Fx55/x15",            0xFF55, 0x12, 0, 0x300 },
+    { "op/Fx65/x0",             0xF065, 0, 0, 0x300 },
+    { "op/Fx65/x7",             0xF765, 0, 0, 0x300 },
+    { "op/Fx65/x15",            0xFF65, 0, 0, 0x300 },
+    /* sprites from the font (I = 0) or the 0xFF rows at 0x300, V[x] is the
+       column and V[y] the row */
+    { "op/Dxyn/h1",             0xDAB1, 8, 8, 0x300 },
+    { "op/Dxyn/h5",             0xDAB5, 8, 8, 0x000 },
+    { "op/Dxyn/h8",             0xDAB8, 8, 8, 0x300 },
+    { "op/Dxyn/h15",            0xDABF, 8, 8, 0x300 },
+    { "op/Dxyn/h8-unaligned",   0xDAB8, 13, 7, 0x300 },
+    { "op/Dxyn/h8-clip-right",  0xDAB8, 60, 8, 0x300 },
+    { "op/Dxyn/h15-clip-bottom",0xDABF, 8, 28, 0x300 },
+    { "op/Dxyn/h15-clip-corner",0xDABF, 61, 28, 0x300 },
+    { "op/Dxyn/h8-wrap",        0xDAB8, 64 + 13, 32 + 7, 0x300 },
+};
+
+/* arithmetic and logic with a skip, 10 instructions round the loop */
+static uint8_t rom_alu[] =
+{
+    0x60, 0x00,     /* 200: LD V0, 0 */
+    0x61, 0x01,     /* 202: LD V1, 1 */
+    0x62, 0x03,     /* 204: LD V2, 3 */
+    0x70, 0x01,     /* 206: ADD V0, 1 */
+    0x80, 0x14,     /* 208: ADD V0, V1 */
+    0x81, 0x25,     /* 20A: SUB V1, V2 */
+    0x82, 0x16,     /* 20C: SHR V2, V1 */
+    0x83, 0x0E,     /* 20E: SHL V3, V0 */
+    0x83, 0x12,     /* 210: AND V3, V1 */
+    0x84, 0x03,     /* 212: XOR V4, V0 */
+    0x34, 0x00,     /* 214: SE V4, 0 */
+    0x74, 0x01,     /* 216: ADD V4, 1 */
+    0x12, 0x06,     /* 218: JP 206 */
+};
+
+/* font sprites drawn across the screen */
+static uint8_t rom_draw[] =
+{
+    0x60, 0x00,     /* 200: LD V0, 0 */
+    0x61, 0x00,     /* 202: LD V1, 0 */
+    0xF0, 0x29,     /* 204: LD F, V0 */
+    0xD0, 0x15,     /* 206: DRW V0, V1, 5 */
+    0x70, 0x05,     /* 208: ADD V0, 5 */
+    0x71, 0x03,     /* 20A: ADD V1, 3 */
+    0xD0, 0x15,     /* 20C: DRW V0, V1, 5 */
+    0x12, 0x04,     /* 20E: JP 204 */
+};
+
+/* BCD and the register block moves */
+static uint8_t rom_mem[] =
+{
+    0xA3, 0x00,     /* 200: LD I, 300 */
+    0xF0, 0x33,     /* 202: LD B, V0 */
+    0xFF, 0x55,     /* 204: LD [I], VF */
+    0xA3, 0x00,     /* 206: LD I, 300 */
+    0xFF, 0x65,     /* 208: LD VF, [I] */
+    0x70, 0x07,     /* 20A: ADD V0, 7 */
+    0x12, 0x00,     /* 20C: JP 200 */
+};
+
+/* subroutine calls */
+static uint8_t rom_call[] =
+{
+    0x22, 0x06,     /* 200: CALL 206 */
+    0x70, 0x01,     /* 202: ADD V0, 1 */
+    0x12, 0x00,     /* 204: JP 200 */
+    0x71, 0x01,     /* 206: ADD V1, 1 */
+    0x00, 0xEE,     /* 208: RET */
+};
+
+static const struct synthetic_rom synthetic_roms[] =
+{
+    { "alu",  rom_alu,  sizeof(rom_alu) },
+    { "draw", rom_draw, sizeof(rom_draw) },
+    { "mem",  rom_mem,  sizeof(rom_mem) },
+    { "call", rom_call, sizeof(rom_call) },
+};
+
+static const struct
+{
+    const char *name;
+    enum chip8_exec_mode mode;
+} exec_modes[] =
+{
+    { "interpreter", CHIP8_EXEC_INTERPRETER },
+    { "blocks",      CHIP8_EXEC_BLOCKS },
+    { "jit",         CHIP8_EXEC_JIT },
+};
+
+static int bench_ops(const struct settings *s, struct result *results, size_t *num_results);
+static int bench_rom(const struct settings *s, const char *name, uint8_t *data, uint16_t num_bytes,
+                     struct result *results, size_t *num_results);
+static int bench_traced(const struct settings *s, const char *name, uint8_t *data, uint16_t num_bytes,
+                        struct result *results, size_t *num_results);
+static int bench_lifecycle(const struct settings *s, struct result *results, size_t *num_results);
+static double measure(const struct settings *s, void (*body)(struct context *, uint64_t),
+                      struct context *ctx);
+static void run_op(struct context *ctx, uint64_t n);
+static void run_cycles(struct context *ctx, uint64_t n);
+static void run_traced(struct context *ctx, uint64_t n);
+static void run_initialise(struct context *ctx, uint64_t n);
+static void run_in_place(struct context *ctx, uint64_t n);
+static void run_pool(struct context *ctx, uint64_t n);
+static int wanted(const struct settings *s, const char *name);
+static int add_result(struct result *results, size_t *num_results, const char *name, const char *unit, double value);
+static int write_results(const char *path, const struct result *results, size_t num_results);
+static int compare_results(const char *path, const struct result *results, size_t num_results, double threshold);
+static double now_seconds(void);
+static void print_help(const char *name);
+
+int
+main(int argc, char *argv[])
+{
+    struct settings s;
+    struct result *results;
+    struct rom *r;
+    size_t num_results = 0, i;
+    const char *output_path = NULL, *baseline_path = NULL;
+    double threshold = DEFAULT_THRESHOLD;
+    int failed = 0, opt;
+
+    s.min_seconds = DEFAULT_MIN_SECONDS;
+    s.reps = DEFAULT_REPS;
+    s.filter = NULL;
+
+    while ((opt = getopt(argc, argv, "o:b:t:s:n:f:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'b':
+                baseline_path = optarg;
+                break;
+            case 't':
+                threshold = strtod(optarg, NULL);
+                break;
+            case 's':
+                s.min_seconds = strtod(optarg, NULL);
+                break;
+            case 'n':
+                s.reps = (int)strtol(optarg, NULL, 10);
+                break;
+            case 'f':
+                s.filter = optarg;
+                break;
+            case 'h':
+                print_help(argv[0]);
+                exit(0);
+            default:
+                fprintf(stderr, "Try '%s -h' for more information.\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (s.min_seconds <= 0 || s.reps < 1 || threshold < 0)
+    {
+        fprintf(stderr, "-s, -n and -t must be positive\n");
+        exit(1);
+    }
+
+    results = calloc(MAX_RESULTS, sizeof(struct result));
+    if (results == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    failed |= bench_ops(&s, results, &num_results);
+    for (i = 0; i < sizeof(synthetic_roms) / sizeof(synthetic_roms[0]); i++)
+    {
+        failed |= bench_rom(&s, synthetic_roms[i].name, synthetic_roms[i].data,
+                            synthetic_roms[i].num_bytes, results, &num_results);
+    }
+    for (i = (size_t)optind; i < (size_t)argc; i++)
+    {
+        r = read_rom(argv[i]);
+        if (r == NULL)
+        {
+            failed = 1;
+            continue;
+        }
+        failed |= bench_rom(&s, argv[i], r->data, r->num_bytes, results, &num_results);
+        free_rom(r);
+    }
+    failed |= bench_lifecycle(&s, results, &num_results);
+
+    if (write_results(output_path, results, num_results) != 0)
+    {
+        failed = 1;
+    }
+    if (baseline_path != NULL && compare_results(baseline_path, results, num_results, threshold) != 0)
+    {
+        failed = 1;
+    }
+    free(results);
+    return failed;
+}
+
+static int
+bench_ops(const struct settings *s, struct result *results, size_t *num_results)
+{
+    struct context ctx;
+    const struct op_case *c;
+    size_t i;
+    int failed = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    for (i = 0; i < sizeof(op_cases) / sizeof(op_cases[0]); i++)
+    {
+        c = &op_cases[i];
+        if (!wanted(s, c->name))
+        {
+            continue;
+        }
+        ctx.p = initialise_chip8(CHIP8_CLOCK_RATE_600Hz);
+        if (ctx.p == NULL)
+        {
+            fprintf(stderr, "could not set up %s\n", c->name);
+            failed = 1;
+            continue;
+        }
+        /* solid sprite rows to draw, and a screen half full to draw on */
+        memset(&ctx.p->mem[0x300], 0xFF, 16);
+        memset(ctx.p->fbuff, 0x5A, sizeof(ctx.p->fbuff));
+        ctx.p->stack[0] = PROGRAM_START_ADDRESS;
+        ctx.p->V[(c->opcode >> 8) & 0xF] = c->vx;
+        ctx.p->V[(c->opcode >> 4) & 0xF] = c->vy;
+        ctx.c = c;
+        ctx.handler = op_handler_table[classify_opcode(c->opcode)];
+        failed |= add_result(results, num_results, c->name, "ns", measure(s, run_op, &ctx) * 1e9);
+        free_chip8(ctx.p);
+    }
+    return failed;
+}
+
+static int
+bench_rom(const struct settings *s, const char *name, uint8_t *data, uint16_t num_bytes,
+          struct result *results, size_t *num_results)
+{
+    struct context ctx;
+    char full_name[MAX_NAME];
+    size_t i;
+    int failed = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    for (i = 0; i < sizeof(exec_modes) / sizeof(exec_modes[0]); i++)
+    {
+        snprintf(full_name, sizeof(full_name), "rom/%s/%s", name, exec_modes[i].name);
+        if (!wanted(s, full_name))
+        {
+            continue;
+        }
+        ctx.p = initialise_chip8(CHIP8_CLOCK_RATE_600Hz);
+        if (ctx.p == NULL || load_rom_chip8(ctx.p, data, num_bytes) != 0)
+        {
+            fprintf(stderr, "could not set up %s\n", full_name);
+            failed = 1;
+        }
+        else if (set_exec_mode_chip8(ctx.p, exec_modes[i].mode) != 0)
+        {
+            /* the JIT isn't built in */
+        }
+        else
+        {
+            failed |= add_result(results, num_results, full_name, "MIPS", 1e-6 / measure(s, run_cycles, &ctx));
+        }
+        if (ctx.p != NULL)
+        {
+            free_chip8(ctx.p);
+        }
+    }
+    snprintf(full_name, sizeof(full_name), "rom/%s/traced", name);
+    if (wanted(s, full_name))
+    {
+        failed |= bench_traced(s, full_name, data, num_bytes, results, num_results);
+    }
+    return failed;
+}
+
+static int
+bench_traced(const struct settings *s, const char *name, uint8_t *data, uint16_t num_bytes,
+             struct result *results, size_t *num_results)
+{
+    struct context ctx;
+    int failed = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.p = initialise_chip8(CHIP8_CLOCK_RATE_600Hz);
+    ctx.trace = initialise_trace_chip8(TRACE_CAPACITY);
+    ctx.records = malloc(TRACE_CAPACITY * sizeof(struct chip8_trace_record));
+    if (ctx.p == NULL || ctx.trace == NULL || ctx.records == NULL || load_rom_chip8(ctx.p, data, num_bytes) != 0)
+    {
+        fprintf(stderr, "could not set up %s\n", name);
+        failed = 1;
+    }
+    else
+    {
+        attach_trace_chip8(ctx.p, ctx.trace);
+        failed |= add_result(results, num_results, name, "MIPS", 1e-6 / measure(s, run_traced, &ctx));
+        if (get_dropped_trace_chip8(ctx.trace) != 0)
+        {
+            fprintf(stderr, "%s dropped trace records\n", name);
+        }
+    }
+    if (ctx.p != NULL)
+    {
+        free_chip8(ctx.p);
+    }
+    free_trace_chip8(ctx.trace);
+    free(ctx.records);
+    return failed;
+}
+
+static int
+bench_lifecycle(const struct settings *s, struct result *results, size_t *num_results)
+{
+    struct context ctx;
+    int failed = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    if (wanted(s, "lifecycle/initialise+free"))
+    {
+        failed |= add_result(results, num_results, "lifecycle/initialise+free", "ns",
+                             measure(s, run_initialise, &ctx) * 1e9);
+    }
+    if (wanted(s, "lifecycle/in-place"))
+    {
+        ctx.mem = malloc(sizeof_chip8());
+        if (ctx.mem == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        failed |= add_result(results, num_results, "lifecycle/in-place", "ns",
+                             measure(s, run_in_place, &ctx) * 1e9);
+        free(ctx.mem);
+    }
+    if (wanted(s, "lifecycle/pool"))
+    {
+        ctx.pool = initialise_pool_chip8(16, CHIP8_CLOCK_RATE_600Hz);
+        if (ctx.pool == NULL)
+        {
+            fprintf(stderr, "could not create a pool\n");
+            return 1;
+        }
+        failed |= add_result(results, num_results, "lifecycle/pool", "ns",
+                             measure(s, run_pool, &ctx) * 1e9);
+        free_pool_chip8(ctx.pool);
+    }
+    return failed;
+}
+
+static double
+measure(const struct settings *s, void (*body)(struct context *, uint64_t), struct context *ctx)
+{
+    /* Returns the best seconds per unit of work over the reps. The number of
+       units per rep is worked up to until a run is long enough to time, then
+       scaled so the reps take about min_seconds between them. */
+    uint64_t n = 64;
+    double elapsed, start, best;
+    int i;
+
+    for (;;)
+    {
+        start = now_seconds();
+        body(ctx, n);
+        elapsed = now_seconds() - start;
+        if (elapsed >= 0.01 || n >= (UINT64_C(1) << 40))
+        {
+            break;
+        }
+        n *= elapsed > 0.001 ? 4 : 16;
+    }
+    if (elapsed > 0 && s->min_seconds / s->reps > elapsed)
+    {
+        n = (uint64_t)(n * (s->min_seconds / s->reps / elapsed));
+    }
+    best = 0;
+    for (i = 0; i < s->reps; i++)
+    {
+        start = now_seconds();
+        body(ctx, n);
+        elapsed = now_seconds() - start;
+        if (i == 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    return best / n;
+}
+
+static void
+run_op(struct context *ctx, uint64_t n)
+{
+    struct chip8 *p = ctx->p;
+    void (*handler)(struct chip8 *, uint16_t) = ctx->handler;
+    uint16_t opcode = ctx->c->opcode, I = ctx->c->I;
+
+    for (; n > 0; n--)
+    {
+        p->pc = PROGRAM_START_ADDRESS;
+        p->sp = 1;
+        p->I = I;
+        p->waiting_for_key = 0;
+        handler(p, opcode);
+    }
+}
+
+static void
+run_cycles(struct context *ctx, uint64_t n)
+{
+    uint32_t budget;
+
+    /* returns early on a draw, key wait or timer clock, as a frontend's loop
+       would */
+    while (n > 0)
+    {
+        budget = n < UINT32_MAX ? (uint32_t)n : UINT32_MAX;
+        n -= execute_cycles_chip8(ctx->p, budget, NULL);
+    }
+}
+
+static void
+run_traced(struct context *ctx, uint64_t n)
+{
+    uint32_t budget;
+
+    /* drains the ring after every run, before it can fill, as a reader
+       thread keeping up would */
+    while (n > 0)
+    {
+        budget = n < TRACE_CAPACITY ? (uint32_t)n : TRACE_CAPACITY;
+        n -= execute_cycles_chip8(ctx->p, budget, NULL);
+        while (read_trace_chip8(ctx->trace, ctx->records, TRACE_CAPACITY) != 0)
+        {
+        }
+    }
+}
+
+static void
+run_initialise(struct context *ctx, uint64_t n)
+{
+    (void)ctx;
+    for (; n > 0; n--)
+    {
+        free_chip8(initialise_chip8(CHIP8_CLOCK_RATE_600Hz));
+    }
+}
+
+static void
+run_in_place(struct context *ctx, uint64_t n)
+{
+    for (; n > 0; n--)
+    {
+        free_chip8(initialise_chip8_in_place(ctx->mem, CHIP8_CLOCK_RATE_600Hz));
+    }
+}
+
+static void
+run_pool(struct context *ctx, uint64_t n)
+{
+    for (; n > 0; n--)
+    {
+        release_pool_chip8(ctx->pool, acquire_pool_chip8(ctx->pool));
+    }
+}
+
+static int
+wanted(const struct settings *s, const char *name)
+{
+    return s->filter == NULL || strstr(name, s->filter) != NULL;
+}
+
+static int
+add_result(struct result *results, size_t *num_results, const char *name, const char *unit, double value)
+{
+    if (*num_results == MAX_RESULTS)
+    {
+        fprintf(stderr, "too many results, %s dropped\n", name);
+        return 1;
+    }
+    snprintf(results[*num_results].name, MAX_NAME, "%s", name);
+    results[*num_results].unit = unit;
+    results[*num_results].value = value;
+    (*num_results)++;
+    fprintf(stderr, "%-40s %12.3f %s\n", name, value, unit);
+    return 0;
+}
+
+static void
+write_json_string(FILE *outfile, const char *str)
+{
+    /* ROM paths are the only names that aren't ours */
+    fputc('"', outfile);
+    for (; *str != '\0'; str++)
+    {
+        if (*str == '"' || *str == '\\')
+        {
+            fputc('\\', outfile);
+        }
+        fputc((unsigned char)*str < 0x20 ? '?' : *str, outfile);
+    }
+    fputc('"', outfile);
+}
+
+static int
+write_results(const char *path, const struct result *results, size_t num_results)
+{
+    /* one result per line, compare_results() depends on that */
+    FILE *outfile;
+    size_t i;
+
+    outfile = path != NULL ? fopen(path, "w") : stdout;
+    if (outfile == NULL)
+    {
+        fprintf(stderr, "could not open: %s\n", path);
+        return 1;
+    }
+    fprintf(outfile, "{\n  \"benchmark\": \"chip8emu_bench\",\n  \"results\": [\n");
+    for (i = 0; i < num_results; i++)
+    {
+        fprintf(outfile, "    {\"name\": ");
+        write_json_string(outfile, results[i].name);
+        fprintf(outfile, ", \"unit\": \"%s\", \"value\": %.6g}%s\n",
+                results[i].unit, results[i].value, i + 1 < num_results ? "," : "");
+    }
+    fprintf(outfile, "  ]\n}\n");
+    if (path != NULL && fclose(outfile) != 0)
+    {
+        fprintf(stderr, "could not write %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+static int
+compare_results(const char *path, const struct result *results, size_t num_results, double threshold)
+{
+    /* Reads a file written by write_results(). A result is a regression if
+       it is more than threshold percent worse than the baseline, results
+       only in one of the two are listed but don't count. */
+    FILE *infile;
+    char line[512], name[MAX_NAME], unit[16];
+    double baseline, change;
+    size_t i, num_regressions = 0, num_compared = 0;
+    int regressed;
+
+    infile = fopen(path, "r");
+    if (infile == NULL)
+    {
+        fprintf(stderr, "could not open: %s\n", path);
+        return 1;
+    }
+    fprintf(stderr, "\n%-40s %12s %12s %8s\n", "compared to baseline", "baseline", "now", "change");
+    while (fgets(line, sizeof(line), infile) != NULL)
+    {
+        if (sscanf(line, " {\"name\": \"%127[^\"]\", \"unit\": \"%15[^\"]\", \"value\": %lf", name, unit, &baseline) != 3)
+        {
+            continue;
+        }
+        for (i = 0; i < num_results && strcmp(results[i].name, name) != 0; i++)
+        {
+        }
+        if (i == num_results || strcmp(results[i].unit, unit) != 0 || baseline <= 0)
+        {
+            fprintf(stderr, "%-40s %12.3f %12s\n", name, baseline, "-");
+            continue;
+        }
+        /* positive is better */
+        change = strcmp(unit, "MIPS") == 0 ? results[i].value / baseline - 1 : baseline / results[i].value - 1;
+        regressed = change * 100 < -threshold;
+        num_regressions += regressed;
+        num_compared++;
+        fprintf(stderr, "%-40s %12.3f %12.3f %+7.1f%%%s\n", name, baseline, results[i].value,
+                change * 100, regressed ? "  REGRESSION" : "");
+    }
+    fclose(infile);
+    fprintf(stderr, "%zu of %zu results more than %.1f%% worse than %s\n",
+            num_regressions, num_compared, threshold, path);
+    return num_regressions != 0;
+}
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+print_help(const char *name)
+{
+    printf("CHIP-8 emulator benchmarks\n");
+    printf("Usage: %s [options] [ROM_FILE]...\n", name);
+    printf("\nOptions:\n");
+    printf("  -o <file>     write the results as JSON to a file (default stdout)\n");
+    printf("  -b <file>     compare against the results of an earlier run, exit 1\n");
+    printf("                if any are worse than the threshold\n");
+    printf("  -t <percent>  regression threshold for -b (default %.0f)\n", DEFAULT_THRESHOLD);
+    printf("  -s <seconds>  time spent on each benchmark (default %.1f)\n", DEFAULT_MIN_SECONDS);
+    printf("  -n <reps>     repetitions of each benchmark, the best is kept (default %d)\n", DEFAULT_REPS);
+    printf("  -f <text>     only run benchmarks with this in their name\n");
+    printf("\nRuns the cost of each instruction in ns (op/...), the throughput of the\n");
+    printf("synthetic ROMs and any ROMs given in each execution mode in MIPS (rom/...)\n");
+    printf("and the cost of creating an emulator in ns (lifecycle/...).\n");
+}
@@ -0,0 +1,744 @@
+/*
+A headless batch runner for regression testing and benchmarking. Each job
+runs a ROM (optionally with scripted key presses) for a fixed number of cycles
+or frames without any display or timing, and the jobs are spread over a pool
+of threads.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "chip8.h"
+#include "roms.h"
+#include "trace_file.h"
+
+#define DEFAULT_FRAMES 600
+#define TRACE_CAPACITY (1u << 16)
+#define TRACE_CHUNK 4096
+
+struct input_event
+{
+    uint64_t cycle;
+    uint8_t key;
+    uint8_t state;
+};
+
+struct job
+{
+    /* inputs */
+    const char *rom_path;
+    const char *input_path;
+    /* results */
+    int failed;
+    uint64_t cycles;
+    uint64_t frames;
+    double seconds;
+    uint64_t fbuff_hash;
+    uint64_t state_digest;
+};
+
+struct settings
+{
+    uint64_t max_cycles;
+    uint64_t max_frames;
+    uint32_t clock_hz;
+    enum chip8_exec_mode mode;
+    int movies_to_end;                      /* no budget was given, run movies to their end */
+    const char *record_path;                /* record the (only) job as an input movie */
+    const char *trace_path;                 /* trace the (only) job to this file */
+};
+
+/* drains an emulator's trace ring to a file on its own thread */
+struct tracer
+{
+    struct chip8_trace *trace;
+    FILE *file;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int done;                               /* the emulator has stopped, under lock */
+    int failed;
+};
+
+struct pool
+{
+    pthread_mutex_t lock;
+    struct job *jobs;
+    size_t num_jobs;
+    size_t next_job;
+    const struct settings *settings;
+};
+
+static void run_job(struct job *j, const struct settings *s);
+static void *worker(void *arg);
+static int start_tracer(struct tracer *tr, struct chip8 *p, const char *path);
+static int stop_tracer(struct tracer *tr, struct chip8 *p);
+static void *drain_trace(void *arg);
+static int is_movie_file(const char *path);
+static int read_input_file(const char *path, struct input_event **events, size_t *num_events);
+static int read_job_list(const char *path, struct job **jobs, size_t *num_jobs, size_t *capacity);
+static int add_job(struct job **jobs, size_t *num_jobs, size_t *capacity, const char *rom_path, const char *input_path);
+static uint64_t hash_framebuffer(const uint64_t *rows);
+static double now_seconds(void);
+static void print_help(const char *name);
+
+int
+main(int argc, char *argv[])
+{
+    struct settings s;
+    struct pool pool;
+    struct job *jobs = NULL;
+    size_t num_jobs = 0, capacity = 0, i;
+    const char *input_path = NULL;
+    long num_threads, hz;
+    pthread_t *threads;
+    uint64_t total_cycles;
+    double start, elapsed;
+    int failed, opt;
+
+    s.max_cycles = 0;
+    s.max_frames = 0;
+    s.clock_hz = CHIP8_CLOCK_RATE_600Hz * 60;
+    s.mode = CHIP8_EXEC_INTERPRETER;
+    s.movies_to_end = 0;
+    s.record_path = NULL;
+    s.trace_path = NULL;
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt(argc, argv, "c:f:i:l:r:m:j:w:t:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                s.max_cycles = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                s.max_frames = strtoull(optarg, NULL, 10);
+                break;
+            case 'i':
+                input_path = optarg;
+                break;
+            case 'l':
+                if (read_job_list(optarg, &jobs, &num_jobs, &capacity) != 0)
+                {
+                    exit(1);
+                }
+                break;
+            case 'r':
+                hz = strtol(optarg, NULL, 10);
+                if (hz < CHIP8_MIN_CLOCK_HZ || hz > CHIP8_MAX_CLOCK_HZ)
+                {
+                    fprintf(stderr, "clock rate must be from %d to %dHz\n", CHIP8_MIN_CLOCK_HZ, CHIP8_MAX_CLOCK_HZ);
+                    exit(1);
+                }
+                s.clock_hz = (uint32_t)hz;
+                break;
+            case 'm':
+                if (strcmp(optarg, "interpreter") == 0)
+                    s.mode = CHIP8_EXEC_INTERPRETER;
+                else if (strcmp(optarg, "blocks") == 0)
+                    s.mode = CHIP8_EXEC_BLOCKS;
+                else if (strcmp(optarg, "jit") == 0)
+                    s.mode = CHIP8_EXEC_JIT;
+                else if (strcmp(optarg, "jit-checked") == 0)
+                    s.mode = CHIP8_EXEC_JIT_CHECKED;
+                else
+                {
+                    fprintf(stderr, "unknown execution mode: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'j':
+                num_threads = strtol(optarg, NULL, 10);
+                break;
+            case 'w':
+                s.record_path = optarg;
+                break;
+            case 't':
+                s.trace_path = optarg;
+                break;
+            case 'h':
+                print_help(argv[0]);
+                exit(0);
+            default:
+                fprintf(stderr, "Try '%s -h' for more information.\n", argv[0]);
+                exit(1);
+        }
+    }
+    for (i = (size_t)optind; i < (size_t)argc; i++)
+    {
+        if (add_job(&jobs, &num_jobs, &capacity, argv[i], input_path) != 0)
+        {
+            exit(1);
+        }
+    }
+    if (num_jobs == 0)
+    {
+        fprintf(stderr, "usage:\n\t%s [options] <ROM_FILE>...\n", argv[0]);
+        fprintf(stderr, "Try '%s -h' for more information.\n", argv[0]);
+        exit(1);
+    }
+    if (s.record_path != NULL && num_jobs != 1)
+    {
+        fprintf(stderr, "-w records a single ROM\n");
+        exit(1);
+    }
+    if (s.trace_path != NULL && num_jobs != 1)
+    {
+        fprintf(stderr, "-t traces a single ROM\n");
+        exit(1);
+    }
+    if (s.max_cycles == 0 && s.max_frames == 0)
+    {
+        s.max_frames = DEFAULT_FRAMES;
+        s.movies_to_end = 1;
+    }
+    if (num_threads < 1)
+    {
+        num_threads = 1;
+    }
+    if ((size_t)num_threads > num_jobs)
+    {
+        num_threads = (long)num_jobs;
+    }
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pool.jobs = jobs;
+    pool.num_jobs = num_jobs;
+    pool.next_job = 0;
+    pool.settings = &s;
+
+    threads = malloc(sizeof(pthread_t) * (size_t)num_threads);
+    if (threads == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    start = now_seconds();
+    for (i = 0; i < (size_t)num_threads; i++)
+    {
+        if (pthread_create(&threads[i], NULL, worker, &pool) != 0)
+        {
+            fprintf(stderr, "could not create thread %zu\n", i);
+            exit(1);
+        }
+    }
+    for (i = 0; i < (size_t)num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    elapsed = now_seconds() - start;
+    pthread_mutex_destroy(&pool.lock);
+
+    /* report in the order the jobs were given, so runs can be diffed */
+    printf("rom\tinput\tcycles\tframes\tseconds\tcycles_per_s\tfbuff_hash\tstate_digest\n");
+    total_cycles = 0;
+    failed = 0;
+    for (i = 0; i < num_jobs; i++)
+    {
+        struct job *j = &jobs[i];
+        if (j->failed)
+        {
+            printf("%s\t%s\tFAILED\n", j->rom_path, j->input_path ? j->input_path : "-");
+            failed = 1;
+            continue;
+        }
+        printf("%s\t%s\t%llu\t%llu\t%.6f\t%.0f\t%016llx\t%016llx\n",
+               j->rom_path, j->input_path ? j->input_path : "-",
+               (unsigned long long)j->cycles, (unsigned long long)j->frames,
+               j->seconds, j->seconds > 0 ? j->cycles / j->seconds : 0.0,
+               (unsigned long long)j->fbuff_hash, (unsigned long long)j->state_digest);
+        total_cycles += j->cycles;
+    }
+    fprintf(stderr, "%zu jobs on %ld threads: %llu cycles in %.3fs (%.0f cycles/s)\n",
+            num_jobs, num_threads, (unsigned long long)total_cycles, elapsed,
+            elapsed > 0 ? total_cycles / elapsed : 0.0);
+
+    free(threads);
+    free(jobs);
+    return failed;
+}
+
+static void *
+worker(void *arg)
+{
+    struct pool *pool = arg;
+    struct job *j;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        j = pool->next_job < pool->num_jobs ? &pool->jobs[pool->next_job++] : NULL;
+        pthread_mutex_unlock(&pool->lock);
+        if (j == NULL)
+        {
+            return NULL;
+        }
+        run_job(j, pool->settings);
+    }
+}
+
+static void
+run_job(struct job *j, const struct settings *s)
+{
+    struct chip8 *p;
+    struct chip8_io *chip8_io;
+    struct chip8_movie *movie = NULL;
+    struct rom *r;
+    struct input_event *events = NULL;
+    struct tracer tracer;
+    size_t num_events = 0, next_event = 0;
+    uint64_t budget, skip_budget;
+    uint32_t n, clocks;
+    unsigned int reason;
+    double start;
+    int replaying, movie_over = 0;
+
+    j->failed = 1;
+    replaying = j->input_path != NULL && s->record_path == NULL && is_movie_file(j->input_path);
+    if (j->input_path != NULL && !replaying && read_input_file(j->input_path, &events, &num_events) != 0)
+    {
+        return;
+    }
+    r = read_rom(j->rom_path);
+    if (r == NULL)
+    {
+        free(events);
+        return;
+    }
+    p = initialise_chip8(CHIP8_CLOCK_RATE_600Hz);
+    if (p == NULL || change_clock_hz_chip8(p, s->clock_hz) != 0
+        || load_rom_chip8(p, r->data, r->num_bytes) != 0
+        || set_exec_mode_chip8(p, s->mode) != 0)
+    {
+        fprintf(stderr, "could not set up %s\n", j->rom_path);
+        if (p != NULL)
+        {
+            free_chip8(p);
+        }
+        free_rom(r);
+        free(events);
+        return;
+    }
+    chip8_io = get_io_chip8(p);
+    if (s->record_path != NULL)
+    {
+        movie = record_movie_chip8(p, s->record_path);
+        if (movie == NULL)
+        {
+            fprintf(stderr, "could not record to %s\n", s->record_path);
+            free_chip8(p);
+            free_rom(r);
+            free(events);
+            return;
+        }
+    }
+    else if (replaying)
+    {
+        movie = replay_movie_chip8(p, j->input_path);
+        if (movie == NULL)
+        {
+            fprintf(stderr, "could not replay %s, was it recorded with %s at this clock rate?\n",
+                    j->input_path, j->rom_path);
+            free_chip8(p);
+            free_rom(r);
+            return;
+        }
+    }
+
+    if (s->trace_path != NULL && start_tracer(&tracer, p, s->trace_path) != 0)
+    {
+        if (movie != NULL)
+        {
+            end_movie_chip8(movie);
+        }
+        free_chip8(p);
+        free_rom(r);
+        free(events);
+        return;
+    }
+
+    j->cycles = 0;
+    j->frames = 0;
+    start = now_seconds();
+    while (replaying && !movie_over)
+    {
+        /* the movie sets the keys, run until it ends or the budget runs out */
+        if (!s->movies_to_end && ((s->max_cycles != 0 && j->cycles >= s->max_cycles)
+                                  || (s->max_frames != 0 && j->frames >= s->max_frames)))
+        {
+            break;
+        }
+        budget = UINT32_MAX;
+        if (!s->movies_to_end && s->max_cycles != 0 && s->max_cycles - j->cycles < budget)
+        {
+            budget = s->max_cycles - j->cycles;
+        }
+        n = execute_cycles_movie_chip8(movie, (uint32_t)budget, &reason);
+        movie_over = n == 0;
+        j->cycles += n;
+        if (reason & CHIP8_EXIT_TIMER)
+        {
+            j->frames++;
+        }
+    }
+    while (!replaying && (s->max_cycles == 0 || j->cycles < s->max_cycles)
+           && (s->max_frames == 0 || j->frames < s->max_frames))
+    {
+        /* apply any key changes due before the next cycle */
+        while (next_event < num_events && events[next_event].cycle <= j->cycles)
+        {
+            chip8_io->keypad_state[events[next_event].key] = events[next_event].state;
+            next_event++;
+        }
+        /* run up to the next key change or the end of the budget */
+        budget = UINT32_MAX;
+        if (s->max_cycles != 0 && s->max_cycles - j->cycles < budget)
+        {
+            budget = s->max_cycles - j->cycles;
+        }
+        if (next_event < num_events && events[next_event].cycle - j->cycles < budget)
+        {
+            budget = events[next_event].cycle - j->cycles;
+        }
+        if (movie == NULL && get_key_wait_chip8(p, NULL))
+        {
+            /* blocked on a key, skip straight to the next key change, leaving
+               the last frame to be run normally so the run ends where it
+               always would */
+            skip_budget = budget;
+            if (s->max_frames != 0 && (s->max_frames - j->frames - 1) * s->clock_hz / 60 < skip_budget)
+            {
+                skip_budget = (s->max_frames - j->frames - 1) * s->clock_hz / 60;
+            }
+            n = skip_key_wait_chip8(p, (uint32_t)skip_budget, &clocks);
+            if (n != 0)
+            {
+                j->cycles += n;
+                j->frames += clocks;
+                continue;
+            }
+        }
+        if (movie != NULL)
+        {
+            j->cycles += execute_cycles_movie_chip8(movie, (uint32_t)budget, &reason);
+        }
+        else
+        {
+            j->cycles += execute_cycles_chip8(p, (uint32_t)budget, &reason);
+        }
+        if (reason & CHIP8_EXIT_TIMER)
+        {
+            j->frames++;
+        }
+    }
+    j->seconds = now_seconds() - start;
+    j->fbuff_hash = hash_framebuffer(get_framebuffer_rows_chip8(p));
+    j->state_digest = get_state_digest_chip8(p);
+    j->failed = 0;
+    if (s->trace_path != NULL && stop_tracer(&tracer, p) != 0)
+    {
+        fprintf(stderr, "could not write %s\n", s->trace_path);
+        j->failed = 1;
+    }
+    if (movie != NULL && !replaying && end_movie_chip8(movie) != 0)
+    {
+        fprintf(stderr, "could not write %s\n", s->record_path);
+        j->failed = 1;
+    }
+    else if (movie != NULL && replaying && end_movie_chip8(movie) != 0 && movie_over)
+    {
+        fprintf(stderr, "%s did not end in the recorded state\n", j->input_path);
+        j->failed = 1;
+    }
+
+    free_chip8(p);
+    free_rom(r);
+    free(events);
+}
+
+static int
+start_tracer(struct tracer *tr, struct chip8 *p, const char *path)
+{
+    tr->trace = initialise_trace_chip8(TRACE_CAPACITY);
+    tr->file = fopen(path, "wb");
+    tr->done = 0;
+    tr->failed = 0;
+    if (tr->trace == NULL || tr->file == NULL || write_trace_header(tr->file) != 0)
+    {
+        fprintf(stderr, "could not trace to %s\n", path);
+        if (tr->file != NULL)
+        {
+            fclose(tr->file);
+        }
+        free_trace_chip8(tr->trace);
+        return 1;
+    }
+    pthread_mutex_init(&tr->lock, NULL);
+    attach_trace_chip8(p, tr->trace);
+    if (pthread_create(&tr->thread, NULL, drain_trace, tr) != 0)
+    {
+        fprintf(stderr, "could not create the trace thread\n");
+        attach_trace_chip8(p, NULL);
+        pthread_mutex_destroy(&tr->lock);
+        fclose(tr->file);
+        free_trace_chip8(tr->trace);
+        return 1;
+    }
+    return 0;
+}
+
+static int
+stop_tracer(struct tracer *tr, struct chip8 *p)
+{
+    uint64_t dropped;
+
+    attach_trace_chip8(p, NULL);
+    pthread_mutex_lock(&tr->lock);
+    tr->done = 1;
+    pthread_mutex_unlock(&tr->lock);
+    pthread_join(tr->thread, NULL);
+    pthread_mutex_destroy(&tr->lock);
+    dropped = get_dropped_trace_chip8(tr->trace);
+    if (dropped != 0)
+    {
+        fprintf(stderr, "%llu trace records were dropped, the file couldn't keep up\n",
+                (unsigned long long)dropped);
+    }
+    free_trace_chip8(tr->trace);
+    if (fclose(tr->file) != 0)
+    {
+        tr->failed = 1;
+    }
+    return tr->failed;
+}
+
+static void *
+drain_trace(void *arg)
+{
+    /* write out whatever is in the ring, napping when it is empty, until
+       the emulator has stopped and the ring is empty */
+    struct tracer *tr = arg;
+    struct chip8_trace_record *records;
+    struct timespec nap = { 0, 100000 };
+    uint32_t n;
+    int done;
+
+    records = malloc(TRACE_CHUNK * sizeof(struct chip8_trace_record));
+    if (records == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        tr->failed = 1;
+        return NULL;
+    }
+    for (;;)
+    {
+        pthread_mutex_lock(&tr->lock);
+        done = tr->done;
+        pthread_mutex_unlock(&tr->lock);
+        n = read_trace_chip8(tr->trace, records, TRACE_CHUNK);
+        if (n != 0 && !tr->failed && write_trace_records(tr->file, records, n) != 0)
+        {
+            tr->failed = 1;
+        }
+        if (n == 0 && done)
+        {
+            break;
+        }
+        if (n < TRACE_CHUNK && !done)
+        {
+            nanosleep(&nap, NULL);
+        }
+    }
+    free(records);
+    return NULL;
+}
+
+static int
+is_movie_file(const char *path)
+{
+    /* input movies start with "C8MV", anything else is a text input file */
+    FILE *infile;
+    char magic[4];
+    int is_movie;
+
+    infile = fopen(path, "rb");
+    if (infile == NULL)
+    {
+        return 0;
+    }
+    is_movie = fread(magic, 1, 4, infile) == 4 && memcmp(magic, "C8MV", 4) == 0;
+    fclose(infile);
+    return is_movie;
+}
+
+static int
+read_input_file(const char *path, struct input_event **events, size_t *num_events)
+{
+    /* Each line is "<cycle> <key> <state>": before the given cycle (counting
+       from 0) set the key (hex 0-F) to the state (1 down, 0 up). Lines must be
+       in cycle order, blank lines and lines starting with # are ignored. */
+    FILE *infile;
+    char line[256];
+    unsigned long long cycle;
+    unsigned int key, state;
+    size_t capacity = 0, line_number = 0;
+    struct input_event *e = NULL, *grown;
+
+    *events = NULL;
+    *num_events = 0;
+    infile = fopen(path, "r");
+    if (infile == NULL)
+    {
+        fprintf(stderr, "could not open: %s\n", path);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), infile) != NULL)
+    {
+        line_number++;
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#')
+        {
+            continue;
+        }
+        if (sscanf(line, "%llu %x %u", &cycle, &key, &state) != 3 || key > 0xF || state > 1
+            || (*num_events > 0 && cycle < e[*num_events - 1].cycle))
+        {
+            fprintf(stderr, "%s:%zu: expected \"<cycle> <key> <0|1>\" in cycle order\n", path, line_number);
+            fclose(infile);
+            free(e);
+            *num_events = 0;
+            return 1;
+        }
+        if (*num_events == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            grown = realloc(e, capacity * sizeof(struct input_event));
+            if (grown == NULL)
+            {
+                fprintf(stderr, "out of memory\n");
+                fclose(infile);
+                free(e);
+                *num_events = 0;
+                return 1;
+            }
+            e = grown;
+        }
+        e[*num_events].cycle = cycle;
+        e[*num_events].key = (uint8_t)key;
+        e[*num_events].state = (uint8_t)state;
+        (*num_events)++;
+    }
+    fclose(infile);
+    *events = e;
+    return 0;
+}
+
+static int
+read_job_list(const char *path, struct job **jobs, size_t *num_jobs, size_t *capacity)
+{
+    /* Each line is "<rom> [input file]", blank lines and lines starting with
+       # are ignored. The strings are kept for the life of the program. */
+    FILE *infile;
+    char line[4096], *rom_path, *input_path;
+
+    infile = fopen(path, "r");
+    if (infile == NULL)
+    {
+        fprintf(stderr, "could not open: %s\n", path);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), infile) != NULL)
+    {
+        rom_path = strtok(line, " \t\r\n");
+        if (rom_path == NULL || rom_path[0] == '#')
+        {
+            continue;
+        }
+        input_path = strtok(NULL, " \t\r\n");
+        rom_path = strdup(rom_path);
+        input_path = input_path ? strdup(input_path) : NULL;
+        if (rom_path == NULL || add_job(jobs, num_jobs, capacity, rom_path, input_path) != 0)
+        {
+            fclose(infile);
+            return 1;
+        }
+    }
+    fclose(infile);
+    return 0;
+}
+
+static int
+add_job(struct job **jobs, size_t *num_jobs, size_t *capacity, const char *rom_path, const char *input_path)
+{
+    struct job *grown;
+
+    if (*num_jobs == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        grown = realloc(*jobs, *capacity * sizeof(struct job));
+        if (grown == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        *jobs = grown;
+    }
+    memset(&(*jobs)[*num_jobs], 0, sizeof(struct job));
+    (*jobs)[*num_jobs].rom_path = rom_path;
+    (*jobs)[*num_jobs].input_path = input_path;
+    (*num_jobs)++;
+    return 0;
+}
+
+static uint64_t
+hash_framebuffer(const uint64_t *rows)
+{
+    /* 64-bit FNV-1a over the rows, most significant byte first */
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    int r, b;
+
+    for (r = 0; r < CHIP8_SCREEN_HEIGHT; r++)
+    {
+        for (b = 56; b >= 0; b -= 8)
+        {
+            hash ^= (rows[r] >> b) & 0xFF;
+            hash *= 0x100000001B3ULL;
+        }
+    }
+    return hash;
+}
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+print_help(const char *name)
+{
+    printf("CHIP-8 headless batch runner\n");
+    printf("Usage: %s [options] <ROM_FILE>...\n", name);
+    printf("\nOptions:\n");
+    printf("  -c <cycles>   stop each run after this many cycles\n");
+    printf("  -f <frames>   stop each run after this many 60Hz frames (default %d if no -c)\n", DEFAULT_FRAMES);
+    printf("  -i <file>     scripted input for the ROMs on the command line, either\n");
+    printf("                one \"<cycle> <key> <0|1>\" per line or an input movie\n");
+    printf("  -l <file>     read more jobs from a file, one \"<rom> [input file]\" per line\n");
+    printf("  -r <Hz>       clock rate, any whole number of Hz from 60 (default 600)\n");
+    printf("  -m <mode>     interpreter, blocks, jit or jit-checked (default interpreter)\n");
+    printf("  -j <threads>  number of worker threads (default: one per CPU)\n");
+    printf("  -w <file>     record the run of a single ROM as an input movie\n");
+    printf("  -t <file>     trace every instruction of a single ROM to a file, see\n");
+    printf("                chip8emu_trace\n");
+    printf("\nPrints one tab separated line per job with its throughput, a hash of the\n");
+    printf("final display and a digest of the final emulator state.\n");
+}
@@ -11,9 +11,24 @@
 
 #define WINDOW_WIDTH 1024
 #define WINDOW_HEIGHT 512
-#define PIXEL_SIZE 16
-
-static void draw_display(SDL_Renderer *renderer, struct chip8_io *io);
+#define PIXEL_ON 0xFFFFFFFF
+#define PIXEL_OFF 0xFF000000
+#define FRAME_RATE 60
+/* the most frames run at once to catch up, any more behind are dropped */
+#define MAX_CATCH_UP_FRAMES 4
+#define AUDIO_SAMPLE_RATE 48000
+/* samples per audio callback, 2.7ms */
+#define AUDIO_DEVICE_SAMPLES 128
+#define AUDIO_RING_SAMPLES 4096
+/* the most audio left queued after a callback, a frame: it is rendered a
+   frame at a time, so a beep waits behind at most this and the device's
+   callback, 928 samples or 19.3ms. Any more and the emulator has got ahead
+   of the audio device, so the oldest is skipped to keep the latency down. */
+#define AUDIO_MAX_QUEUED (AUDIO_SAMPLE_RATE / FRAME_RATE)
+
+static unsigned int run_movie_frame(struct chip8 *p, struct chip8_movie *movie, bool *movie_over);
+static void audio_callback(void *userdata, Uint8 *stream, int len);
+static void draw_display(SDL_Renderer *renderer, SDL_Texture *texture, const uint64_t *rows);
 static void update_chip8_keys(struct chip8_io *chip8_io, const Uint8 *keystate);
 static void update_window_title(SDL_Window *window, enum chip8_clock clock_rate, bool buzzer_active);
 static void print_help(const char *name);
@@ -24,14 +39,24 @@ main(int argc, char* argv[])
     struct chip8 *p;
     enum chip8_clock clock_rate;
     struct chip8_io *chip8_io;
+    struct chip8_movie *movie = NULL;
+    bool replaying = false;
     struct rom *r;
     const Uint8 *keystate;
     SDL_Window *window;
     SDL_Renderer *renderer;
+    SDL_Texture *texture;
     SDL_Event event;
     bool running = true;
-    Uint32 last_time, current_time;
-    float sleep_time_ms;
+    bool display_dirty = true;
+    bool buzzer_active = false, title_buzzer = false, movie_over;
+    unsigned int summary;
+    Uint64 counter_freq, last_counter, current_counter, lag;
+    Uint32 wait_ms;
+    void *audio_mem;
+    struct chip8_audio *audio;
+    SDL_AudioSpec audio_spec;
+    SDL_AudioDeviceID audio_device = 0;
 
     if (argc == 2 && (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0))
     {
@@ -39,9 +64,13 @@ main(int argc, char* argv[])
         exit(0);
     }
 
-    if (argc != 2)
+    if (argc == 4 && strcmp(argv[2], "--replay") == 0)
+    {
+        replaying = true;
+    }
+    else if (argc != 2 && !(argc == 4 && strcmp(argv[2], "--record") == 0))
     {
-        fprintf(stderr, "usage:\n\t%s <ROM_FILE>\n", argv[0]);
+        fprintf(stderr, "usage:\n\t%s <ROM_FILE> [--record|--replay <MOVIE_FILE>]\n", argv[0]);
         fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
         exit(1);
     }
@@ -75,14 +104,28 @@ main(int argc, char* argv[])
         exit(1);
     }
 
+    /* The display is drawn into a texture the size of the CHIP-8 screen and
+       stretched over the whole window */
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                CHIP8_SCREEN_WIDTH, CHIP8_SCREEN_HEIGHT);
+    if (texture == NULL)
+    {
+        fprintf(stderr, "Texture could not be created! SDL_Error: %s\n", SDL_GetError());
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        exit(1);
+    }
+
     /* Initialize CHIP-8 */
     clock_rate = CHIP8_CLOCK_RATE_600Hz;
-    sleep_time_ms = 1000.0f / (clock_rate * 60.0f);
     
     p = initialise_chip8(clock_rate);
     if (p == NULL)
     {
         fprintf(stderr, "Failed to initialize CHIP-8 emulator\n");
+        SDL_DestroyTexture(texture);
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         SDL_Quit();
@@ -97,6 +140,7 @@ main(int argc, char* argv[])
     {
         fprintf(stderr, "Failed to load ROM: %s\n", argv[1]);
         free_chip8(p);
+        SDL_DestroyTexture(texture);
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         SDL_Quit();
@@ -108,12 +152,56 @@ main(int argc, char* argv[])
         fprintf(stderr, "Failed to load ROM into CHIP-8\n");
         free_rom(r);
         free_chip8(p);
+        SDL_DestroyTexture(texture);
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         SDL_Quit();
         exit(1);
     }
 
+    /* Record or replay the keypad */
+    if (argc == 4)
+    {
+        movie = replaying ? replay_movie_chip8(p, argv[3]) : record_movie_chip8(p, argv[3]);
+        if (movie == NULL)
+        {
+            fprintf(stderr, "Failed to %s movie: %s\n", replaying ? "replay" : "record", argv[3]);
+            free_rom(r);
+            free_chip8(p);
+            SDL_DestroyTexture(texture);
+            SDL_DestroyRenderer(renderer);
+            SDL_DestroyWindow(window);
+            SDL_Quit();
+            exit(1);
+        }
+    }
+
+    /* The buzzer is rendered into a ring that the audio callback plays from,
+       carry on without sound if there is no audio device */
+    audio_mem = malloc(sizeof_audio_chip8(AUDIO_RING_SAMPLES));
+    audio = audio_mem == NULL ? NULL : initialise_audio_chip8(audio_mem, AUDIO_RING_SAMPLES, AUDIO_SAMPLE_RATE);
+    if (audio != NULL)
+    {
+        SDL_zero(audio_spec);
+        audio_spec.freq = AUDIO_SAMPLE_RATE;
+        audio_spec.format = AUDIO_S16SYS;
+        audio_spec.channels = 1;
+        audio_spec.samples = AUDIO_DEVICE_SAMPLES;
+        audio_spec.callback = audio_callback;
+        audio_spec.userdata = audio;
+        /* SDL converts if the device can't do this format exactly */
+        audio_device = SDL_OpenAudioDevice(NULL, 0, &audio_spec, NULL, 0);
+    }
+    if (audio_device == 0)
+    {
+        fprintf(stderr, "No sound, audio could not be opened! SDL_Error: %s\n", SDL_GetError());
+    }
+    else
+    {
+        attach_audio_chip8(p, audio);
+        SDL_PauseAudioDevice(audio_device, 0);
+    }
+
     printf("CHIP-8 Emulator \n");
     printf("Controls:\n");
     printf("  1 2 3 4     ->  1 2 3 C\n");
@@ -126,7 +214,11 @@ main(int argc, char* argv[])
     /* Set initial window title with clock rate */
     update_window_title(window, clock_rate, false);
 
-    last_time = SDL_GetTicks();
+    /* lag is how far the emulator is behind the clock, in performance counter
+       ticks times FRAME_RATE so a frame is exactly counter_freq of them */
+    counter_freq = SDL_GetPerformanceFrequency();
+    last_counter = SDL_GetPerformanceCounter();
+    lag = counter_freq;
 
     /* Main loop */
     while (running)
@@ -139,6 +231,13 @@ main(int argc, char* argv[])
                 case SDL_QUIT:
                     running = false;
                     break;
+
+                case SDL_WINDOWEVENT:
+                    if (event.window.event == SDL_WINDOWEVENT_EXPOSED)
+                    {
+                        display_dirty = true;
+                    }
+                    break;
                     
                 case SDL_KEYDOWN:
                     switch (event.key.keysym.sym)
@@ -149,24 +248,22 @@ main(int argc, char* argv[])
                             
                         case SDLK_PLUS:
                         case SDLK_EQUALS:
-                            if (clock_rate < CHIP8_CLOCK_RATE_900Hz)
+                            if (!replaying && clock_rate < CHIP8_CLOCK_RATE_900Hz)
                             {
                                 clock_rate += 1;
-                                sleep_time_ms = 1000.0f / (clock_rate * 60.0f);
                                 change_clock_rate_chip8(p, clock_rate);
-                                update_window_title(window, clock_rate, chip8_io->buzzer_active);
+                                update_window_title(window, clock_rate, buzzer_active);
                          
                             }
                             break;
                             
                         case SDLK_MINUS:
                         case SDLK_UNDERSCORE:
-                            if (clock_rate > CHIP8_CLOCK_RATE_300Hz)
+                            if (!replaying && clock_rate > CHIP8_CLOCK_RATE_300Hz)
                             {
                                 clock_rate -= 1;
-                                sleep_time_ms = 1000.0f / (clock_rate * 60.0f);
                                 change_clock_rate_chip8(p, clock_rate);
-                                update_window_title(window, clock_rate, chip8_io->buzzer_active);
+                                update_window_title(window, clock_rate, buzzer_active);
                             }
                             break;
                     }
@@ -175,32 +272,93 @@ main(int argc, char* argv[])
         }
 
         /* get keyboard state (is high if key is down, not just on rising edge) */
-        keystate = SDL_GetKeyboardState(NULL);
-        update_chip8_keys(chip8_io, keystate);
-
-        /* Execute a single CHIP-8 cycle */
-        execute_cycle_chip8(p);
+        if (!replaying)
+        {
+            keystate = SDL_GetKeyboardState(NULL);
+            update_chip8_keys(chip8_io, keystate);
+        }
 
-        /* Render display if updated */
-        if (chip8_io->update_display)
+        /* Run every frame that has come due since the last time round. The
+           part of a frame left over stays in lag, so the speed doesn't drift
+           however late the loop wakes up */
+        current_counter = SDL_GetPerformanceCounter();
+        lag += (current_counter - last_counter) * FRAME_RATE;
+        last_counter = current_counter;
+        if (lag > MAX_CATCH_UP_FRAMES * counter_freq)
         {
-            draw_display(renderer, chip8_io);
-            SDL_RenderPresent(renderer);
+            /* too far behind to catch up (e.g. the window was being dragged),
+               carry on from now rather than racing through the backlog */
+            lag = counter_freq;
+        }
+        while (lag >= counter_freq)
+        {
+            lag -= counter_freq;
+            if (movie == NULL)
+            {
+                summary = run_frame_chip8(p);
+            }
+            else
+            {
+                summary = run_movie_frame(p, movie, &movie_over);
+                if (movie_over)
+                {
+                    /* the replay is over, hand the keypad back to the player */
+                    printf("Replay %s\n", end_movie_chip8(movie) == 0 ? "finished" : "did not end in the recorded state");
+                    movie = NULL;
+                    replaying = false;
+                }
+            }
+            if (summary & CHIP8_FRAME_DISPLAY)
+            {
+                display_dirty = true;
+            }
+            buzzer_active = (summary & CHIP8_FRAME_BUZZER) != 0;
         }
 
-        update_window_title(window, clock_rate, chip8_io->buzzer_active);
+        if (buzzer_active != title_buzzer)
+        {
+            update_window_title(window, clock_rate, buzzer_active);
+            title_buzzer = buzzer_active;
+        }
 
-        current_time = SDL_GetTicks();
-        if (current_time - last_time < sleep_time_ms)
+        /* Render the display if it has changed, once however many sprites
+           were drawn. Presenting waits for the vsync, otherwise sleep until
+           the next frame is due. */
+        if (display_dirty)
+        {
+            draw_display(renderer, texture, get_framebuffer_rows_chip8(p));
+            SDL_RenderPresent(renderer);
+            display_dirty = false;
+        }
+        else
         {
-            SDL_Delay((Uint32)(sleep_time_ms - (current_time - last_time)));
+            /* SDL_Delay() can oversleep by a millisecond or so, wake up early
+               rather than late */
+            wait_ms = (Uint32)((counter_freq - lag) * 1000 / (counter_freq * FRAME_RATE));
+            if (wait_ms > 1)
+            {
+                SDL_Delay(wait_ms - 1);
+            }
         }
-        last_time = SDL_GetTicks();
     }
 
     /* Cleanup */
+    if (movie != NULL && !replaying && end_movie_chip8(movie) != 0)
+    {
+        fprintf(stderr, "Failed to write movie: %s\n", argv[3]);
+    }
+    else if (movie != NULL)
+    {
+        end_movie_chip8(movie);
+    }
+    if (audio_device != 0)
+    {
+        SDL_CloseAudioDevice(audio_device);
+    }
+    free(audio_mem);
     free_rom(r);
     free_chip8(p);
+    SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -209,35 +367,81 @@ main(int argc, char* argv[])
     return 0;
 }
 
-static void
-draw_display(SDL_Renderer *renderer, struct chip8_io *io)
+static unsigned int
+run_movie_frame(struct chip8 *p, struct chip8_movie *movie, bool *movie_over)
 {
-    SDL_Rect pixel_rect;
-    int x, y, pixel_value;
+    /* run_frame_chip8() through a movie. Returns the enum chip8_frame_summary
+       flags, movie_over is set if a replay reached its end. */
+    uint32_t remaining, n;
+    unsigned int reason, summary;
+
+    summary = 0;
+    *movie_over = false;
+    remaining = get_timer_cycles_chip8(p);
+    while (remaining > 0)
+    {
+        n = execute_cycles_movie_chip8(movie, remaining, &reason);
+        if (n == 0)
+        {
+            *movie_over = true;
+            break;
+        }
+        remaining -= n;
+        if (reason & CHIP8_EXIT_DRAW)
+        {
+            summary |= CHIP8_FRAME_DISPLAY;
+        }
+    }
+    if (get_io_chip8(p)->buzzer_active)
+    {
+        summary |= CHIP8_FRAME_BUZZER;
+    }
+    return summary;
+}
 
-    /* Clear screen with black */
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
+static void
+audio_callback(void *userdata, Uint8 *stream, int len)
+{
+    /* Runs on SDL's audio thread, the only reader of the ring */
+    struct chip8_audio *audio = userdata;
+    int16_t *samples = (int16_t *)stream;
+    uint32_t wanted = (uint32_t)len / sizeof(int16_t), available, n;
 
-    /* Draw white pixels */
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    available = available_audio_chip8(audio);
+    if (available > wanted + AUDIO_MAX_QUEUED)
+    {
+        read_audio_chip8(audio, NULL, available - wanted - AUDIO_MAX_QUEUED);
+    }
+    n = read_audio_chip8(audio, samples, wanted);
+    /* fill in with silence if the emulator has fallen behind */
+    memset(samples + n, 0, (wanted - n) * sizeof(int16_t));
+}
 
-    pixel_rect.w = PIXEL_SIZE;
-    pixel_rect.h = PIXEL_SIZE;
+static void
+draw_display(SDL_Renderer *renderer, SDL_Texture *texture, const uint64_t *rows)
+{
+    void *pixels;
+    Uint32 *line;
+    int pitch, x, y;
 
+    /* Expand the packed rows into the texture */
+    if (SDL_LockTexture(texture, NULL, &pixels, &pitch) != 0)
+    {
+        return;
+    }
     for (y = 0; y < CHIP8_SCREEN_HEIGHT; y++)
     {
+        line = (Uint32 *)((Uint8 *)pixels + y * pitch);
         for (x = 0; x < CHIP8_SCREEN_WIDTH; x++)
         {
-            pixel_value = io->fbuff[y * CHIP8_SCREEN_WIDTH + x];
-            if (pixel_value)
-            {
-                pixel_rect.x = x * PIXEL_SIZE;
-                pixel_rect.y = y * PIXEL_SIZE;
-                SDL_RenderFillRect(renderer, &pixel_rect);
-            }
+            line[x] = ((rows[y] >> (CHIP8_SCREEN_WIDTH - 1 - x)) & 1) ? PIXEL_ON : PIXEL_OFF;
         }
     }
+    SDL_UnlockTexture(texture);
+
+    /* and stretch it over the window in one copy */
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
 }
 
 static void
@@ -287,7 +491,9 @@ static void
 print_help(const char *name)
 {
     printf("CHIP-8 Emulator\n");
-    printf("Usage: %s <ROM_FILE>\n", name);
+    printf("Usage: %s <ROM_FILE> [--record|--replay <MOVIE_FILE>]\n", name);
+    printf("\n  --record <MOVIE_FILE>  record the keypad to an input movie\n");
+    printf("  --replay <MOVIE_FILE>  play back an input movie, then carry on live\n");
     printf("\nControls:\n");
     printf("  1 2 3 4     ->  1 2 3 C\n");
     printf("  Q W E R     ->  4 5 6 D\n");
@@ -0,0 +1,271 @@
+/*
+Runs ROMs on a library built with -DCHIP8_ENABLE_PROFILE=ON and reports
+where each one spends its cycles: the instructions executed most, the
+hottest addresses, time blocked on key presses and how much drawing it does.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "chip8.h"
+#include "instructions.h"
+#include "roms.h"
+
+#define DEFAULT_FRAMES 600
+#define DEFAULT_TOP 20
+#define NUM_ADDRESSES 4096
+
+struct settings
+{
+    uint64_t frames;
+    uint32_t clock_hz;
+    enum chip8_exec_mode mode;
+    int top;                                /* rows in each table */
+};
+
+/* sorted by qsort() along with the index it counts */
+struct entry
+{
+    uint32_t index;
+    uint64_t count;
+};
+
+static int profile_rom(const char *path, const struct settings *s);
+static void print_ops(const struct chip8_profile *prof, uint64_t total, int top);
+static void print_addresses(const struct chip8_profile *prof, const struct rom *r, uint64_t total, int top);
+static int compare_entries(const void *a, const void *b);
+static double percent(uint64_t count, uint64_t total);
+static void print_help(const char *name);
+
+int
+main(int argc, char *argv[])
+{
+    struct settings s;
+    long hz;
+    int i, failed = 0, opt;
+
+    s.frames = DEFAULT_FRAMES;
+    s.clock_hz = CHIP8_CLOCK_RATE_600Hz * 60;
+    s.mode = CHIP8_EXEC_INTERPRETER;
+    s.top = DEFAULT_TOP;
+
+    while ((opt = getopt(argc, argv, "f:r:m:n:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f':
+                s.frames = strtoull(optarg, NULL, 10);
+                break;
+            case 'r':
+                hz = strtol(optarg, NULL, 10);
+                if (hz < CHIP8_MIN_CLOCK_HZ || hz > CHIP8_MAX_CLOCK_HZ)
+                {
+                    fprintf(stderr, "clock rate must be from %d to %dHz\n", CHIP8_MIN_CLOCK_HZ, CHIP8_MAX_CLOCK_HZ);
+                    exit(1);
+                }
+                s.clock_hz = (uint32_t)hz;
+                break;
+            case 'm':
+                if (strcmp(optarg, "interpreter") == 0)
+                    s.mode = CHIP8_EXEC_INTERPRETER;
+                else if (strcmp(optarg, "blocks") == 0)
+                    s.mode = CHIP8_EXEC_BLOCKS;
+                else
+                {
+                    fprintf(stderr, "unknown execution mode: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'n':
+                s.top = (int)strtol(optarg, NULL, 10);
+                break;
+            case 'h':
+                print_help(argv[0]);
+                exit(0);
+            default:
+                fprintf(stderr, "Try '%s -h' for more information.\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (optind == argc)
+    {
+        fprintf(stderr, "usage:\n\t%s [options] <ROM_FILE>...\n", argv[0]);
+        fprintf(stderr, "Try '%s -h' for more information.\n", argv[0]);
+        exit(1);
+    }
+    for (i = optind; i < argc; i++)
+    {
+        failed |= profile_rom(argv[i], &s);
+    }
+    return failed;
+}
+
+static int
+profile_rom(const char *path, const struct settings *s)
+{
+    struct chip8 *p;
+    struct chip8_profile *prof;
+    struct rom *r;
+    uint64_t frame, total;
+    uint32_t op;
+    int failed = 1;
+
+    r = read_rom(path);
+    if (r == NULL)
+    {
+        return 1;
+    }
+    prof = malloc(sizeof(struct chip8_profile));
+    p = initialise_chip8(CHIP8_CLOCK_RATE_600Hz);
+    if (prof == NULL || p == NULL || change_clock_hz_chip8(p, s->clock_hz) != 0
+        || load_rom_chip8(p, r->data, r->num_bytes) != 0
+        || set_exec_mode_chip8(p, s->mode) != 0)
+    {
+        fprintf(stderr, "could not set up %s\n", path);
+        goto done;
+    }
+    if (get_profile_chip8(p, prof) != 0)
+    {
+        fprintf(stderr, "the library wasn't built with -DCHIP8_ENABLE_PROFILE=ON\n");
+        goto done;
+    }
+
+    for (frame = 0; frame < s->frames; frame++)
+    {
+        run_frame_chip8(p);
+    }
+    get_profile_chip8(p, prof);
+
+    total = 0;
+    for (op = 0; op < CHIP8_PROFILE_NUM_OPS; op++)
+    {
+        total += prof->op_count[op];
+    }
+    printf("%s: %llu frames at %luHz\n", path, (unsigned long long)s->frames, (unsigned long)s->clock_hz);
+    printf("  instructions   %12llu\n", (unsigned long long)total);
+    printf("  blocked cycles %12llu  (waiting for a key)\n", (unsigned long long)prof->blocked_cycles);
+    printf("  idle cycles    %12llu  %5.1f%% of instructions (wait loops skipped over)\n",
+           (unsigned long long)prof->idle_cycles, percent(prof->idle_cycles, total));
+    printf("  draws          %12llu  %llu pixels flipped, %llu erased, %llu collisions\n",
+           (unsigned long long)prof->draws, (unsigned long long)prof->pixels_drawn,
+           (unsigned long long)prof->pixels_erased, (unsigned long long)prof->collisions);
+    print_ops(prof, total, s->top);
+    print_addresses(prof, r, total, s->top);
+    printf("\n");
+    failed = 0;
+
+done:
+    if (p != NULL)
+    {
+        free_chip8(p);
+    }
+    free(prof);
+    free_rom(r);
+    return failed;
+}
+
+static void
+print_ops(const struct chip8_profile *prof, uint64_t total, int top)
+{
+    struct entry entries[CHIP8_PROFILE_NUM_OPS];
+    int i, n;
+
+    for (i = n = 0; i < CHIP8_PROFILE_NUM_OPS; i++)
+    {
+        if (prof->op_count[i] != 0)
+        {
+            entries[n].index = (uint32_t)i;
+            entries[n++].count = prof->op_count[i];
+        }
+    }
+    qsort(entries, (size_t)n, sizeof(struct entry), compare_entries);
+    printf("  %-8s %14s %7s\n", "op", "executed", "share");
+    for (i = 0; i < n && i < top; i++)
+    {
+        printf("  %-8s %14llu %6.2f%%\n", op_name_table[entries[i].index],
+               (unsigned long long)entries[i].count, percent(entries[i].count, total));
+    }
+}
+
+static void
+print_addresses(const struct chip8_profile *prof, const struct rom *r, uint64_t total, int top)
+{
+    /* the opcodes are as loaded from the ROM, a program that rewrites
+       itself may have run something else there */
+    struct entry *entries;
+    uint32_t address, offset;
+    uint16_t opcode;
+    int i, n;
+
+    entries = malloc(NUM_ADDRESSES * sizeof(struct entry));
+    if (entries == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        return;
+    }
+    for (address = 0, n = 0; address < NUM_ADDRESSES; address++)
+    {
+        if (prof->pc_count[address] != 0)
+        {
+            entries[n].index = address;
+            entries[n++].count = prof->pc_count[address];
+        }
+    }
+    qsort(entries, (size_t)n, sizeof(struct entry), compare_entries);
+    printf("  %-8s %14s %7s  %s\n", "address", "executed", "share", "opcode");
+    for (i = 0; i < n && i < top; i++)
+    {
+        address = entries[i].index;
+        offset = address - 0x200;
+        printf("  0x%03X    %14llu %6.2f%%  ", (unsigned int)address,
+               (unsigned long long)entries[i].count, percent(entries[i].count, total));
+        if (address >= 0x200 && offset + 1 < r->num_bytes)
+        {
+            opcode = (uint16_t)(r->data[offset] << 8 | r->data[offset + 1]);
+            printf("%04X %s\n", (unsigned int)opcode, op_name_table[classify_opcode(opcode)]);
+        }
+        else
+        {
+            printf("outside the ROM\n");
+        }
+    }
+    free(entries);
+}
+
+static int
+compare_entries(const void *a, const void *b)
+{
+    /* most executed first, then in index order */
+    const struct entry *ea = a, *eb = b;
+
+    if (ea->count != eb->count)
+    {
+        return ea->count < eb->count ? 1 : -1;
+    }
+    return ea->index < eb->index ? -1 : ea->index > eb->index;
+}
+
+static double
+percent(uint64_t count, uint64_t total)
+{
+    return total > 0 ? 100.0 * count / total : 0.0;
+}
+
+static void
+print_help(const char *name)
+{
+    printf("CHIP-8 hot spot profiler\n");
+    printf("Usage: %s [options] <ROM_FILE>...\n", name);
+    printf("\nOptions:\n");
+    printf("  -f <frames>   run each ROM for this many 60Hz frames (default %d)\n", DEFAULT_FRAMES);
+    printf("  -r <Hz>       clock rate, any whole number of Hz from 60 (default 600)\n");
+    printf("  -m <mode>     interpreter or blocks (default interpreter)\n");
+    printf("  -n <rows>     rows in each table (default %d)\n", DEFAULT_TOP);
+    printf("\nFor each ROM prints the instructions executed most, the hottest\n");
+    printf("addresses, cycles blocked on key presses and the drawing done. Needs a\n");
+    printf("library built with -DCHIP8_ENABLE_PROFILE=ON.\n");
+}
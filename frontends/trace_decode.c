@@ -0,0 +1,108 @@
+/*
+Decodes an execution trace file (see trace_file.h) into text, one line per
+instruction with the same mnemonics as the comments on the op_* functions.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "instructions.h"
+#include "trace_file.h"
+
+static void disassemble(uint16_t opcode, char *text, size_t size);
+
+int
+main(int argc, char *argv[])
+{
+    FILE *infile;
+    struct chip8_trace_record r;
+    char text[32];
+    uint64_t num_records = 0;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage:\n\t%s <TRACE_FILE>\n", argv[0]);
+        fprintf(stderr, "Prints \"<cycle> <address> <opcode> <instruction> <I> [<register>=<value>]\"\n");
+        fprintf(stderr, "for every instruction in a trace written by chip8emu_headless -t.\n");
+        return 1;
+    }
+    infile = fopen(argv[1], "rb");
+    if (infile == NULL)
+    {
+        fprintf(stderr, "could not open: %s\n", argv[1]);
+        return 1;
+    }
+    if (read_trace_header(infile) != 0)
+    {
+        fprintf(stderr, "%s is not a version %d trace file\n", argv[1], TRACE_FILE_VERSION);
+        fclose(infile);
+        return 1;
+    }
+    while (read_trace_record(infile, &r))
+    {
+        disassemble(r.opcode, text, sizeof(text));
+        printf("%10llu  %03X  %04X  %-18s I=%03X", (unsigned long long)r.cycle,
+               (unsigned int)r.pc, (unsigned int)r.opcode, text, (unsigned int)r.I);
+        if (r.reg != CHIP8_TRACE_NO_REG)
+        {
+            printf("  V%X=%02X", (unsigned int)r.reg, (unsigned int)r.value);
+        }
+        printf("\n");
+        num_records++;
+    }
+    fclose(infile);
+    fprintf(stderr, "%llu instructions\n", (unsigned long long)num_records);
+    return 0;
+}
+
+static void
+disassemble(uint16_t opcode, char *text, size_t size)
+{
+    unsigned int x, y, n, kk, nnn;
+
+    x = (opcode >> 8) & 0xF;
+    y = (opcode >> 4) & 0xF;
+    n = opcode & 0xF;
+    kk = opcode & 0xFF;
+    nnn = opcode & 0xFFF;
+    switch (classify_opcode(opcode))
+    {
+        case CHIP8_OP_0nnn: snprintf(text, size, "SYS %03X", nnn); break;
+        case CHIP8_OP_00E0: snprintf(text, size, "CLS"); break;
+        case CHIP8_OP_00EE: snprintf(text, size, "RET"); break;
+        case CHIP8_OP_1nnn: snprintf(text, size, "JP %03X", nnn); break;
+        case CHIP8_OP_2nnn: snprintf(text, size, "CALL %03X", nnn); break;
+        case CHIP8_OP_3xkk: snprintf(text, size, "SE V%X, %02X", x, kk); break;
+        case CHIP8_OP_4xkk: snprintf(text, size, "SNE V%X, %02X", x, kk); break;
+        case CHIP8_OP_5xy0: snprintf(text, size, "SE V%X, V%X", x, y); break;
+        case CHIP8_OP_6xkk: snprintf(text, size, "LD V%X, %02X", x, kk); break;
+        case CHIP8_OP_7xkk: snprintf(text, size, "ADD V%X, %02X", x, kk); break;
+        case CHIP8_OP_8xy0: snprintf(text, size, "LD V%X, V%X", x, y); break;
+        case CHIP8_OP_8xy1: snprintf(text, size, "OR V%X, V%X", x, y); break;
+        case CHIP8_OP_8xy2: snprintf(text, size, "AND V%X, V%X", x, y); break;
+        case CHIP8_OP_8xy3: snprintf(text, size, "XOR V%X, V%X", x, y); break;
+        case CHIP8_OP_8xy4: snprintf(text, size, "ADD V%X, V%X", x, y); break;
+        case CHIP8_OP_8xy5: snprintf(text, size, "SUB V%X, V%X", x, y); break;
+        case CHIP8_OP_8xy6: snprintf(text, size, "SHR V%X, V%X", x, y); break;
+        case CHIP8_OP_8xy7: snprintf(text, size, "SUBN V%X, V%X", x, y); break;
+        case CHIP8_OP_8xyE: snprintf(text, size, "SHL V%X, V%X", x, y); break;
+        case CHIP8_OP_9xy0: snprintf(text, size, "SNE V%X, V%X", x, y); break;
+        case CHIP8_OP_Annn: snprintf(text, size, "LD I, %03X", nnn); break;
+        case CHIP8_OP_Bnnn: snprintf(text, size, "JP V0, %03X", nnn); break;
+        case CHIP8_OP_Cxkk: snprintf(text, size, "RND V%X, %02X", x, kk); break;
+        case CHIP8_OP_Dxyn: snprintf(text, size, "DRW V%X, V%X, %X", x, y, n); break;
+        case CHIP8_OP_Ex9E: snprintf(text, size, "SKP V%X", x); break;
+        case CHIP8_OP_ExA1: snprintf(text, size, "SKNP V%X", x); break;
+        case CHIP8_OP_Fx07: snprintf(text, size, "LD V%X, DT", x); break;
+        case CHIP8_OP_Fx0A: snprintf(text, size, "LD V%X, K", x); break;
+        case CHIP8_OP_Fx15: snprintf(text, size, "LD DT, V%X", x); break;
+        case CHIP8_OP_Fx18: snprintf(text, size, "LD ST, V%X", x); break;
+        case CHIP8_OP_Fx1E: snprintf(text, size, "ADD I, V%X", x); break;
+        case CHIP8_OP_Fx29: snprintf(text, size, "LD F, V%X", x); break;
+        case CHIP8_OP_Fx33: snprintf(text, size, "LD B, V%X", x); break;
+        case CHIP8_OP_Fx55: snprintf(text, size, "LD [I], V%X", x); break;
+        case CHIP8_OP_Fx65: snprintf(text, size, "LD V%X, [I]", x); break;
+        default:            snprintf(text, size, "illegal"); break;
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef TRACE_FILE_H
+#define TRACE_FILE_H
+
+/*
+A simple header-only library that reads and writes execution trace files.
+A trace file is the magic "C8TR", a version byte, then one 16 byte record per
+instruction: the cycle (8 bytes), pc, opcode and I (2 bytes each), all little
+endian, then the register written and its value (1 byte each).
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8.h"
+
+#define TRACE_FILE_VERSION (1)
+#define TRACE_RECORD_BYTES (16)
+
+static inline int
+write_trace_header(FILE *outfile)
+{
+    uint8_t header[5] = { 'C', '8', 'T', 'R', TRACE_FILE_VERSION };
+
+    return fwrite(header, 1, sizeof(header), outfile) == sizeof(header) ? 0 : 1;
+}
+
+static inline int
+write_trace_records(FILE *outfile, const struct chip8_trace_record *records, uint32_t num_records)
+{
+    uint8_t bytes[TRACE_RECORD_BYTES];
+    uint32_t i;
+    int b;
+
+    for (i = 0; i < num_records; i++)
+    {
+        for (b = 0; b < 8; b++)
+        {
+            bytes[b] = (uint8_t)(records[i].cycle >> (8 * b));
+        }
+        bytes[8] = (uint8_t)records[i].pc;
+        bytes[9] = (uint8_t)(records[i].pc >> 8);
+        bytes[10] = (uint8_t)records[i].opcode;
+        bytes[11] = (uint8_t)(records[i].opcode >> 8);
+        bytes[12] = (uint8_t)records[i].I;
+        bytes[13] = (uint8_t)(records[i].I >> 8);
+        bytes[14] = records[i].reg;
+        bytes[15] = records[i].value;
+        if (fwrite(bytes, 1, TRACE_RECORD_BYTES, outfile) != TRACE_RECORD_BYTES)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline int
+read_trace_header(FILE *infile)
+{
+    uint8_t header[5];
+
+    if (fread(header, 1, sizeof(header), infile) != sizeof(header)
+        || memcmp(header, "C8TR", 4) != 0 || header[4] != TRACE_FILE_VERSION)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+/* Returns 1 if a record was read, 0 at the end of the file */
+static inline int
+read_trace_record(FILE *infile, struct chip8_trace_record *record)
+{
+    uint8_t bytes[TRACE_RECORD_BYTES];
+    int b;
+
+    if (fread(bytes, 1, TRACE_RECORD_BYTES, infile) != TRACE_RECORD_BYTES)
+    {
+        return 0;
+    }
+    record->cycle = 0;
+    for (b = 7; b >= 0; b--)
+    {
+        record->cycle = record->cycle << 8 | bytes[b];
+    }
+    record->pc = (uint16_t)(bytes[8] | bytes[9] << 8);
+    record->opcode = (uint16_t)(bytes[10] | bytes[11] << 8);
+    record->I = (uint16_t)(bytes[12] | bytes[13] << 8);
+    record->reg = bytes[14];
+    record->value = bytes[15];
+    return 1;
+}
+
+#endif // TRACE_FILE_H
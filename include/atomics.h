@@ -0,0 +1,88 @@
+#ifndef CHIP8_ATOMICS_H
+#define CHIP8_ATOMICS_H
+
+#include <stdint.h>
+
+/*
+Just enough atomics for the single producer, single consumer rings (see
+trace.c and audio.c). Each side only ever writes its own index. A producer
+publishes what it has written by storing its index with release, and the
+consumer loads it with acquire before reading, the same the other way round.
+The only other shared value is a 64 bit count of what was dropped, written
+by the producer and read at any time.
+
+C90 has no atomics, so these are the GCC and Clang builtins, or MSVC's
+intrinsics. MSVC's volatile only orders accesses with /volatile:ms, which
+isn't the default on ARM, so its loads and stores are the __iso_volatile
+ones (never torn, nothing more) with explicit barriers: a dmb on ARM, and
+on x86, where loads and stores are already ordered, just stopping the
+compiler reordering them. 64 bit loads and stores aren't single
+instructions on 32 bit targets, so they go through a compare and exchange.
+*/
+
+#if defined(__GNUC__)
+
+#define LOAD_ACQUIRE_U32(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE_U32(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define LOAD_RELAXED_U64(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE_RELAXED_U64(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+#elif defined(_MSC_VER)
+
+#include <intrin.h>
+
+#if defined(_M_ARM64)
+#define CHIP8_BARRIER() __dmb(_ARM64_BARRIER_ISH)
+#elif defined(_M_ARM)
+#define CHIP8_BARRIER() __dmb(_ARM_BARRIER_ISH)
+#elif defined(_M_IX86) || defined(_M_X64)
+#define CHIP8_BARRIER() _ReadWriteBarrier()
+#else
+#error "atomics.h: unsupported MSVC target"
+#endif
+
+static __inline uint32_t
+load_acquire_u32(volatile uint32_t *x)
+{
+    uint32_t v;
+
+    v = (uint32_t) __iso_volatile_load32((volatile __int32 *) x);
+    CHIP8_BARRIER();
+    return v;
+}
+
+static __inline void
+store_release_u32(volatile uint32_t *x, uint32_t v)
+{
+    CHIP8_BARRIER();
+    __iso_volatile_store32((volatile __int32 *) x, (__int32) v);
+}
+
+static __inline uint64_t
+load_relaxed_u64(volatile uint64_t *x)
+{
+    /* swaps 0 for 0, so it only reads */
+    return (uint64_t) _InterlockedCompareExchange64((volatile __int64 *) x, 0, 0);
+}
+
+static __inline void
+store_relaxed_u64(volatile uint64_t *x, uint64_t v)
+{
+    __int64 old;
+
+    do
+    {
+        old = _InterlockedCompareExchange64((volatile __int64 *) x, 0, 0);
+    } while (_InterlockedCompareExchange64((volatile __int64 *) x, (__int64) v, old) != old);
+}
+
+#define LOAD_ACQUIRE_U32(x) load_acquire_u32(&(x))
+#define STORE_RELEASE_U32(x, v) store_release_u32(&(x), (v))
+#define LOAD_RELAXED_U64(x) load_relaxed_u64(&(x))
+#define STORE_RELAXED_U64(x, v) store_relaxed_u64(&(x), (v))
+
+#else
+#error "atomics.h: no atomics for this compiler, it needs GCC or Clang builtins or MSVC intrinsics"
+#endif
+
+#endif /* CHIP8_ATOMICS_H */
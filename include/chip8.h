@@ -2,6 +2,7 @@
 #define CHIP8_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 /*
 This is the public API. Use this to integrate Chip8 into an app.
@@ -10,7 +11,13 @@ This is the public API. Use this to integrate Chip8 into an app.
 #define CHIP8_SCREEN_WIDTH (64)
 #define CHIP8_SCREEN_HEIGHT (32)
 #define MAX_ROM_SIZE (3584) /* 4096 - 512 (0x200) */
+#define CHIP8_MIN_CLOCK_HZ (60)
+#define CHIP8_MAX_CLOCK_HZ (1000000000)
 
+/*
+The usual clock rates, the value is the number of cycles per 60Hz timer clock.
+change_clock_hz_chip8() can set any other rate.
+*/
 enum chip8_clock
 {
     CHIP8_CLOCK_RATE_300Hz = 5,
@@ -26,18 +33,56 @@ enum chip8_clock
     CHIP8_CLOCK_RATE_900Hz = 15
 };
 
+/*
+Reasons execute_cycles_chip8() stopped before using up its cycle budget.
+These are bit flags, several can be reported for the same cycle.
+*/
+enum chip8_exit_reason
+{
+    CHIP8_EXIT_BUDGET = 0,      /* all of the requested cycles were executed */
+    CHIP8_EXIT_DRAW = 1,        /* a 00E0 or Dxyn instruction updated the display */
+    CHIP8_EXIT_KEY_WAIT = 2,    /* an Fx0A instruction is blocked waiting for a key press */
+    CHIP8_EXIT_TIMER = 4        /* the 60Hz delay and sound timers were clocked */
+};
+
+/*
+What happened during a frame run by run_frame_chip8(), returned as flags.
+*/
+enum chip8_frame_summary
+{
+    CHIP8_FRAME_DISPLAY = 1,    /* a 00E0 or Dxyn instruction updated the display */
+    CHIP8_FRAME_BUZZER = 2,     /* the sound timer was running, so the buzzer was on */
+    CHIP8_FRAME_KEY_WAIT = 4    /* an Fx0A instruction blocked waiting for a key press */
+};
+
+/*
+How execute_cycles_chip8() runs the program. Every mode gives exactly the
+same results, they only differ in speed.
+*/
+enum chip8_exec_mode
+{
+    CHIP8_EXEC_INTERPRETER = 0, /* fetch, decode and execute one instruction at a time */
+    CHIP8_EXEC_BLOCKS = 1,      /* translate straight line runs of instructions once and 
+                                   execute them as a unit */
+    CHIP8_EXEC_JIT = 2,         /* compile the blocks to native code, only available when
+                                   built with CHIP8_ENABLE_JIT on x86-64 */
+    CHIP8_EXEC_JIT_CHECKED = 3  /* CHIP8_EXEC_JIT, but check the state against 
+                                   execute_cycle_chip8() after every block. On a mismatch
+                                   the interpreter's state is kept, a message is printed 
+                                   to stderr and the mode drops to CHIP8_EXEC_BLOCKS */
+};
+
 struct chip8_io
 {
     /* inputs */
     uint8_t     keypad_state[16];
     /* outputs */
-    uint8_t     fbuff[CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT];
     char        update_display;
     char        buzzer_active;            
 };
 
 /*
-Initialise a chip8 emulator.
+Initialise a chip8 emulator, starting on a cache line.
 Arguments: 
     - enum chip8_clock: clock the rate the application will call  execute_cycle_chip8() at 
 Returns a pointer to the chip8 emulator state.
@@ -45,6 +90,31 @@ Returns a pointer to the chip8 emulator state.
 struct chip8 *
 initialise_chip8(enum chip8_clock clock);
 
+/*
+Get the number of bytes an emulator takes up. An emulator is a single block
+of memory, it is a multiple of 64 bytes so an array of them stays cache line
+aligned.
+Returns the size of an emulator in bytes
+*/
+size_t
+sizeof_chip8(void);
+
+/*
+Initialise a chip8 emulator in memory the caller provides, e.g. to pack many
+of them into one allocation. free_chip8() still has to be called to release 
+anything the emulator allocated later on (JIT, shared RAM) but it leaves mem
+to the caller.
+Arguments: 
+    - void *mem: sizeof_chip8() bytes aligned to at least 8 bytes, NULL is
+      returned otherwise. Align it to 64 bytes to start on a cache line like
+      initialise_chip8() does, sizeof_chip8() is a multiple of 64 so an
+      array of them stays aligned.
+    - enum chip8_clock: clock the rate the application will call  execute_cycle_chip8() at 
+Returns a pointer to the chip8 emulator state (at mem), NULL on failure
+*/
+struct chip8 *
+initialise_chip8_in_place(void *mem, enum chip8_clock clock);
+
 /* 
 Get a pointer to the output state. This is the only publically available struct
 and is all you need to interface and control the emulator with.
@@ -55,6 +125,41 @@ Returns a pointer to the chip8_io struct
 struct chip8_io *
 get_io_chip8(struct chip8 *p);
 
+/*
+Copy the display out as one byte per pixel, 0 is off and 1 is on.
+The emulator stores the display packed into bits internally, so only call
+this when you are going to draw it (i.e. after update_display is set).
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+    - uint8_t *fbuff: CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT bytes to fill,
+      stored row by row
+Returns 0 on success 1 on failure
+*/
+int
+export_framebuffer_chip8(struct chip8 *p, uint8_t *fbuff);
+
+/*
+Get the packed display, one uint64_t per row with the leftmost pixel in the
+most significant bit. This is the internal storage, so it must not be modified.
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+Returns a pointer to CHIP8_SCREEN_HEIGHT rows
+*/
+const uint64_t *
+get_framebuffer_rows_chip8(struct chip8 *p);
+
+/*
+Get a 64-bit hash of everything that affects how the emulator will run from
+here (RAM, registers, stack, timers, random number generator and display).
+Two emulators with the same digest will almost certainly behave identically,
+which makes this useful for regression testing.
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+Returns the digest, 0 if p is NULL
+*/
+uint64_t
+get_state_digest_chip8(struct chip8 *p);
+
 /*
 Load ROM data into the chip8 RAM.
 Arguments:
@@ -75,6 +180,89 @@ Arguments:
 void
 execute_cycle_chip8(struct chip8 *p);
 
+/*
+Run up to num_cycles fetch, decode, execute cycles in one call.
+This gives exactly the same results as calling execute_cycle_chip8() the same
+number of times, but returns early at the end of any cycle that drew to the
+display, blocked on a key press or clocked the 60Hz timers, so the host can
+react to it.
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+    - uint32_t num_cycles: the maximum number of cycles to run
+    - unsigned int *exit_reason: set to the enum chip8_exit_reason flags that
+      stopped execution, CHIP8_EXIT_BUDGET if the budget ran out (may be NULL)
+Returns the number of cycles executed
+*/
+uint32_t
+execute_cycles_chip8(struct chip8 *p, uint32_t num_cycles, unsigned int *exit_reason);
+
+/*
+Run one 60Hz frame: every cycle up to and including the next timer clock,
+get_timer_cycles_chip8() of them. This gives exactly the same results as 
+calling execute_cycle_chip8() that many times, a host can then present the
+display and sleep until the next frame is due. Cycles spent blocked on a key
+press are skipped over in one step.
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+Returns the enum chip8_frame_summary flags for the frame (0 if p is NULL)
+*/
+unsigned int
+run_frame_chip8(struct chip8 *p);
+
+/*
+Find out if the emulator is blocked on an Fx0A key wait. Until a key is
+pressed the only thing that changes is the timers counting down, so a host
+can stop running a blocked emulator, account for the time it was parked
+with skip_key_wait_chip8() and start it again when set_key_chip8() says a
+key press has woken it.
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+    - uint32_t *timer_cycles: set to the number of cycles until the delay and
+      sound timers are both 0, after that nothing at all changes (may be NULL)
+Returns 1 if the emulator is blocked on a key, 0 if not
+*/
+int
+get_key_wait_chip8(struct chip8 *p, uint32_t *timer_cycles);
+
+/*
+Account for num_cycles cycles of an emulator blocked on a key in one step.
+The result is exactly the same as executing them with no key pressed.
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+    - uint32_t num_cycles: the number of cycles to skip
+    - uint32_t *num_timer_clocks: set to the number of times the 60Hz timers
+      were clocked, i.e. frames (may be NULL)
+Returns the number of cycles skipped, 0 if the emulator isn't blocked or a
+key is already down that will wake it
+*/
+uint32_t
+skip_key_wait_chip8(struct chip8 *p, uint32_t num_cycles, uint32_t *num_timer_clocks);
+
+/*
+Press or release a key, the same as setting keypad_state in the chip8_io
+struct.
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+    - uint8_t key: the key, 0x0 to 0xF
+    - int pressed: 1 if the key is down, 0 if it is up
+Returns 1 if the emulator was blocked on a key and this press wakes it (on
+the next cycle), otherwise 0
+*/
+int
+set_key_chip8(struct chip8 *p, uint8_t key, int pressed);
+
+/*
+Choose how execute_cycles_chip8() runs the program, the default is
+CHIP8_EXEC_INTERPRETER. execute_cycle_chip8() always uses the interpreter.
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+    - enum chip8_exec_mode mode: the execution mode to use
+Returns 0 on success 1 on failure (including asking for the JIT when it
+isn't available)
+*/
+int
+set_exec_mode_chip8(struct chip8 *p, enum chip8_exec_mode mode);
+
 /*
 Use this to change the clock rate of the chip8 after initialisation
 Arguments:
@@ -85,7 +273,541 @@ Returns 0 on success 1 on failruie
 int 
 change_clock_rate_chip8(struct chip8 *p, enum chip8_clock clock);
 
+/*
+Change the clock rate to any whole number of Hz. The timers are still clocked
+at 60Hz, every clock_hz / 60 cycles, and when that isn't a whole number the
+timer clocks are spread out so that there are exactly 60 for every clock_hz
+cycles.
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+    - uint32_t clock_hz: the clock rate, CHIP8_MIN_CLOCK_HZ to CHIP8_MAX_CLOCK_HZ
+Returns 0 on success 1 on failure
+*/
+int
+change_clock_hz_chip8(struct chip8 *p, uint32_t clock_hz);
+
+/*
+Get the clock rate.
+Returns the clock rate in Hz, 0 if p is NULL
+*/
+uint32_t
+get_clock_hz_chip8(struct chip8 *p);
+
+/*
+Get the number of cycles until the timers are next clocked, counting the
+cycle that clocks them.
+Returns the number of cycles, at least 1 (0 if p is NULL)
+*/
+uint32_t
+get_timer_cycles_chip8(struct chip8 *p);
+
+/*
+Restart the random number generator (a 32 bit LFSR) from a new seed and
+polynomial, e.g. so that many emulators running the same ROM each get their
+own sequence that can be reproduced. Every emulator starts with the defaults.
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+    - uint32_t seed: the starting state, 0 for the default
+    - uint32_t polynomial: the feedback taps, 0 for the default. The top bit
+      must be set, the generator shifts right and it is the x^0 term.
+Returns 0 on success 1 on failure
+*/
+int
+set_prng_chip8(struct chip8 *p, uint32_t seed, uint32_t polynomial);
+
+/*
+Get the number of bytes needed by save_state_chip8().
+Returns the size of a saved state in bytes
+*/
+uint32_t
+state_size_chip8(void);
+
+/*
+Save everything needed to carry on from this point later (RAM, registers, 
+stack, timers, clock rate, random number generator, key wait, display and
+chip8_io).
+This doesn't allocate, so it is cheap enough to call every frame. The state
+is in the host's own layout, it can only be loaded by the same build.
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+    - void *buff: state_size_chip8() bytes to save the state into
+Returns 0 on success 1 on failure
+*/
+int
+save_state_chip8(struct chip8 *p, void *buff);
+
+/*
+Restore a state saved by save_state_chip8(), to this or any other emulator.
+The clock rate is restored too, the execution mode is left as it is.
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+    - const void *buff: the saved state
+Returns 0 on success 1 on failure (including a state from a different 
+version or build), p is unchanged on failure
+*/
+int
+load_state_chip8(struct chip8 *p, const void *buff);
+
+/*
+Make dst an exact copy of the running emulator src, e.g. to fork a run for
+tree search. dst must already be initialised, nothing is allocated. Only the
+parts of dst's translated code for RAM that differs are thrown away. dst keeps
+its own execution mode.
+Arguments:
+    - struct chip8 *dst: a pointer to the chip8 state to overwrite
+    - struct chip8 *src: a pointer to the chip8 state to copy
+Returns 0 on success 1 on failure
+*/
+int
+clone_chip8(struct chip8 *dst, struct chip8 *src);
+
+/*
+The same as clone_chip8(), but rather than copying RAM, src and dst share it 
+until either of them writes to it (Fx33, Fx55, loading a ROM or a state), 
+when the writer gets its own copy again. This makes cloning cheaper still when
+the clones don't often write to RAM. The first time src is shared it moves its
+RAM into a separately allocated page. Emulators sharing RAM must all be used 
+from the same thread.
+Returns 0 on success 1 on failure
+*/
+int
+clone_shared_chip8(struct chip8 *dst, struct chip8 *src);
+
 void 
 free_chip8(struct chip8 *p);
 
+/*
+Rewind: record snapshots of an emulator as it runs and go back to any of 
+them. Only the newest snapshot is kept whole, older ones are stored as the 
+(usually tiny) difference from the next, in a ring with a fixed memory budget.
+When the ring is full the oldest snapshots are dropped.
+*/
+struct chip8_rewind;
+
+/*
+Create a rewind buffer.
+Arguments:
+    - uint32_t budget_bytes: the total memory to use, this has to be at least
+      5 * state_size_chip8() bytes
+    - uint32_t interval_frames: take a snapshot every this many calls to
+      record_rewind_chip8()
+Returns a pointer to the rewind buffer, NULL on failure
+*/
+struct chip8_rewind *
+initialise_rewind_chip8(uint32_t budget_bytes, uint32_t interval_frames);
+
+/*
+Call this once a frame (e.g. when execute_cycles_chip8() reports 
+CHIP8_EXIT_TIMER), a snapshot is taken on the first call and then every
+interval_frames calls.
+Arguments:
+    - struct chip8_rewind *r: a pointer to the rewind buffer
+    - struct chip8 *p: a pointer to the chip8 state
+Returns 0 on success 1 on failure
+*/
+int
+record_rewind_chip8(struct chip8_rewind *r, struct chip8 *p);
+
+/*
+Get the number of snapshots that can be rewound to.
+Returns the number of snapshots, the newest is 0 and the oldest is one less
+than this
+*/
+uint32_t
+num_snapshots_rewind_chip8(struct chip8_rewind *r);
+
+/*
+Restore an emulator to a snapshot and forget every snapshot after it, 
+recording then carries on from there.
+Arguments:
+    - struct chip8_rewind *r: a pointer to the rewind buffer
+    - struct chip8 *p: a pointer to the chip8 state to restore
+    - uint32_t num_back: the snapshot to go back to, 0 is the newest
+Returns 0 on success 1 on failure (there aren't that many snapshots)
+*/
+int
+rewind_chip8(struct chip8_rewind *r, struct chip8 *p, uint32_t num_back);
+
+void
+free_rewind_chip8(struct chip8_rewind *r);
+
+/*
+Input movies: record every change to the keypad (and clock rate) with the
+cycle it happened at, then replay them to reproduce a session exactly. The
+movie is streamed to and from a file, so sessions can be any length. Run the
+emulator with execute_cycles_movie_chip8() in place of execute_cycles_chip8()
+while recording or replaying.
+*/
+struct chip8_movie;
+
+/*
+Start recording a movie, from the emulator's current state.
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+    - const char *path: the file to write the movie to
+Returns a pointer to the movie, NULL on failure
+*/
+struct chip8_movie *
+record_movie_chip8(struct chip8 *p, const char *path);
+
+/*
+Start replaying a movie. The emulator has to be in the same state the
+recording started from (e.g. freshly initialised with the same ROM loaded).
+While replaying the movie sets the keypad and anything the host writes to it
+is overwritten.
+Arguments:
+    - struct chip8 *p: a pointer to the chip8 state
+    - const char *path: the movie file
+Returns a pointer to the movie, NULL on failure (including when p is not in
+the starting state)
+*/
+struct chip8_movie *
+replay_movie_chip8(struct chip8 *p, const char *path);
+
+/*
+Execute up to num_cycles cycles like execute_cycles_chip8(), recording the
+keypad as it is now or replaying the recorded changes as they come up.
+Arguments:
+    - struct chip8_movie *m: a pointer to the movie
+    - uint32_t num_cycles: the most cycles to execute
+    - unsigned int *exit_reason: as for execute_cycles_chip8()
+Returns the number of cycles executed, when replaying this is 0 once the
+end of the movie has been reached
+*/
+uint32_t
+execute_cycles_movie_chip8(struct chip8_movie *m, uint32_t num_cycles, unsigned int *exit_reason);
+
+/*
+Stop recording or replaying and free the movie. A recording is finished
+with the final state digest, so a replay can check it ends up in the same
+place.
+Arguments:
+    - struct chip8_movie *m: a pointer to the movie
+Returns 0 on success 1 on failure. A replay fails if it didn't reach the end
+of the movie or the emulator's state there differs from the recording.
+*/
+int
+end_movie_chip8(struct chip8_movie *m);
+
+/*
+Lockstep emulators: many chip8 emulators (lanes) running the same ROM, each
+with its own keypad. While the lanes are all at the same instruction it is
+executed for all of them at once with SIMD, so this is much faster than
+running the emulators one by one when their inputs rarely change control flow
+(e.g. reinforcement learning). The results are exactly the same as separate
+emulators calling execute_cycle_chip8().
+*/
+struct chip8_lockstep;
+
+/*
+Initialise num_lanes emulators to run in lockstep.
+Arguments:
+    - uint32_t num_lanes: the number of emulators
+    - enum chip8_clock: clock the rate of every lane
+Returns a pointer to the lockstep state, NULL on failure
+*/
+struct chip8_lockstep *
+initialise_lockstep_chip8(uint32_t num_lanes, enum chip8_clock clock);
+
+/*
+Load the same ROM into every lane, see load_rom_chip8().
+Returns 0 on success 1 on failure
+*/
+int
+load_rom_lockstep_chip8(struct chip8_lockstep *l, uint8_t *data, uint16_t num_bytes);
+
+/*
+Get a lane's chip8_io, to set its keypad and read its outputs.
+Arguments:
+    - struct chip8_lockstep *l: a pointer to the lockstep state
+    - uint32_t lane: the lane, from 0 to num_lanes - 1
+Returns a pointer to the chip8_io struct, NULL if there is no such lane
+*/
+struct chip8_io *
+get_io_lockstep_chip8(struct chip8_lockstep *l, uint32_t lane);
+
+/*
+Restart a lane's random number generator from a new seed, see 
+set_prng_chip8(). The lanes all share the default polynomial.
+Arguments:
+    - struct chip8_lockstep *l: a pointer to the lockstep state
+    - uint32_t lane: the lane, from 0 to num_lanes - 1
+    - uint32_t seed: the starting state, 0 for the default
+Returns 0 on success 1 on failure
+*/
+int
+set_prng_lockstep_chip8(struct chip8_lockstep *l, uint32_t lane, uint32_t seed);
+
+/*
+Get a lane as a normal chip8 emulator, brought up to date with the lane, so
+the other functions (export_framebuffer_chip8(), get_state_digest_chip8() 
+etc.) can be used on it. Only use it to read the state, and only until the
+next call to execute_cycles_lockstep_chip8(). It is freed with the lockstep
+state, don't free_chip8() it.
+Returns a pointer to the lane's chip8 state, NULL if there is no such lane
+*/
+struct chip8 *
+get_lane_lockstep_chip8(struct chip8_lockstep *l, uint32_t lane);
+
+/*
+Run num_cycles cycles on every lane, the same as calling execute_cycle_chip8()
+num_cycles times on each of them.
+Arguments:
+    - struct chip8_lockstep *l: a pointer to the lockstep state
+    - uint32_t num_cycles: the number of cycles to run
+Returns how many of those cycles ran every lane together with SIMD, the rest
+ran one lane at a time
+*/
+uint32_t
+execute_cycles_lockstep_chip8(struct chip8_lockstep *l, uint32_t num_cycles);
+
+void
+free_lockstep_chip8(struct chip8_lockstep *l);
+
+/*
+Instance pools: emulators preallocated in slabs and handed out already 
+initialised, for hosts that start and stop sessions all the time. A released
+emulator is reset with one copy of a freshly initialised one, and the pool
+grows by a slab at a time when it runs out.
+*/
+struct chip8_pool;
+
+struct chip8_pool_stats
+{
+    uint32_t    in_use;                     /* emulators handed out right now */
+    uint32_t    capacity;                   /* emulators allocated in all of the slabs */
+    uint32_t    high_water;                 /* the most ever in use at once */
+    uint32_t    num_slabs;
+};
+
+/*
+Initialise a pool with its first slab.
+Arguments:
+    - uint32_t slab_size: the number of emulators to allocate at a time
+    - enum chip8_clock: clock the rate every emulator starts at
+Returns a pointer to the pool, NULL on failure
+*/
+struct chip8_pool *
+initialise_pool_chip8(uint32_t slab_size, enum chip8_clock clock);
+
+/*
+Take an emulator from the pool, in the same state as initialise_chip8() 
+leaves one. Don't free_chip8() it, give it back with release_pool_chip8().
+Returns a pointer to the emulator, NULL if a new slab couldn't be allocated
+*/
+struct chip8 *
+acquire_pool_chip8(struct chip8_pool *pool);
+
+/*
+Give an emulator back to the pool it came from, it is reset ready to be
+handed out again. Anything that isn't an emulator handed out by this pool
+(including one already given back) is ignored.
+*/
+void
+release_pool_chip8(struct chip8_pool *pool, struct chip8 *p);
+
+/*
+Get the number of emulators in use and allocated.
+Arguments:
+    - struct chip8_pool *pool: a pointer to the pool
+    - struct chip8_pool_stats *stats: filled in with the statistics
+*/
+void
+get_stats_pool_chip8(struct chip8_pool *pool, struct chip8_pool_stats *stats);
+
+/*
+Free the pool and every emulator in it, including any still handed out.
+*/
+void
+free_pool_chip8(struct chip8_pool *pool);
+
+/*
+An execution trace: with a trace attached, an emulator appends a record of
+every instruction it executes to a ring buffer, which another thread reads
+from while it runs. The ring has a single producer (the emulator) and a single
+consumer, and neither ever waits for the other; when the ring is full records
+are dropped and counted rather than holding up the emulator. A traced emulator
+executes one instruction at a time through the interpreter whatever its
+execution mode, with exactly the same results. Lockstep lanes aren't traced.
+*/
+struct chip8_trace;
+
+#define CHIP8_TRACE_NO_REG (0xFF)
+
+struct chip8_trace_record
+{
+    uint64_t    cycle;                      /* cycles since the trace was attached,
+                                               including cycles blocked on a key */
+    uint16_t    pc;                         /* address of the instruction */
+    uint16_t    opcode;
+    uint16_t    I;                          /* I after the instruction */
+    uint8_t     reg;                        /* the V register the instruction wrote
+                                               (VF for Dxyn), CHIP8_TRACE_NO_REG if none */
+    uint8_t     value;                      /* the register's value after */
+};
+
+/*
+Allocate a trace ring.
+Arguments:
+    - uint32_t capacity: records the ring holds, rounded up to a power of 2
+Returns a pointer to the ring, NULL on failure
+*/
+struct chip8_trace *
+initialise_trace_chip8(uint32_t capacity);
+
+/*
+Start tracing an emulator into a ring, or stop with a NULL ring. The cycle
+count starts from 0. A ring can only have one emulator attached at a time,
+and must stay attached until the emulator stops running.
+Returns 0 on success, 1 if p is NULL
+*/
+int
+attach_trace_chip8(struct chip8 *p, struct chip8_trace *t);
+
+/*
+Take the oldest records out of the ring, safe to call from another thread
+while the emulator runs (but only one thread at a time).
+Arguments:
+    - struct chip8_trace *t: a pointer to the ring
+    - struct chip8_trace_record *records: filled in with the records
+    - uint32_t max_records: the most records to take
+Returns the number of records taken, 0 if the ring is empty
+*/
+uint32_t
+read_trace_chip8(struct chip8_trace *t, struct chip8_trace_record *records, uint32_t max_records);
+
+/*
+Get the number of records dropped because the ring was full.
+*/
+uint64_t
+get_dropped_trace_chip8(struct chip8_trace *t);
+
+/*
+Free a ring, once it is no longer attached to an emulator.
+*/
+void
+free_trace_chip8(struct chip8_trace *t);
+
+/*
+Buzzer audio: with an audio ring attached, an emulator renders the buzzer as
+mono signed 16 bit PCM into a ring buffer in memory the caller provides, for
+another thread (e.g. an audio callback) to read while it runs. The buzzer
+only changes when the timers are clocked, so each clock renders the 1/60s up
+to the next one, a square wave while the sound timer is running and silence
+otherwise. Every edge lands on the sample for the cycle it happened at, in
+emulated time. As with a trace, the ring has a single producer and a single
+consumer that never wait for each other, and samples that don't fit are
+dropped. Lockstep lanes have no audio.
+*/
+struct chip8_audio;
+
+/*
+Get the number of bytes of memory initialise_audio_chip8() needs.
+Arguments:
+    - uint32_t capacity: samples the ring holds, a power of 2
+Returns the number of bytes, 0 if capacity isn't a power of 2
+*/
+size_t
+sizeof_audio_chip8(uint32_t capacity);
+
+/*
+Set up an audio ring in memory owned by the caller, which must stay valid
+until the ring is no longer used. There is nothing to free.
+Arguments:
+    - void *mem: at least sizeof_audio_chip8(capacity) bytes, aligned to 8 bytes
+    - uint32_t capacity: samples the ring holds, a power of 2. Sized for a
+      frame or two, as everything in the ring is audio latency
+    - uint32_t sample_rate: samples per second, e.g. 48000
+Returns a pointer to the ring (the same address as mem), NULL on failure
+*/
+struct chip8_audio *
+initialise_audio_chip8(void *mem, uint32_t capacity, uint32_t sample_rate);
+
+/*
+Change the buzzer's tone, 440Hz at an amplitude of 4096 to begin with. Only
+call this before the ring is attached, or from the emulator's thread.
+Arguments:
+    - struct chip8_audio *a: a pointer to the ring
+    - uint32_t tone_hz: the square wave's frequency, up to half the sample rate
+    - int16_t amplitude: the height of the square wave
+Returns 0 on success, 1 on failure
+*/
+int
+set_tone_audio_chip8(struct chip8_audio *a, uint32_t tone_hz, int16_t amplitude);
+
+/*
+Start rendering an emulator's buzzer into a ring, or stop with a NULL ring.
+The first samples are for the emulator's next timer clock. A ring can only
+have one emulator attached at a time.
+Returns 0 on success, 1 if p is NULL
+*/
+int
+attach_audio_chip8(struct chip8 *p, struct chip8_audio *a);
+
+/*
+Get the number of samples waiting in the ring, from the reading thread.
+*/
+uint32_t
+available_audio_chip8(struct chip8_audio *a);
+
+/*
+Take the oldest samples out of the ring, safe to call from another thread
+while the emulator runs (but only one thread at a time).
+Arguments:
+    - struct chip8_audio *a: a pointer to the ring
+    - int16_t *samples: filled in with the samples, or NULL to throw them away
+    - uint32_t max_samples: the most samples to take
+Returns the number of samples taken, 0 if the ring is empty
+*/
+uint32_t
+read_audio_chip8(struct chip8_audio *a, int16_t *samples, uint32_t max_samples);
+
+/*
+Get the number of samples dropped because the ring was full.
+*/
+uint64_t
+get_dropped_audio_chip8(struct chip8_audio *a);
+
+/*
+Profiling, only available when the library is built with
+-DCHIP8_ENABLE_PROFILE=ON (without it nothing is counted and there is no
+cost). Every instruction executed by execute_cycle_chip8(),
+execute_cycles_chip8() and run_frame_chip8() is counted, including the
+trips round wait loops that are skipped over, in the interpreter and blocks
+modes. The JIT isn't built into a profiling build, and lockstep lanes
+aren't profiled (their counts stay at 0).
+*/
+#define CHIP8_PROFILE_NUM_OPS (37)
+
+struct chip8_profile
+{
+    uint64_t    op_count[CHIP8_PROFILE_NUM_OPS]; /* instructions executed, indexed by
+                                                    enum chip8_op (instructions.h) */
+    uint64_t    pc_count[4096];             /* instructions executed at each address */
+    uint64_t    blocked_cycles;             /* cycles spent waiting for a key (Fx0A) */
+    uint64_t    idle_cycles;                /* cycles in wait loops that were skipped over,
+                                               already counted in op_count and pc_count */
+    uint64_t    draws;                      /* Dxyn instructions */
+    uint64_t    pixels_drawn;               /* pixels flipped by Dxyn, after clipping */
+    uint64_t    pixels_erased;              /* of those, pixels turned off */
+    uint64_t    collisions;                 /* Dxyn instructions that set VF */
+};
+
+/*
+Get the counts since the emulator was initialised or reset_profile_chip8()
+was last called.
+Arguments:
+    - struct chip8 *p: a pointer to the emulator
+    - struct chip8_profile *profile: filled in with the counts
+Returns 0 on success, 1 if the library wasn't built with profiling
+*/
+int
+get_profile_chip8(struct chip8 *p, struct chip8_profile *profile);
+
+/*
+Set all of the counts back to 0.
+*/
+void
+reset_profile_chip8(struct chip8 *p);
+
 #endif /* CHIP8_H */
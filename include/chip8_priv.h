@@ -6,34 +6,86 @@ The API required to integrate the CHIP8 emulator into an app
 */
 
 #include <stdint.h>
+#include <stddef.h>
 
-struct chip8_io;
-struct lfsr_prng;
+#include "chip8.h"
+#include "prng.h"
+
+struct chip8_jit;
+struct chip8_mem_page;
 
 #define CHIP8_MEM_SIZE_BYTES (4096)
 #define PROGRAM_START_ADDRESS (0x200)
 #define FONT_START_ADDRESS (0x0000)
+#define CHIP8_ADDRESS_MASK (CHIP8_MEM_SIZE_BYTES - 1)
+#define CHIP8_NUM_DECODED (CHIP8_MEM_SIZE_BYTES / 2)
+#define CHIP8_MAX_BLOCK_LEN (32)
+#define CHIP8_CACHE_LINE (64)
+
+/* A predecoded instruction, see decode.h */
+struct chip8_decoded
+{
+    uint16_t    opcode;
+    uint16_t    nnn;
+    uint8_t     op;                         /* enum chip8_op */
+    uint8_t     x;
+    uint8_t     y;
+    uint8_t     n;
+    uint8_t     kk;
+};
 
+/* 
+An instance is this one struct, see sizeof_chip8(). The fields used by every
+instruction come first so they share a cache line.
+*/
 struct chip8
 {
     /* chip 8 */
-    uint8_t     mem[CHIP8_MEM_SIZE_BYTES];  /* RAM */
+    uint8_t *   mem;                        /* RAM, own_mem or a copy-on-write page shared with clones */
     uint16_t    pc;                         /* program counter */
     uint8_t     V[16];                      /* General purpose registers */
     uint16_t    I;                          /* the address register (note we only use the lower 12 bits) */
     uint8_t     delay_timer;
     uint8_t     sound_timer;
-    uint16_t    stack[16];                  /* the stack */
     uint8_t     sp;                         /* stack pointer (note we only use the lower 4 bits) */
     /* emulator state */ 
-    uint8_t    tick;                        /* keep track of ticks for clock division */
-    uint8_t    timer_clock_div;             /* clock divider to run the timers at*/
-    struct lfsr_prng * prng;                /* random number generator */
-    uint8_t            rnd;                 /* random number updates each cycle*/
+    uint8_t            rnd;                 /* random number, as of rnd_steps cycles ago */
     char waiting_for_key;                   /* execution of the program is halted */
     uint8_t            key_x;               /**/
-    /* externally accessible IO (frambuffer, buzzer, keypad etc) */
-    struct chip8_io * chip8_io;
+    uint32_t   clock_hz;                    /* the rate cycles are executed at */
+    uint32_t   timer_acc;                   /* goes up 60 a cycle, the timers are clocked
+                                               each time it reaches clock_hz */
+    uint32_t   rnd_steps;                   /* cycles the random number generator is
+                                               behind by, see catch_up_rnd() */
+    uint16_t    stack[16];                  /* the stack */
+    /* the display, one bit per pixel with the leftmost pixel in the msb */
+    uint64_t    fbuff[CHIP8_SCREEN_HEIGHT];
+    /* everything from pc up to here is saved by save_state_chip8() as is */
+    struct lfsr_prng prng;                  /* random number generator */
+    /* externally accessible IO (buzzer, keypad etc) */
+    struct chip8_io chip8_io;
+    uint8_t     exec_mode;                  /* enum chip8_exec_mode */
+    void *      allocation;                 /* this as allocated by initialise_chip8(), NULL
+                                               if the caller owns the memory */
+    struct chip8_mem_page * mem_page;       /* the page mem points to if it is shared, otherwise NULL */
+    uint8_t     own_mem[CHIP8_MEM_SIZE_BYTES];
+    /* instructions decoded from each even address in mem */
+    struct chip8_decoded decoded[CHIP8_NUM_DECODED];
+    /* length of the basic block starting at each even address, 0 if it hasn't
+       been translated yet */
+    uint8_t     block_len[CHIP8_NUM_DECODED];
+    struct chip8_jit * jit;                 /* compiled blocks, NULL unless the JIT is in use */
+    struct chip8 *     shadow;              /* reference instance for CHIP8_EXEC_JIT_CHECKED */
+    struct chip8_trace * trace;             /* see attach_trace_chip8(), NULL unless tracing */
+    struct chip8_audio * audio;             /* see attach_audio_chip8(), NULL if there is none */
+#ifdef CHIP8_ENABLE_PROFILE
+    struct chip8_profile profile;           /* see get_profile_chip8() */
+    uint8_t     unprofiled;                 /* a lockstep lane, Dxyn doesn't count its draws */
+#endif
 };
 
+/* the part of struct chip8 save_state_chip8() copies in one go */
+#define CHIP8_SAVED_START (offsetof(struct chip8, pc))
+#define CHIP8_SAVED_BYTES (offsetof(struct chip8, fbuff) + sizeof(uint64_t) * CHIP8_SCREEN_HEIGHT - CHIP8_SAVED_START)
+
 #endif /* CHIP8_PRIV_H */
@@ -0,0 +1,99 @@
+#ifndef CHIP8_CORE_H
+#define CHIP8_CORE_H
+
+#include <stdint.h>
+
+/*
+Internals shared by the different ways of executing instructions
+*/
+
+struct chip8;
+
+/* The number of cycles up to and including the next one that clocks the timers */
+uint32_t
+timer_cycles_remaining(struct chip8 *p);
+
+/* Account for num_cycles cycles, no more than timer_cycles_remaining().
+   Returns 1 if the last one clocked the timers. */
+int
+advance_timers(struct chip8 *p, uint32_t num_cycles);
+
+/* If the program counter is at a loop that only waits for the timers, 
+   execute it up to the next timer clock (and no more than max_cycles) at
+   once. Returns the number of cycles executed, 0 if it isn't at a wait loop
+   or there isn't room for a trip round it. Adds CHIP8_EXIT_TIMER to 
+   exit_reason if the timers were clocked. */
+uint32_t
+skip_idle_loop(struct chip8 *p, uint32_t max_cycles, unsigned int *exit_reason);
+
+/* A quick test for whether skip_idle_loop() is worth calling, true when the
+   instruction at the program counter is already decoded as one that can 
+   start a wait loop. The index is masked so an out of range or odd program
+   counter only gives a false positive. */
+#define MAYBE_IDLE_LOOP(p) \
+    (starts_idle_loop[(p)->decoded[((p)->pc >> 1) & (CHIP8_NUM_DECODED - 1)].op])
+
+/* The enum chip8_op that MAYBE_IDLE_LOOP() is true for */
+extern const uint8_t starts_idle_loop[];
+
+/* The random number generator should step every cycle, but only Cxkk uses
+   it. So each cycle just adds to rnd_steps, and this catches the generator
+   up in one jump before anything reads rnd or the generator. */
+void
+catch_up_rnd(struct chip8 *p);
+
+/* Give p its own copy of RAM if it shares a page with clones, called 
+   before anything writes to RAM */
+void
+unshare_mem(struct chip8 *p);
+
+/* Append a record of the instruction just executed to the trace attached
+   to p, see attach_trace_chip8(). */
+void
+record_trace(struct chip8 *p, uint16_t pc, uint16_t opcode);
+
+/* Count num_cycles cycles that executed no instructions (blocked on a key)
+   in the trace attached to p */
+void
+skip_trace(struct chip8 *p, uint32_t num_cycles);
+
+/* Render num_clocks timer clocks' worth of buzzer, on or off, into the audio
+   ring attached to p, see attach_audio_chip8() */
+void
+render_audio(struct chip8 *p, uint32_t num_clocks, int on);
+
+/* Profiling hooks, see get_profile_chip8(). Without CHIP8_ENABLE_PROFILE
+   they compile to nothing. */
+#ifdef CHIP8_ENABLE_PROFILE
+#define PROFILE_INSTRUCTION(p, address, op) \
+    ((p)->profile.op_count[(op)]++, (p)->profile.pc_count[(address) & CHIP8_ADDRESS_MASK]++)
+#define PROFILE_BLOCKED(p, num_cycles) ((p)->profile.blocked_cycles += (num_cycles))
+#define PROFILE_IDLE_LOOP(p, start, loop_len, trips) profile_idle_loop((p), (start), (loop_len), (trips))
+/* op_Dxyn() also runs for lockstep lanes, which count nothing */
+#define PROFILE_SPRITE_ROW(p, sprite_row, screen_row) \
+    ((p)->unprofiled ? (void) 0 : profile_sprite_row((p), (sprite_row), (screen_row)))
+#define PROFILE_DRAW(p, collision) \
+    ((p)->unprofiled ? (void) 0 : (void) ((p)->profile.draws++, (p)->profile.collisions += (collision)))
+
+/* Count trips trips round the loop_len instructions starting at start */
+void
+profile_idle_loop(struct chip8 *p, uint32_t start, uint32_t loop_len, uint32_t trips);
+
+/* Count the pixels a sprite row flips and erases on a display row */
+void
+profile_sprite_row(struct chip8 *p, uint64_t sprite_row, uint64_t screen_row);
+#else
+#define PROFILE_INSTRUCTION(p, address, op) ((void) 0)
+#define PROFILE_BLOCKED(p, num_cycles) ((void) 0)
+#define PROFILE_IDLE_LOOP(p, start, loop_len, trips) ((void) 0)
+#define PROFILE_SPRITE_ROW(p, sprite_row, screen_row) ((void) 0)
+#define PROFILE_DRAW(p, collision) ((void) 0)
+#endif
+
+/* The switch (or computed goto) interpreter core, selected with
+   -DCHIP8_CORE=switch. Behaves exactly like execute_cycles_chip8() in 
+   CHIP8_EXEC_INTERPRETER mode. */
+uint32_t
+execute_cycles_switch(struct chip8 *p, uint32_t num_cycles, unsigned int *exit_reason);
+
+#endif /* CHIP8_CORE_H */
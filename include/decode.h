@@ -0,0 +1,36 @@
+#ifndef CHIP8_DECODE_H
+#define CHIP8_DECODE_H
+
+#include <stdint.h>
+
+/*
+A cache of predecoded instructions, one entry for every even address in RAM.
+Entries are decoded the first time they are executed and thrown away again
+whenever the memory they were decoded from is written to.
+
+On top of that, straight line runs of instructions (basic blocks) are
+translated into a run of decoded entries that ends with the first 
+instruction that can change the program counter, draw, wait for a key or 
+write to RAM. Only that last instruction can do any of those things, so 
+the whole block can be executed without checking in between.
+*/
+
+struct chip8;
+struct chip8_decoded;
+
+void
+decode_instruction(uint16_t opcode, struct chip8_decoded *d);
+
+struct chip8_decoded *
+fetch_decoded(struct chip8 *p);
+
+struct chip8_decoded *
+decoded_at(struct chip8 *p, uint32_t address);
+
+uint8_t
+translate_block(struct chip8 *p);
+
+void
+invalidate_decoded(struct chip8 *p, uint32_t address, uint32_t num_bytes);
+
+#endif /* CHIP8_DECODE_H */
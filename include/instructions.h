@@ -5,6 +5,59 @@
 
 struct chip8;
 
+/*
+Every instruction the interpreter knows about. Opcodes that map to none of
+these are CHIP8_OP_ILLEGAL, CHIP8_OP_NONE marks an instruction that has not
+been decoded yet.
+*/
+enum chip8_op
+{
+    CHIP8_OP_NONE = 0,
+    CHIP8_OP_0nnn,
+    CHIP8_OP_00E0,
+    CHIP8_OP_00EE,
+    CHIP8_OP_1nnn,
+    CHIP8_OP_2nnn,
+    CHIP8_OP_3xkk,
+    CHIP8_OP_4xkk,
+    CHIP8_OP_5xy0,
+    CHIP8_OP_6xkk,
+    CHIP8_OP_7xkk,
+    CHIP8_OP_8xy0,
+    CHIP8_OP_8xy1,
+    CHIP8_OP_8xy2,
+    CHIP8_OP_8xy3,
+    CHIP8_OP_8xy4,
+    CHIP8_OP_8xy5,
+    CHIP8_OP_8xy6,
+    CHIP8_OP_8xy7,
+    CHIP8_OP_8xyE,
+    CHIP8_OP_9xy0,
+    CHIP8_OP_Annn,
+    CHIP8_OP_Bnnn,
+    CHIP8_OP_Cxkk,
+    CHIP8_OP_Dxyn,
+    CHIP8_OP_Ex9E,
+    CHIP8_OP_ExA1,
+    CHIP8_OP_Fx07,
+    CHIP8_OP_Fx0A,
+    CHIP8_OP_Fx15,
+    CHIP8_OP_Fx18,
+    CHIP8_OP_Fx1E,
+    CHIP8_OP_Fx29,
+    CHIP8_OP_Fx33,
+    CHIP8_OP_Fx55,
+    CHIP8_OP_Fx65,
+    CHIP8_OP_ILLEGAL,
+    CHIP8_OP_COUNT
+};
+
+/* The instruction function for each enum chip8_op */
+extern void (*const op_handler_table[CHIP8_OP_COUNT])(struct chip8 *, uint16_t);
+
+/* The name of each enum chip8_op, e.g. "Dxyn" */
+extern const char *const op_name_table[CHIP8_OP_COUNT];
+
 void 
 op_0ZZZ(struct chip8 *p, uint16_t opcode);
 
@@ -107,10 +160,16 @@ op_Fx55(struct chip8 *p, uint16_t opcode);
 void
 op_Fx65(struct chip8 *p, uint16_t opcode);
 
+void
+op_illegal(struct chip8 *p, uint16_t opcode);
+
 uint16_t
 fetch_opcode(struct chip8 *p);
 
 void 
 (*decode_opcode(uint16_t opcode))(struct chip8 *, uint16_t);
 
+enum chip8_op
+classify_opcode(uint16_t opcode);
+
 #endif /* CHIP8_INSTR_H */
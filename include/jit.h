@@ -0,0 +1,38 @@
+#ifndef CHIP8_JIT_H
+#define CHIP8_JIT_H
+
+#include <stdint.h>
+
+/*
+An optional x86-64 JIT that compiles the basic blocks from decode.h into
+native code. It is only built when CMake is configured with 
+-DCHIP8_ENABLE_JIT=ON on an x86-64 host, which defines CHIP8_ENABLE_JIT.
+
+Simple instructions are compiled inline, everything else calls the op_*
+instruction functions. The compiled code does exactly what running the 
+block with op_handler_table would (including the per-cycle rnd update), 
+apart from advancing the program counter and clocking the timers, which 
+the caller does for the whole block.
+*/
+
+struct chip8;
+struct chip8_jit;
+
+struct chip8_jit *
+initialise_jit(void);
+
+/* Run the first num_instructions of the translated block at start_address,
+   compiling it first if needed. The caller must already have moved the 
+   program counter past them. Returns 0 on success and 1 if the block could
+   not be compiled. */
+int
+execute_jit_block(struct chip8 *p, uint16_t start_address, uint32_t num_instructions);
+
+/* Throw away the compiled code for the block starting at p->decoded[index] */
+void
+invalidate_jit_block(struct chip8_jit *jit, uint32_t index);
+
+void
+free_jit(struct chip8_jit *jit);
+
+#endif /* CHIP8_JIT_H */
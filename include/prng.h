@@ -8,13 +8,36 @@ A simple 32 bit linear feedback shift register pseudo random number generator
 that outputs the least significant 8 bits only.
 */
 
+struct 
+lfsr_prng
+{
+    uint32_t buff;
+    uint32_t polynomial;
+    uint32_t jump[32];                      /* x^(2^k) modulo the polynomial, see prng.c */
+};
+
 struct 
 lfsr_prng *
 initialise_lfsr_prng(uint32_t seed, uint32_t polynomial);
 
+/* Set up a generator the caller has placed, e.g. inside another struct */
+void
+init_lfsr_prng(struct lfsr_prng *p, uint32_t seed, uint32_t polynomial);
+
 uint8_t
 lfsr_prng_process(struct lfsr_prng *p);
 
+/* Step the generator num_steps times, returns the last output. Large jumps 
+   take a few hundred operations rather than num_steps */
+uint8_t
+lfsr_prng_skip(struct lfsr_prng *p, uint32_t num_steps);
+
+void
+get_state_lfsr_prng(const struct lfsr_prng *p, uint32_t *buff, uint32_t *polynomial);
+
+void
+set_state_lfsr_prng(struct lfsr_prng *p, uint32_t buff, uint32_t polynomial);
+
 void 
 free_lfsr_prng(struct lfsr_prng *p);
 
@@ -0,0 +1,211 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_priv.h"
+#include "core.h"
+#include "atomics.h"
+
+/*
+The audio ring, laid out like the trace ring (see trace.c) with the samples
+straight after it in the caller's memory. The emulator only writes at timer
+clocks, a whole 1/60s of samples at a time.
+*/
+
+#define MAX_CAPACITY (0x1000000u)
+#define MAX_SAMPLE_RATE (1000000u)
+#define DEFAULT_TONE_HZ (440)
+#define DEFAULT_AMPLITUDE (4096)
+
+struct chip8_audio
+{
+    int16_t *   samples;                    /* capacity of them, after the ring */
+    uint32_t    mask;                       /* capacity - 1 */
+    uint32_t    sample_rate;
+    uint8_t     pad0[CHIP8_CACHE_LINE];
+    /* written by the emulator */
+    uint32_t    head;                       /* where the next sample goes */
+    uint32_t    tail_seen;                  /* the emulator's copy of tail */
+    uint32_t    sample_acc;                 /* sample_rate * timer clocks so far, mod 60 */
+    uint32_t    phase;                      /* of the square wave, the top bit is the half */
+    uint32_t    phase_step;                 /* tone_hz / sample_rate of a turn */
+    int16_t     amplitude;
+    uint64_t    dropped;
+    uint8_t     pad1[CHIP8_CACHE_LINE];
+    /* written by the reader */
+    uint32_t    tail;                       /* the next sample to read */
+    uint32_t    head_seen;                  /* the reader's copy of head */
+};
+
+size_t
+sizeof_audio_chip8(uint32_t capacity)
+{
+    if (capacity == 0 || capacity > MAX_CAPACITY || (capacity & (capacity - 1)) != 0)
+    {
+        return 0;
+    }
+    return sizeof(struct chip8_audio) + capacity * sizeof(int16_t);
+}
+
+struct chip8_audio *
+initialise_audio_chip8(void *mem, uint32_t capacity, uint32_t sample_rate)
+{
+    struct chip8_audio *a;
+
+    if (mem == NULL || ((size_t) mem & (sizeof(uint64_t) - 1)) != 0
+        || sizeof_audio_chip8(capacity) == 0 || sample_rate == 0 || sample_rate > MAX_SAMPLE_RATE)
+    {
+        return NULL;
+    }
+    memset(mem, 0, sizeof_audio_chip8(capacity));
+    a = (struct chip8_audio *) mem;
+    a->samples = (int16_t *) ((uint8_t *) mem + sizeof(struct chip8_audio));
+    a->mask = capacity - 1;
+    a->sample_rate = sample_rate;
+    set_tone_audio_chip8(a, DEFAULT_TONE_HZ, DEFAULT_AMPLITUDE);
+    return a;
+}
+
+int
+set_tone_audio_chip8(struct chip8_audio *a, uint32_t tone_hz, int16_t amplitude)
+{
+    if (a == NULL || tone_hz == 0 || tone_hz > a->sample_rate / 2)
+    {
+        return 1;
+    }
+    a->phase_step = (uint32_t) (((uint64_t) tone_hz << 32) / a->sample_rate);
+    a->amplitude = amplitude;
+    return 0;
+}
+
+int
+attach_audio_chip8(struct chip8 *p, struct chip8_audio *a)
+{
+    if (p == NULL)
+    {
+        return 1;
+    }
+    if (a != NULL)
+    {
+        a->sample_acc = 0;
+        a->phase = 0;
+    }
+    p->audio = a;
+    return 0;
+}
+
+void
+render_audio(struct chip8 *p, uint32_t num_clocks, int on)
+{
+    struct chip8_audio *a;
+    uint64_t total, num_samples;
+    uint32_t head, space, n, i, phase;
+    int16_t *samples;
+
+    a = p->audio;
+    if (num_clocks == 0)
+    {
+        return;
+    }
+    /* Each clock is sample_rate / 60 samples, carrying the remainder on to
+       the next so every clock starts on the sample it happened at */
+    total = (uint64_t) a->sample_rate * num_clocks + a->sample_acc;
+    num_samples = total / 60;
+    a->sample_acc = (uint32_t) (total % 60);
+
+    head = a->head;
+    space = a->mask + 1 - (head - a->tail_seen);
+    if (space < num_samples)
+    {
+        a->tail_seen = LOAD_ACQUIRE_U32(a->tail);
+        space = a->mask + 1 - (head - a->tail_seen);
+    }
+    n = num_samples < space ? (uint32_t) num_samples : space;
+    samples = a->samples;
+    if (on)
+    {
+        phase = a->phase;
+        for (i = 0; i < n; i++)
+        {
+            samples[(head + i) & a->mask] = (phase & 0x80000000u) ? (int16_t) -a->amplitude : a->amplitude;
+            phase += a->phase_step;
+        }
+        /* the wave carries on through any samples dropped below */
+        a->phase = phase + a->phase_step * (uint32_t) (num_samples - n);
+    }
+    else
+    {
+        /* silence, and the next beep starts from the beginning of a wave */
+        for (i = 0; i < n; i++)
+        {
+            samples[(head + i) & a->mask] = 0;
+        }
+        a->phase = 0;
+    }
+    STORE_RELEASE_U32(a->head, head + n);
+    if (n < num_samples)
+    {
+        /* the reader has fallen behind */
+        STORE_RELAXED_U64(a->dropped, a->dropped + (num_samples - n));
+    }
+}
+
+uint32_t
+available_audio_chip8(struct chip8_audio *a)
+{
+    if (a == NULL)
+    {
+        return 0;
+    }
+    a->head_seen = LOAD_ACQUIRE_U32(a->head);
+    return a->head_seen - a->tail;
+}
+
+uint32_t
+read_audio_chip8(struct chip8_audio *a, int16_t *samples, uint32_t max_samples)
+{
+    uint32_t tail, n, first;
+
+    if (a == NULL)
+    {
+        return 0;
+    }
+    tail = a->tail;
+    if (a->head_seen - tail < max_samples)
+    {
+        a->head_seen = LOAD_ACQUIRE_U32(a->head);
+    }
+    n = a->head_seen - tail;
+    if (n > max_samples)
+    {
+        n = max_samples;
+    }
+    if (n == 0)
+    {
+        return 0;
+    }
+    if (samples != NULL)
+    {
+        /* in up to two pieces, if the samples wrap round the end of the ring */
+        first = a->mask + 1 - (tail & a->mask);
+        if (first > n)
+        {
+            first = n;
+        }
+        memcpy(samples, &a->samples[tail & a->mask], first * sizeof(int16_t));
+        memcpy(samples + first, a->samples, (n - first) * sizeof(int16_t));
+    }
+    STORE_RELEASE_U32(a->tail, tail + n);
+    return n;
+}
+
+uint64_t
+get_dropped_audio_chip8(struct chip8_audio *a)
+{
+    if (a == NULL)
+    {
+        return 0;
+    }
+    return LOAD_RELAXED_U64(a->dropped);
+}
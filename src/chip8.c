@@ -7,28 +7,63 @@
 #include "fonts.h"
 #include "prng.h"
 #include "instructions.h"
+#include "decode.h"
+#include "jit.h"
+#include "core.h"
  
+size_t
+sizeof_chip8(void)
+{
+    /* rounded up so an array of instances stays cache line aligned */
+    return (sizeof(struct chip8) + CHIP8_CACHE_LINE - 1) / CHIP8_CACHE_LINE * CHIP8_CACHE_LINE;
+}
+
 struct chip8 *
-initialise_chip8(enum chip8_clock clock)
+initialise_chip8_in_place(void *mem, enum chip8_clock clock)
 {
     struct chip8 * p;
-    p = calloc(1, sizeof(struct chip8));
-    if (p == NULL)
+
+    if (mem == NULL || ((size_t) mem & (sizeof(uint64_t) - 1)) != 0
+        || clock < CHIP8_CLOCK_RATE_300Hz || clock > CHIP8_CLOCK_RATE_900Hz)
     {
         return NULL;
     }
+    memset(mem, 0, sizeof_chip8());
+    p = (struct chip8 *) mem;
+    p->allocation = NULL;
+    /* RAM is our own until it is shared with a clone */
+    p->mem = p->own_mem;
     /* initialise the program counter to the start address */
     p->pc = PROGRAM_START_ADDRESS;
-    /* initialise the io struct */
-    p->chip8_io = calloc(1, sizeof(struct chip8_io));
-    p->chip8_io->buzzer_active = 0;
-    p->chip8_io->update_display = 0;
-    /* the value of the clock enum is the timer clock divider */
-    p->timer_clock_div = clock;
+    /* the value of the clock enum is the number of cycles per timer clock */
+    p->clock_hz = 60u * clock;
     /* copy font into memory */
     memcpy(&p->mem[FONT_START_ADDRESS], fontset, FONTSET_SIZE*sizeof(uint8_t));
     /* initialise the random number generator */
-    p->prng = initialise_lfsr_prng(0, 0);
+    init_lfsr_prng(&p->prng, 0, 0);
+    return p;
+}
+
+struct chip8 *
+initialise_chip8(enum chip8_clock clock)
+{
+    struct chip8 * p;
+    uint8_t * mem;
+
+    /* over allocated so the emulator can start on a cache line */
+    mem = malloc(sizeof_chip8() + CHIP8_CACHE_LINE);
+    if (mem == NULL)
+    {
+        return NULL;
+    }
+    p = initialise_chip8_in_place(mem + (CHIP8_CACHE_LINE - (size_t) mem % CHIP8_CACHE_LINE) % CHIP8_CACHE_LINE,
+                                  clock);
+    if (p == NULL)
+    {
+        free(mem);
+        return NULL;
+    }
+    p->allocation = mem;
     return p;
 }
 
@@ -39,7 +74,120 @@ get_io_chip8(struct chip8 *p)
     {
         return NULL;
     }
-    return p->chip8_io;
+    return &p->chip8_io;
+}
+
+int
+export_framebuffer_chip8(struct chip8 *p, uint8_t *fbuff)
+{
+    int r, c;
+    uint64_t row;
+
+    if (p == NULL || fbuff == NULL)
+    {
+        return 1;
+    }
+    for (r=0; r<CHIP8_SCREEN_HEIGHT; r++)
+    {
+        row = p->fbuff[r];
+        for (c=0; c<CHIP8_SCREEN_WIDTH; c++)
+        {
+            fbuff[c + r * CHIP8_SCREEN_WIDTH] = (uint8_t)((row >> (CHIP8_SCREEN_WIDTH - 1 - c)) & 1);
+        }
+    }
+    return 0;
+}
+
+const uint64_t *
+get_framebuffer_rows_chip8(struct chip8 *p)
+{
+    if (p == NULL)
+    {
+        return NULL;
+    }
+    return p->fbuff;
+}
+
+static
+uint64_t
+hash_bytes_chip8(uint64_t hash, const void *data, size_t num_bytes)
+{
+    /* 64-bit FNV-1a */
+    const uint64_t prime = ((uint64_t)1 << 40) | 0x1B3;
+    const uint8_t *bytes = (const uint8_t *) data;
+    size_t i;
+
+    for (i = 0; i < num_bytes; i++)
+    {
+        hash ^= bytes[i];
+        hash *= prime;
+    }
+    return hash;
+}
+
+uint64_t
+get_state_digest_chip8(struct chip8 *p)
+{
+    uint64_t hash;
+    uint32_t buff, polynomial;
+    uint8_t bytes[8];
+    int i, r;
+
+    if (p == NULL)
+    {
+        return 0;
+    }
+    hash = ((uint64_t)0xCBF29CE4 << 32) | 0x84222325;
+    hash = hash_bytes_chip8(hash, p->mem, CHIP8_MEM_SIZE_BYTES);
+    hash = hash_bytes_chip8(hash, p->V, sizeof(p->V));
+    /* hash the wider fields a byte at a time so the digest is the same on
+       any host */
+    for (i = 0; i < 16; i++)
+    {
+        bytes[0] = (uint8_t)(p->stack[i] >> 8);
+        bytes[1] = (uint8_t)p->stack[i];
+        hash = hash_bytes_chip8(hash, bytes, 2);
+    }
+    catch_up_rnd(p);
+    get_state_lfsr_prng(&p->prng, &buff, &polynomial);
+    bytes[0] = (uint8_t)(p->pc >> 8);
+    bytes[1] = (uint8_t)p->pc;
+    bytes[2] = (uint8_t)(p->I >> 8);
+    bytes[3] = (uint8_t)p->I;
+    bytes[4] = p->delay_timer;
+    bytes[5] = p->sound_timer;
+    bytes[6] = p->sp;
+    bytes[7] = (uint8_t)(p->timer_acc / 60);
+    hash = hash_bytes_chip8(hash, bytes, 8);
+    bytes[0] = (uint8_t)(buff >> 24);
+    bytes[1] = (uint8_t)(buff >> 16);
+    bytes[2] = (uint8_t)(buff >> 8);
+    bytes[3] = (uint8_t)buff;
+    bytes[4] = p->rnd;
+    bytes[5] = p->waiting_for_key;
+    bytes[6] = p->key_x;
+    bytes[7] = (uint8_t)(p->clock_hz / 60);
+    hash = hash_bytes_chip8(hash, bytes, 8);
+    if (p->clock_hz % 60 != 0 || p->clock_hz / 60 > 0xFF)
+    {
+        /* only rates that aren't one of enum chip8_clock need all of it, 
+           the digests of the rest stay as they always were */
+        for (i = 0; i < 4; i++)
+        {
+            bytes[i] = (uint8_t)(p->clock_hz >> (24 - 8 * i));
+            bytes[4 + i] = (uint8_t)(p->timer_acc >> (24 - 8 * i));
+        }
+        hash = hash_bytes_chip8(hash, bytes, 8);
+    }
+    for (r = 0; r < CHIP8_SCREEN_HEIGHT; r++)
+    {
+        for (i = 0; i < 8; i++)
+        {
+            bytes[i] = (uint8_t)(p->fbuff[r] >> (56 - 8 * i));
+        }
+        hash = hash_bytes_chip8(hash, bytes, 8);
+    }
+    return hash;
 }
 
 int 
@@ -55,6 +203,8 @@ load_rom_chip8(struct chip8 * p, uint8_t * data, uint16_t num_bytes)
         return 1;
     }
     
+    invalidate_decoded(p, PROGRAM_START_ADDRESS, MAX_ROM_SIZE);
+
     /* zero the old ROM data, if any */
     memset(&p->mem[PROGRAM_START_ADDRESS], 0, MAX_ROM_SIZE);
 
@@ -65,54 +215,79 @@ load_rom_chip8(struct chip8 * p, uint8_t * data, uint16_t num_bytes)
 }
 
 static
-void
+int
 update_timers(struct chip8 *p)
 {
-    if(p == NULL)
+    /* returns 1 if the timers were clocked this cycle */
+    p->timer_acc += 60;
+    if(p->timer_acc < p->clock_hz)
     {
-        return;
+        return 0;
     }
-    p->tick += 1;
-    if(p->tick % p->timer_clock_div != 0)
+    p->timer_acc -= p->clock_hz;
+    if (p->rnd_steps >= 0x80000000u)
     {
-        return;
+        /* there is less than a second of cycles between timer clocks, so
+           checking here keeps rnd_steps from overflowing */
+        catch_up_rnd(p);
     }
-    p->tick = 0;
     if(p->sound_timer > 0)
     {
         p->sound_timer --;
-        p->chip8_io->buzzer_active = 1;
+        p->chip8_io.buzzer_active = 1;
     }
     else
     {
-        p->chip8_io->buzzer_active = 0;
+        p->chip8_io.buzzer_active = 0;
     }
     if(p->delay_timer > 0)
     {
         p->delay_timer --;
     }
+    if (p->audio != NULL)
+    {
+        render_audio(p, 1, p->chip8_io.buzzer_active);
+    }
+    return 1;
 }
 
-void
-execute_cycle_chip8(struct chip8 *p)
+static
+int
+key_down_chip8(struct chip8 *p)
 {
+    /* true if a key is down that would end an Fx0A wait */
     uint8_t n;
-    uint16_t opcode;
-    void (*fn)(struct chip8 *, uint16_t);
 
-    if(p==NULL)
+    for (n = 0; n < 16; n++)
     {
-        return;
+        if (p->chip8_io.keypad_state[n] == 1)
+        {
+            return 1;
+        }
     }
+    return 0;
+}
 
-    p->chip8_io->update_display = 0;
+static
+unsigned int
+step_chip8(struct chip8 *p)
+{
+    /* A single fetch, decode, execute cycle. Returns the enum chip8_exit_reason
+       flags for anything the host may want to react to. */
+    uint8_t n;
+    uint16_t opcode;
+    unsigned int reason;
+    struct chip8_decoded *d, uncached;
+
+    reason = CHIP8_EXIT_BUDGET;
+    p->chip8_io.update_display = 0;
 
     if(p->waiting_for_key == 1)
     {
         /* check to see if there is a key press */
         for (n=0; n<16; n++)
         {
-            if(p->chip8_io->keypad_state[n] == 1)
+            if(p->chip8_io.keypad_state[n] == 1)
             {
                 p->V[p->key_x] = n;
                 p->waiting_for_key = 0;
@@ -122,45 +297,868 @@ execute_cycle_chip8(struct chip8 *p)
         /* no key press so we do not continue*/
         if(p->waiting_for_key == 1)
         {
-            update_timers(p);
-            return;
+            PROFILE_BLOCKED(p, 1);
+            reason |= CHIP8_EXIT_KEY_WAIT;
+            if (update_timers(p))
+            {
+                reason |= CHIP8_EXIT_TIMER;
+            }
+            return reason;
         }
     }
 
-    /* update internal random number generator */
-    p->rnd = lfsr_prng_process(p->prng);
+    /* update internal random number generator, see catch_up_rnd() */
+    p->rnd_steps++;
 
-    /* Grab the next opcode in the ROM. This is a 16bit chunk of data */
-    opcode = fetch_opcode(p);
+    d = fetch_decoded(p);
+    if (d != NULL)
+    {
+        /* The instruction has already been fetched and decoded from RAM,
+           so we can go straight to the instruction function */
+        p->pc += 2;
+    }
+    else
+    {
+        /* Grab the next opcode in the ROM. This is a 16bit chunk of data */
+        opcode = fetch_opcode(p);
 
-    /* Decode the opcode. This takes the opcode and gets the instruction function pointer */
-    fn = decode_opcode(opcode);
+        /* Decode the opcode. The cache doesn't cover this address so
+           decode into a temporary */
+        decode_instruction(opcode, &uncached);
+        d = &uncached;
+    }
 
-    /* Now, execute the instruction as we have the opcode (which still contains the variable part)
-       decoded instruction */
-    fn(p, opcode);
+    /* Now, execute the instruction */
+    PROFILE_INSTRUCTION(p, p->pc - 2u, d->op);
+    op_handler_table[d->op](p, d->opcode);
 
-    update_timers(p);
+    if (p->chip8_io.update_display)
+    {
+        reason |= CHIP8_EXIT_DRAW;
+    }
+    if (p->waiting_for_key)
+    {
+        reason |= CHIP8_EXIT_KEY_WAIT;
+    }
+    if (update_timers(p))
+    {
+        reason |= CHIP8_EXIT_TIMER;
+    }
+    return reason;
+}
 
-    return;
+static
+unsigned int
+step_traced(struct chip8 *p)
+{
+    /* step_chip8(), recording the instruction in the trace */
+    uint16_t pc, opcode;
+    unsigned int reason;
+
+    if (p->waiting_for_key == 1 && !key_down_chip8(p))
+    {
+        skip_trace(p, 1);
+        return step_chip8(p);
+    }
+    /* read before it runs, in case it overwrites itself */
+    pc = p->pc;
+    opcode = (uint16_t)(p->mem[pc & CHIP8_ADDRESS_MASK] << 8 | p->mem[(pc + 1) & CHIP8_ADDRESS_MASK]);
+    reason = step_chip8(p);
+    record_trace(p, pc, opcode);
+    return reason;
+}
+
+void
+execute_cycle_chip8(struct chip8 *p)
+{
+    if(p==NULL)
+    {
+        return;
+    }
+    if (p->trace != NULL)
+    {
+        step_traced(p);
+        return;
+    }
+#ifdef CHIP8_CORE_SWITCH
+    execute_cycles_switch(p, 1, NULL);
+#else
+    step_chip8(p);
+#endif
+}
+
+#ifdef CHIP8_ENABLE_JIT
+static
+int
+same_state_chip8(struct chip8 *a, struct chip8 *b)
+{
+    uint32_t buff_a, buff_b, polynomial_a, polynomial_b;
+
+    catch_up_rnd(a);
+    catch_up_rnd(b);
+    get_state_lfsr_prng(&a->prng, &buff_a, &polynomial_a);
+    get_state_lfsr_prng(&b->prng, &buff_b, &polynomial_b);
+    return memcmp(a->mem, b->mem, CHIP8_MEM_SIZE_BYTES) == 0
+        && a->pc == b->pc
+        && memcmp(a->V, b->V, sizeof(a->V)) == 0
+        && a->I == b->I
+        && a->delay_timer == b->delay_timer
+        && a->sound_timer == b->sound_timer
+        && memcmp(a->stack, b->stack, sizeof(a->stack)) == 0
+        && a->sp == b->sp
+        && a->timer_acc == b->timer_acc
+        && a->clock_hz == b->clock_hz
+        && buff_a == buff_b
+        && a->rnd == b->rnd
+        && a->waiting_for_key == b->waiting_for_key
+        && a->key_x == b->key_x
+        && memcmp(a->fbuff, b->fbuff, sizeof(a->fbuff)) == 0
+        && a->chip8_io.update_display == b->chip8_io.update_display
+        && a->chip8_io.buzzer_active == b->chip8_io.buzzer_active;
+}
+
+static
+void
+check_jit_block_chip8(struct chip8 *p, uint32_t num_instructions)
+{
+    /* p->shadow was a copy of p before the block ran, bring it up to date
+       with the interpreter and make sure they agree */
+    uint32_t i;
+    uint16_t start;
+
+    start = p->shadow->pc;
+    for (i = 0; i < num_instructions; i++)
+    {
+        execute_cycle_chip8(p->shadow);
+    }
+    if (!same_state_chip8(p, p->shadow))
+    {
+        fprintf(stderr, "JIT mismatch in the block at 0x%03X, falling back to CHIP8_EXEC_BLOCKS\n", start);
+        clone_chip8(p, p->shadow);
+        p->exec_mode = CHIP8_EXEC_BLOCKS;
+    }
+}
+#endif
+
+uint32_t
+timer_cycles_remaining(struct chip8 *p)
+{
+    return (p->clock_hz - p->timer_acc + 59) / 60;
+}
+
+int
+advance_timers(struct chip8 *p, uint32_t num_cycles)
+{
+    if (num_cycles == 0)
+    {
+        return 0;
+    }
+    p->timer_acc += 60 * (num_cycles - 1);
+    return update_timers(p);
+}
+
+const uint8_t starts_idle_loop[CHIP8_OP_COUNT] = {
+    0, /* NONE */       0, /* 0nnn */       0, /* 00E0 */       0, /* 00EE */
+    1, /* 1nnn */       0, /* 2nnn */       0, /* 3xkk */       0, /* 4xkk */
+    0, /* 5xy0 */       0, /* 6xkk */       0, /* 7xkk */       0, /* 8xy0 */
+    0, /* 8xy1 */       0, /* 8xy2 */       0, /* 8xy3 */       0, /* 8xy4 */
+    0, /* 8xy5 */       0, /* 8xy6 */       0, /* 8xy7 */       0, /* 8xyE */
+    0, /* 9xy0 */       0, /* Annn */       0, /* Bnnn */       0, /* Cxkk */
+    0, /* Dxyn */       0, /* Ex9E */       0, /* ExA1 */       1, /* Fx07 */
+    0, /* Fx0A */       0, /* Fx15 */       0, /* Fx18 */       0, /* Fx1E */
+    0, /* Fx29 */       0, /* Fx33 */       0, /* Fx55 */       0, /* Fx65 */
+    0  /* ILLEGAL */
+};
+
+static
+int
+skip_not_taken(struct chip8 *p, const struct chip8_decoded *d)
+{
+    /* True if d is a conditional skip on registers or the keypad that won't
+       skip. Neither can change while execute_cycles_chip8() runs. */
+    switch (d->op)
+    {
+        case CHIP8_OP_3xkk:
+            return p->V[d->x] != d->kk;
+        case CHIP8_OP_4xkk:
+            return p->V[d->x] == d->kk;
+        case CHIP8_OP_5xy0:
+            return p->V[d->x] != p->V[d->y];
+        case CHIP8_OP_9xy0:
+            return p->V[d->x] == p->V[d->y];
+        case CHIP8_OP_Ex9E:
+            return p->chip8_io.keypad_state[p->V[d->x] & 0x0F] == 0;
+        case CHIP8_OP_ExA1:
+            return p->chip8_io.keypad_state[p->V[d->x] & 0x0F] != 0;
+        default:
+            return 0;
+    }
+}
+
+uint32_t
+skip_idle_loop(struct chip8 *p, uint32_t max_cycles, unsigned int *exit_reason)
+{
+    /* Wait loops only change state when the timers are clocked, so run up
+       to the next timer clock in one go. Three loops are recognised: a jump
+       to itself, a jump back to a skip that isn't taken (e.g. waiting for a
+       key), and the usual wait for the delay timer:
+            A:  Fx07        LD Vx, DT
+                3xkk        SE Vx, kk   (or any skip that isn't taken)
+                1nnn        JP A
+       Only whole trips round the loop are skipped. */
+    struct chip8_decoded *d, *skip, *jump;
+    uint32_t num_cycles, loop_len;
+    uint8_t vx = 0;
+
+    d = fetch_decoded(p);
+    if (d == NULL || p->waiting_for_key)
+    {
+        return 0;
+    }
+    if (d->op == CHIP8_OP_1nnn && d->nnn == p->pc)
+    {
+        loop_len = 1;
+    }
+    else if (d->op == CHIP8_OP_1nnn && d->nnn + 2u == p->pc)
+    {
+        skip = decoded_at(p, d->nnn);
+        if (skip == NULL || !skip_not_taken(p, skip))
+        {
+            return 0;
+        }
+        loop_len = 2;
+    }
+    else if (d->op == CHIP8_OP_Fx07)
+    {
+        skip = decoded_at(p, p->pc + 2u);
+        jump = decoded_at(p, p->pc + 4u);
+        if (skip == NULL || jump == NULL || jump->op != CHIP8_OP_1nnn || jump->nnn != p->pc)
+        {
+            return 0;
+        }
+        /* Fx07 sets Vx before the skip looks at it */
+        vx = p->V[d->x];
+        p->V[d->x] = p->delay_timer;
+        if (!skip_not_taken(p, skip))
+        {
+            p->V[d->x] = vx;
+            return 0;
+        }
+        loop_len = 3;
+    }
+    else
+    {
+        return 0;
+    }
+    num_cycles = timer_cycles_remaining(p);
+    if (num_cycles > max_cycles)
+    {
+        num_cycles = max_cycles;
+    }
+    num_cycles -= num_cycles % loop_len;
+    if (num_cycles == 0)
+    {
+        if (loop_len == 3)
+        {
+            p->V[d->x] = vx;
+        }
+        return 0;
+    }
+    PROFILE_IDLE_LOOP(p, loop_len == 2 ? d->nnn : p->pc, loop_len, num_cycles / loop_len);
+    p->chip8_io.update_display = 0;
+    p->rnd_steps += num_cycles;
+    if (advance_timers(p, num_cycles) && exit_reason != NULL)
+    {
+        *exit_reason |= CHIP8_EXIT_TIMER;
+    }
+    return num_cycles;
+}
+
+static
+unsigned int
+run_block_chip8(struct chip8 *p, uint32_t num_instructions)
+{
+    /* Execute the first num_instructions of the translated block at the
+       program counter. The caller makes sure the timers are clocked on the 
+       last instruction at the earliest, so the timers can be brought up to 
+       date once at the end. Only the final instruction of a block can read
+       the program counter, draw or wait for a key. */
+    uint32_t i;
+    unsigned int reason;
+    struct chip8_decoded *d;
+
+    uint16_t start;
+
+    reason = CHIP8_EXIT_BUDGET;
+    start = p->pc;
+    d = &p->decoded[start >> 1];
+    p->chip8_io.update_display = 0;
+    p->pc += 2 * num_instructions;
+#ifdef CHIP8_ENABLE_JIT
+    if (p->jit == NULL || p->exec_mode < CHIP8_EXEC_JIT
+        || execute_jit_block(p, start, num_instructions) != 0)
+#endif
+    {
+        for (i = 0; i < num_instructions; i++, d++)
+        {
+            p->rnd_steps++;
+            PROFILE_INSTRUCTION(p, start + 2 * i, d->op);
+            op_handler_table[d->op](p, d->opcode);
+        }
+    }
+
+    if (p->chip8_io.update_display)
+    {
+        reason |= CHIP8_EXIT_DRAW;
+    }
+    if (p->waiting_for_key)
+    {
+        reason |= CHIP8_EXIT_KEY_WAIT;
+    }
+    if (advance_timers(p, num_instructions))
+    {
+        reason |= CHIP8_EXIT_TIMER;
+    }
+    return reason;
+}
+
+uint32_t
+execute_cycles_chip8(struct chip8 *p, uint32_t num_cycles, unsigned int *exit_reason)
+{
+    uint32_t executed, n, remaining;
+    unsigned int reason;
+
+    executed = 0;
+    reason = CHIP8_EXIT_BUDGET;
+    if (p != NULL && p->trace != NULL)
+    {
+        /* one instruction at a time, so each one can be recorded */
+        while (executed < num_cycles && reason == CHIP8_EXIT_BUDGET)
+        {
+            reason = step_traced(p);
+            executed ++;
+        }
+    }
+    else if(p != NULL && p->exec_mode != CHIP8_EXEC_INTERPRETER)
+    {
+        while (executed < num_cycles && reason == CHIP8_EXIT_BUDGET)
+        {
+            n = MAYBE_IDLE_LOOP(p) ? skip_idle_loop(p, num_cycles - executed, &reason) : 0;
+            if (n != 0)
+            {
+                executed += n;
+                continue;
+            }
+            n = p->waiting_for_key ? 0 : translate_block(p);
+            if (n == 0)
+            {
+                /* there is no block here, take a single step instead */
+                reason = step_chip8(p);
+                executed ++;
+                continue;
+            }
+            remaining = num_cycles - executed;
+            if (n > remaining)
+            {
+                n = remaining;
+            }
+            remaining = timer_cycles_remaining(p);
+            if (n > remaining)
+            {
+                n = remaining;
+            }
+#ifdef CHIP8_ENABLE_JIT
+            if (p->exec_mode == CHIP8_EXEC_JIT_CHECKED)
+            {
+                clone_chip8(p->shadow, p);
+                reason = run_block_chip8(p, n);
+                check_jit_block_chip8(p, n);
+                executed += n;
+                continue;
+            }
+#endif
+            reason = run_block_chip8(p, n);
+            executed += n;
+        }
+    }
+    else if(p != NULL)
+    {
+#ifdef CHIP8_CORE_SWITCH
+        executed = execute_cycles_switch(p, num_cycles, &reason);
+#else
+        /* one step_chip8() at a time, jumping over any wait loop for the
+           timers in one go */
+        while (executed < num_cycles && reason == CHIP8_EXIT_BUDGET)
+        {
+            n = MAYBE_IDLE_LOOP(p) ? skip_idle_loop(p, num_cycles - executed, &reason) : 0;
+            if (n != 0)
+            {
+                executed += n;
+                continue;
+            }
+            reason = step_chip8(p);
+            executed ++;
+        }
+#endif
+    }
+    if (exit_reason != NULL)
+    {
+        *exit_reason = reason;
+    }
+    return executed;
+}
+
+unsigned int
+run_frame_chip8(struct chip8 *p)
+{
+    uint32_t remaining, n;
+    unsigned int reason, summary;
+
+    if (p == NULL)
+    {
+        return 0;
+    }
+    summary = 0;
+    remaining = timer_cycles_remaining(p);
+    while (remaining > 0)
+    {
+        /* once blocked with no key down the rest of the frame is just the
+           timers, so it can be done in one step */
+        n = skip_key_wait_chip8(p, remaining, NULL);
+        if (n != 0)
+        {
+            summary |= CHIP8_FRAME_KEY_WAIT;
+            remaining -= n;
+            continue;
+        }
+        n = execute_cycles_chip8(p, remaining, &reason);
+        remaining -= n;
+        if (reason & CHIP8_EXIT_DRAW)
+        {
+            summary |= CHIP8_FRAME_DISPLAY;
+        }
+        if (reason & CHIP8_EXIT_KEY_WAIT)
+        {
+            summary |= CHIP8_FRAME_KEY_WAIT;
+        }
+    }
+    /* the clock that ended the frame sets the buzzer if the sound timer
+       was still running */
+    if (p->chip8_io.buzzer_active)
+    {
+        summary |= CHIP8_FRAME_BUZZER;
+    }
+    return summary;
+}
+
+int
+get_key_wait_chip8(struct chip8 *p, uint32_t *timer_cycles)
+{
+    uint64_t longest;
+
+    if (p == NULL)
+    {
+        return 0;
+    }
+    if (timer_cycles != NULL)
+    {
+        /* the timers run out on the clock that takes the longer one to 0,
+           that is when timer_acc has gone up by longest * clock_hz */
+        longest = p->delay_timer > p->sound_timer ? p->delay_timer : p->sound_timer;
+        *timer_cycles = 0;
+        if (longest > 0)
+        {
+            *timer_cycles = (uint32_t)((longest * p->clock_hz - p->timer_acc + 59) / 60);
+        }
+    }
+    return p->waiting_for_key == 1;
+}
+
+uint32_t
+skip_key_wait_chip8(struct chip8 *p, uint32_t num_cycles, uint32_t *num_timer_clocks)
+{
+    /* A blocked cycle only counts towards the next timer clock, so work out
+       how many clocks num_cycles covers and apply them all at once */
+    uint64_t acc;
+    uint32_t clocks, on;
+
+    if (num_timer_clocks != NULL)
+    {
+        *num_timer_clocks = 0;
+    }
+    if (p == NULL || p->waiting_for_key != 1 || key_down_chip8(p) || num_cycles == 0)
+    {
+        return 0;
+    }
+    PROFILE_BLOCKED(p, num_cycles);
+    if (p->trace != NULL)
+    {
+        skip_trace(p, num_cycles);
+    }
+    acc = p->timer_acc + (uint64_t)60 * num_cycles;
+    clocks = (uint32_t)(acc / p->clock_hz);
+    p->timer_acc = (uint32_t)(acc % p->clock_hz);
+    p->chip8_io.update_display = 0;
+    if (clocks > 0)
+    {
+        if (p->audio != NULL)
+        {
+            /* the buzzer is on for the clocks the sound timer lasts */
+            on = clocks < p->sound_timer ? clocks : p->sound_timer;
+            render_audio(p, on, 1);
+            render_audio(p, clocks - on, 0);
+        }
+        /* the buzzer is left as the last clock set it */
+        p->chip8_io.buzzer_active = p->sound_timer >= clocks;
+        p->delay_timer = clocks < p->delay_timer ? (uint8_t)(p->delay_timer - clocks) : 0;
+        p->sound_timer = clocks < p->sound_timer ? (uint8_t)(p->sound_timer - clocks) : 0;
+    }
+    if (num_timer_clocks != NULL)
+    {
+        *num_timer_clocks = clocks;
+    }
+    return num_cycles;
+}
+
+int
+set_key_chip8(struct chip8 *p, uint8_t key, int pressed)
+{
+    int was_blocked;
+
+    if (p == NULL || key > 0xF)
+    {
+        return 0;
+    }
+    was_blocked = p->waiting_for_key == 1 && !key_down_chip8(p);
+    p->chip8_io.keypad_state[key] = pressed ? 1 : 0;
+    return was_blocked && pressed;
+}
+
+int
+set_exec_mode_chip8(struct chip8 *p, enum chip8_exec_mode mode)
+{
+    if (p == NULL || mode < CHIP8_EXEC_INTERPRETER || mode > CHIP8_EXEC_JIT_CHECKED)
+    {
+        return 1;
+    }
+    if (mode >= CHIP8_EXEC_JIT)
+    {
+#ifdef CHIP8_ENABLE_JIT
+        if (p->jit == NULL)
+        {
+            p->jit = initialise_jit();
+        }
+        if (mode == CHIP8_EXEC_JIT_CHECKED && p->shadow == NULL)
+        {
+            /* the clock rate is copied over along with everything else */
+            p->shadow = initialise_chip8(CHIP8_CLOCK_RATE_600Hz);
+        }
+        if (p->jit == NULL || (mode == CHIP8_EXEC_JIT_CHECKED && p->shadow == NULL))
+        {
+            return 1;
+        }
+#else
+        return 1;
+#endif
+    }
+    p->exec_mode = (uint8_t) mode;
+    return 0;
 }
 
 int 
 change_clock_rate_chip8(struct chip8 *p, enum chip8_clock clock)
 {
-    if (p == NULL || clock < CHIP8_CLOCK_RATE_300Hz || clock > CHIP8_CLOCK_RATE_900Hz)
+    if (clock < CHIP8_CLOCK_RATE_300Hz || clock > CHIP8_CLOCK_RATE_900Hz)
+    {
+        return 1;
+    }
+    return change_clock_hz_chip8(p, 60u * clock);
+}
+
+int
+change_clock_hz_chip8(struct chip8 *p, uint32_t clock_hz)
+{
+    if (p == NULL || clock_hz < CHIP8_MIN_CLOCK_HZ || clock_hz > CHIP8_MAX_CLOCK_HZ)
+    {
+        return 1;
+    }
+    p->clock_hz = clock_hz;
+    /* keep counting from where we are in the timer period */
+    p->timer_acc %= clock_hz;
+    return 0;
+}
+
+uint32_t
+get_clock_hz_chip8(struct chip8 *p)
+{
+    if (p == NULL)
+    {
+        return 0;
+    }
+    return p->clock_hz;
+}
+
+uint32_t
+get_timer_cycles_chip8(struct chip8 *p)
+{
+    if (p == NULL)
+    {
+        return 0;
+    }
+    return timer_cycles_remaining(p);
+}
+
+int
+set_prng_chip8(struct chip8 *p, uint32_t seed, uint32_t polynomial)
+{
+    if (p == NULL || (polynomial != 0 && (polynomial & 0x80000000u) == 0))
+    {
+        return 1;
+    }
+    init_lfsr_prng(&p->prng, seed, polynomial);
+    p->rnd_steps = 0;
+    /* rnd is always the low byte of the generator */
+    p->rnd = (uint8_t) p->prng.buff;
+    return 0;
+}
+
+/*
+A saved state is a header followed by RAM, the saved part of struct chip8, 
+the random number generator and the chip8_io struct, all in the host's own 
+layout. The size in the header catches states saved by a different build.
+*/
+#define CHIP8_STATE_VERSION (4)
+#define CHIP8_STATE_CHUNK (64)              /* RAM is compared this much at a time on load */
+
+struct chip8_state_header
+{
+    char        magic[4];
+    uint32_t    version;
+    uint32_t    size;
+};
+
+struct chip8_state_prng
+{
+    uint32_t    buff;
+    uint32_t    polynomial;
+};
+
+/* A RAM page shared copy-on-write between clones */
+struct chip8_mem_page
+{
+    uint32_t    refs;
+    uint8_t     mem[CHIP8_MEM_SIZE_BYTES];
+};
+
+static
+void
+load_mem_chip8(struct chip8 *p, const uint8_t *mem, int copy)
+{
+    /* Bring RAM in line with mem. Only the decoded instructions for RAM that
+       is actually different are thrown away, as rolling back or cloning a 
+       running emulator usually only changes a few bytes of it. If copy is 0
+       the caller is about to point p->mem at mem, so only the cache needs 
+       updating. */
+    uint32_t address;
+
+    for (address = 0; address < CHIP8_MEM_SIZE_BYTES; address += CHIP8_STATE_CHUNK)
+    {
+        if (memcmp(&p->mem[address], &mem[address], CHIP8_STATE_CHUNK) != 0)
+        {
+            invalidate_decoded(p, address, CHIP8_STATE_CHUNK);
+            if (copy)
+            {
+                memcpy(&p->mem[address], &mem[address], CHIP8_STATE_CHUNK);
+            }
+        }
+    }
+}
+
+static
+void
+release_mem_chip8(struct chip8 *p)
+{
+    /* stop sharing a RAM page, without copying it */
+    if (p->mem_page != NULL)
+    {
+        p->mem_page->refs--;
+        if (p->mem_page->refs == 0)
+        {
+            free(p->mem_page);
+        }
+        p->mem_page = NULL;
+    }
+    p->mem = p->own_mem;
+}
+
+void
+catch_up_rnd(struct chip8 *p)
+{
+    if (p->rnd_steps != 0)
+    {
+        p->rnd = lfsr_prng_skip(&p->prng, p->rnd_steps);
+        p->rnd_steps = 0;
+    }
+}
+
+void
+unshare_mem(struct chip8 *p)
+{
+    if (p->mem_page != NULL)
+    {
+        memcpy(p->own_mem, p->mem_page->mem, CHIP8_MEM_SIZE_BYTES);
+        release_mem_chip8(p);
+    }
+}
+
+uint32_t
+state_size_chip8(void)
+{
+    return (uint32_t)(sizeof(struct chip8_state_header) + CHIP8_MEM_SIZE_BYTES 
+                      + CHIP8_SAVED_BYTES + sizeof(struct chip8_state_prng) 
+                      + sizeof(struct chip8_io));
+}
+
+int
+save_state_chip8(struct chip8 *p, void *buff)
+{
+    struct chip8_state_header header;
+    struct chip8_state_prng prng;
+    uint8_t *out;
+
+    if (p == NULL || buff == NULL)
+    {
+        return 1;
+    }
+    memcpy(header.magic, "C8ST", 4);
+    header.version = CHIP8_STATE_VERSION;
+    header.size = state_size_chip8();
+    catch_up_rnd(p);
+    get_state_lfsr_prng(&p->prng, &prng.buff, &prng.polynomial);
+
+    out = (uint8_t *) buff;
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    memcpy(out, p->mem, CHIP8_MEM_SIZE_BYTES);
+    out += CHIP8_MEM_SIZE_BYTES;
+    memcpy(out, (uint8_t *) p + CHIP8_SAVED_START, CHIP8_SAVED_BYTES);
+    out += CHIP8_SAVED_BYTES;
+    memcpy(out, &prng, sizeof(prng));
+    out += sizeof(prng);
+    memcpy(out, &p->chip8_io, sizeof(struct chip8_io));
+    return 0;
+}
+
+int
+load_state_chip8(struct chip8 *p, const void *buff)
+{
+    struct chip8_state_header header;
+    struct chip8_state_prng prng;
+    const uint8_t *in;
+
+    if (p == NULL || buff == NULL)
+    {
+        return 1;
+    }
+    in = (const uint8_t *) buff;
+    memcpy(&header, in, sizeof(header));
+    if (memcmp(header.magic, "C8ST", 4) != 0 || header.version != CHIP8_STATE_VERSION
+        || header.size != state_size_chip8())
     {
         return 1;
     }
-    p->timer_clock_div = clock;
+    in += sizeof(header);
+    load_mem_chip8(p, in, 1);
+    in += CHIP8_MEM_SIZE_BYTES;
+    memcpy((uint8_t *) p + CHIP8_SAVED_START, in, CHIP8_SAVED_BYTES);
+    in += CHIP8_SAVED_BYTES;
+    memcpy(&prng, in, sizeof(prng));
+    set_state_lfsr_prng(&p->prng, prng.buff, prng.polynomial);
+    in += sizeof(prng);
+    memcpy(&p->chip8_io, in, sizeof(struct chip8_io));
+    return 0;
+}
+
+static
+void
+clone_state_chip8(struct chip8 *dst, struct chip8 *src)
+{
+    /* everything but RAM, which the caller has already dealt with */
+    uint32_t buff, polynomial;
+
+    memcpy((uint8_t *) dst + CHIP8_SAVED_START, (uint8_t *) src + CHIP8_SAVED_START, CHIP8_SAVED_BYTES);
+    get_state_lfsr_prng(&src->prng, &buff, &polynomial);
+    set_state_lfsr_prng(&dst->prng, buff, polynomial);
+    dst->chip8_io = src->chip8_io;
+}
+
+int
+clone_chip8(struct chip8 *dst, struct chip8 *src)
+{
+    if (dst == NULL || src == NULL)
+    {
+        return 1;
+    }
+    if (dst != src)
+    {
+        load_mem_chip8(dst, src->mem, 1);
+        clone_state_chip8(dst, src);
+    }
+    return 0;
+}
+
+int
+clone_shared_chip8(struct chip8 *dst, struct chip8 *src)
+{
+    struct chip8_mem_page *page;
+
+    if (dst == NULL || src == NULL)
+    {
+        return 1;
+    }
+    if (dst == src || (dst->mem_page != NULL && dst->mem_page == src->mem_page))
+    {
+        clone_state_chip8(dst, src);
+        return 0;
+    }
+    if (src->mem_page == NULL)
+    {
+        /* move the source's RAM into a page that can be shared */
+        page = malloc(sizeof(struct chip8_mem_page));
+        if (page == NULL)
+        {
+            return 1;
+        }
+        memcpy(page->mem, src->own_mem, CHIP8_MEM_SIZE_BYTES);
+        page->refs = 1;
+        src->mem_page = page;
+        src->mem = page->mem;
+    }
+    /* dst is about to drop its own RAM, so it mustn't be copied first */
+    page = dst->mem_page;
+    dst->mem_page = NULL;
+    load_mem_chip8(dst, src->mem, 0);
+    dst->mem_page = page;
+    release_mem_chip8(dst);
+    dst->mem_page = src->mem_page;
+    dst->mem_page->refs++;
+    dst->mem = dst->mem_page->mem;
+    clone_state_chip8(dst, src);
     return 0;
 }
 
 void 
 free_chip8(struct chip8 * p)
 {
-    free_lfsr_prng(p->prng);
-    free(p->chip8_io);
-    free(p);
+#ifdef CHIP8_ENABLE_JIT
+    free_jit(p->jit);
+    if (p->shadow != NULL)
+    {
+        free_chip8(p->shadow);
+    }
+#endif
+    release_mem_chip8(p);
+    /* NULL if the caller owns the memory */
+    free(p->allocation);
     return;
 }
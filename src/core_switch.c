@@ -0,0 +1,331 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "core.h"
+#include "decode.h"
+#include "instructions.h"
+#include "chip8_priv.h"
+#include "chip8.h"
+
+/*
+An interpreter core with every instruction written out inline in one
+dispatch loop, rather than the op_* functions reached through tables of 
+function pointers. Instructions come from the predecoded cache in decode.h,
+so there is only one dispatch per cycle however the opcode is laid out.
+
+GCC and Clang dispatch with computed goto when built with -DCHIP8_CORE=goto,
+otherwise (and under strict C90) it is a dense switch on enum chip8_op.
+The instructions have to match the op_* functions in instructions.c exactly.
+*/
+
+#if defined(CHIP8_CORE_COMPUTED_GOTO) && defined(__GNUC__)
+#define USE_COMPUTED_GOTO
+#endif
+
+#ifdef USE_COMPUTED_GOTO
+/* labels as values are a GNU extension */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define DISPATCH(op) goto *dispatch_table[op];
+#define CASE(op) label_##op:
+#define NEXT goto next
+#else
+#define DISPATCH(op) switch (op)
+#define CASE(op) case op:
+#define NEXT break
+#endif
+
+uint32_t
+execute_cycles_switch(struct chip8 *p, uint32_t num_cycles, unsigned int *exit_reason)
+{
+#ifdef USE_COMPUTED_GOTO
+    static const void *dispatch_table[CHIP8_OP_COUNT] = {
+        &&label_CHIP8_OP_NONE, &&label_CHIP8_OP_0nnn, &&label_CHIP8_OP_00E0, &&label_CHIP8_OP_00EE,
+        &&label_CHIP8_OP_1nnn, &&label_CHIP8_OP_2nnn, &&label_CHIP8_OP_3xkk, &&label_CHIP8_OP_4xkk,
+        &&label_CHIP8_OP_5xy0, &&label_CHIP8_OP_6xkk, &&label_CHIP8_OP_7xkk, &&label_CHIP8_OP_8xy0,
+        &&label_CHIP8_OP_8xy1, &&label_CHIP8_OP_8xy2, &&label_CHIP8_OP_8xy3, &&label_CHIP8_OP_8xy4,
+        &&label_CHIP8_OP_8xy5, &&label_CHIP8_OP_8xy6, &&label_CHIP8_OP_8xy7, &&label_CHIP8_OP_8xyE,
+        &&label_CHIP8_OP_9xy0, &&label_CHIP8_OP_Annn, &&label_CHIP8_OP_Bnnn, &&label_CHIP8_OP_Cxkk,
+        &&label_CHIP8_OP_Dxyn, &&label_CHIP8_OP_Ex9E, &&label_CHIP8_OP_ExA1, &&label_CHIP8_OP_Fx07,
+        &&label_CHIP8_OP_Fx0A, &&label_CHIP8_OP_Fx15, &&label_CHIP8_OP_Fx18, &&label_CHIP8_OP_Fx1E,
+        &&label_CHIP8_OP_Fx29, &&label_CHIP8_OP_Fx33, &&label_CHIP8_OP_Fx55, &&label_CHIP8_OP_Fx65,
+        &&label_CHIP8_OP_ILLEGAL
+    };
+#endif
+    struct chip8_io *io;
+    struct chip8_decoded *d, uncached;
+    uint32_t executed, until_timer, since_timer, skipped;
+    unsigned int reason;
+    uint8_t *V;
+    uint8_t n, r, i, start_row, start_col, end_row, carry, s, collision;
+    uint64_t sprite_row;
+
+    io = &p->chip8_io;
+    V = p->V;
+    reason = CHIP8_EXIT_BUDGET;
+    /* count down to the next timer clock here rather than updating timer_acc every cycle */
+    until_timer = timer_cycles_remaining(p);
+    since_timer = 0;
+
+    for (executed = 0; executed < num_cycles && reason == CHIP8_EXIT_BUDGET; executed++)
+    {
+        io->update_display = 0;
+        if (p->waiting_for_key == 1)
+        {
+            /* check to see if there is a key press */
+            for (n=0; n<16; n++)
+            {
+                if (io->keypad_state[n] == 1)
+                {
+                    V[p->key_x] = n;
+                    p->waiting_for_key = 0;
+                    break;
+                }
+            }
+            /* no key press so we do not continue*/
+            if (p->waiting_for_key == 1)
+            {
+                PROFILE_BLOCKED(p, 1);
+                reason |= CHIP8_EXIT_KEY_WAIT;
+                goto timers;
+            }
+        }
+
+        if (MAYBE_IDLE_LOOP(p))
+        {
+            /* it might be a wait loop, bring timer_acc up to date and run it to 
+               the next timer clock at once */
+            advance_timers(p, since_timer);
+            since_timer = 0;
+            skipped = skip_idle_loop(p, num_cycles - executed, &reason);
+            until_timer = timer_cycles_remaining(p);
+            if (skipped != 0)
+            {
+                executed += skipped - 1;
+                continue;
+            }
+        }
+
+        p->rnd_steps++;
+
+        if ((p->pc & 1) == 0 && p->pc < CHIP8_MEM_SIZE_BYTES)
+        {
+            d = &p->decoded[p->pc >> 1];
+            if (d->op == CHIP8_OP_NONE)
+            {
+                decode_instruction((uint16_t)(p->mem[p->pc] << 8 | p->mem[p->pc + 1]), d);
+            }
+            p->pc += 2;
+        }
+        else
+        {
+            decode_instruction(fetch_opcode(p), &uncached);
+            d = &uncached;
+        }
+
+        PROFILE_INSTRUCTION(p, p->pc - 2u, d->op);
+        DISPATCH(d->op)
+        {
+            CASE(CHIP8_OP_NONE)
+            CASE(CHIP8_OP_ILLEGAL)
+            CASE(CHIP8_OP_0nnn)
+                NEXT;
+            CASE(CHIP8_OP_00E0)
+                memset(p->fbuff, 0, CHIP8_SCREEN_HEIGHT * sizeof(uint64_t));
+                io->update_display = 1;
+                reason |= CHIP8_EXIT_DRAW;
+                NEXT;
+            CASE(CHIP8_OP_00EE)
+                p->sp--;
+                p->pc = p->stack[p->sp & 0x0F];
+                NEXT;
+            CASE(CHIP8_OP_1nnn)
+                p->pc = d->nnn;
+                NEXT;
+            CASE(CHIP8_OP_2nnn)
+                p->stack[p->sp & 0x0F] = p->pc;
+                p->sp ++;
+                p->pc = d->nnn;
+                NEXT;
+            CASE(CHIP8_OP_3xkk)
+                if (V[d->x] == d->kk)
+                {
+                    p->pc += 2;
+                }
+                NEXT;
+            CASE(CHIP8_OP_4xkk)
+                if (V[d->x] != d->kk)
+                {
+                    p->pc += 2;
+                }
+                NEXT;
+            CASE(CHIP8_OP_5xy0)
+                if (V[d->x] == V[d->y])
+                {
+                    p->pc += 2;
+                }
+                NEXT;
+            CASE(CHIP8_OP_6xkk)
+                V[d->x] = d->kk;
+                NEXT;
+            CASE(CHIP8_OP_7xkk)
+                V[d->x] += d->kk;
+                NEXT;
+            CASE(CHIP8_OP_8xy0)
+                V[d->x] = V[d->y];
+                NEXT;
+            CASE(CHIP8_OP_8xy1)
+                V[0xF] = 0;
+                V[d->x] |= V[d->y];
+                NEXT;
+            CASE(CHIP8_OP_8xy2)
+                V[0xF] = 0;
+                V[d->x] &= V[d->y];
+                NEXT;
+            CASE(CHIP8_OP_8xy3)
+                V[0xF] = 0;
+                V[d->x] ^= V[d->y];
+                NEXT;
+            CASE(CHIP8_OP_8xy4)
+                carry = V[d->x] > (255 - V[d->y]) ? 1 : 0;
+                V[d->x] = V[d->x] + V[d->y];
+                V[0xF] = carry;
+                NEXT;
+            CASE(CHIP8_OP_8xy5)
+                carry = V[d->x] >= V[d->y] ? 1 : 0;
+                V[d->x] = V[d->x] - V[d->y];
+                V[0xF] = carry;
+                NEXT;
+            CASE(CHIP8_OP_8xy6)
+                carry = V[d->y] & 0x01;
+                V[d->x] = V[d->y] >> 1;
+                V[0xF] = carry;
+                NEXT;
+            CASE(CHIP8_OP_8xy7)
+                carry = V[d->y] >= V[d->x] ? 1 : 0;
+                V[d->x] = V[d->y] - V[d->x];
+                V[0xF] = carry;
+                NEXT;
+            CASE(CHIP8_OP_8xyE)
+                carry = (V[d->y] & 0x80) >> 7;
+                V[d->x] = (uint8_t)(V[d->y] << 1);
+                V[0xF] = carry;
+                NEXT;
+            CASE(CHIP8_OP_9xy0)
+                if (V[d->x] != V[d->y])
+                {
+                    p->pc += 2;
+                }
+                NEXT;
+            CASE(CHIP8_OP_Annn)
+                p->I = d->nnn;
+                NEXT;
+            CASE(CHIP8_OP_Bnnn)
+                p->pc = d->nnn + V[0];
+                NEXT;
+            CASE(CHIP8_OP_Cxkk)
+                catch_up_rnd(p);
+                V[d->x] = d->kk & p->rnd;
+                NEXT;
+            CASE(CHIP8_OP_Dxyn)
+                collision = 0;
+                start_row = V[d->y] % CHIP8_SCREEN_HEIGHT;
+                start_col = V[d->x] % CHIP8_SCREEN_WIDTH;
+                end_row = start_row + d->n < CHIP8_SCREEN_HEIGHT ? start_row + d->n : CHIP8_SCREEN_HEIGHT;
+                for (r=start_row, i=0; r<end_row; r++, i++)
+                {
+                    sprite_row = ((uint64_t)p->mem[(p->I + i) & CHIP8_ADDRESS_MASK] << (CHIP8_SCREEN_WIDTH - 8)) >> start_col;
+                    if (p->fbuff[r] & sprite_row)
+                    {
+                        collision = 1;
+                    }
+                    PROFILE_SPRITE_ROW(p, sprite_row, p->fbuff[r]);
+                    p->fbuff[r] ^= sprite_row;
+                }
+                PROFILE_DRAW(p, collision);
+                V[0xF] = collision;
+                io->update_display = 1;
+                reason |= CHIP8_EXIT_DRAW;
+                NEXT;
+            CASE(CHIP8_OP_Ex9E)
+                if (io->keypad_state[V[d->x] & 0x0F] >= 1)
+                {
+                    p->pc += 2;
+                }
+                NEXT;
+            CASE(CHIP8_OP_ExA1)
+                if (io->keypad_state[V[d->x] & 0x0F] == 0)
+                {
+                    p->pc += 2;
+                }
+                NEXT;
+            CASE(CHIP8_OP_Fx07)
+                V[d->x] = p->delay_timer;
+                NEXT;
+            CASE(CHIP8_OP_Fx0A)
+                p->waiting_for_key = 1;
+                p->key_x = d->x;
+                reason |= CHIP8_EXIT_KEY_WAIT;
+                NEXT;
+            CASE(CHIP8_OP_Fx15)
+                p->delay_timer = V[d->x];
+                NEXT;
+            CASE(CHIP8_OP_Fx18)
+                p->sound_timer = V[d->x];
+                NEXT;
+            CASE(CHIP8_OP_Fx1E)
+                p->I = p->I + V[d->x];
+                NEXT;
+            CASE(CHIP8_OP_Fx29)
+                p->I = FONT_START_ADDRESS + V[d->x] * 5;
+                NEXT;
+            CASE(CHIP8_OP_Fx33)
+                /* d points into the cache, this can invalidate it */
+                s = V[d->x];
+                invalidate_decoded(p, p->I, 3);
+                p->mem[(p->I + 0) & CHIP8_ADDRESS_MASK] = s / 100;
+                p->mem[(p->I + 1) & CHIP8_ADDRESS_MASK] = (s / 10) % 10;
+                p->mem[(p->I + 2) & CHIP8_ADDRESS_MASK] = s % 10;
+                NEXT;
+            CASE(CHIP8_OP_Fx55)
+                s = d->x;
+                invalidate_decoded(p, p->I, s + 1);
+                for (n=0; n<s+1; n++, p->I++)
+                {
+                    p->mem[p->I & CHIP8_ADDRESS_MASK] = V[n];
+                }
+                NEXT;
+            CASE(CHIP8_OP_Fx65)
+                for (n=0; n<d->x+1; n++, p->I++)
+                {
+                    V[n] = p->mem[p->I & CHIP8_ADDRESS_MASK];
+                }
+                NEXT;
+        }
+#ifdef USE_COMPUTED_GOTO
+next:
+#endif
+
+timers:
+        since_timer ++;
+        if (--until_timer == 0)
+        {
+            advance_timers(p, since_timer);
+            reason |= CHIP8_EXIT_TIMER;
+            since_timer = 0;
+            until_timer = timer_cycles_remaining(p);
+        }
+    }
+    advance_timers(p, since_timer);
+
+    if (exit_reason != NULL)
+    {
+        *exit_reason = reason;
+    }
+    return executed;
+}
+
+#ifdef USE_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,172 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "decode.h"
+#include "instructions.h"
+#include "chip8_priv.h"
+#include "jit.h"
+#include "core.h"
+
+void
+decode_instruction(uint16_t opcode, struct chip8_decoded *d)
+{
+    /* pull all of the operands out up front, so they are ready to use
+       every time the instruction is executed */
+    d->opcode = opcode;
+    d->nnn = opcode & 0x0FFF;
+    d->x = (opcode & 0x0F00) >> 8;
+    d->y = (opcode & 0x00F0) >> 4;
+    d->n = opcode & 0x000F;
+    d->kk = opcode & 0x00FF;
+    d->op = (uint8_t) classify_opcode(opcode);
+}
+
+struct chip8_decoded *
+fetch_decoded(struct chip8 *p)
+{
+    /* Returns the decoded instruction at the program counter, decoding it
+       first if needed. Returns NULL for an odd or out of range program 
+       counter, which the cache doesn't cover, so the caller must fall back 
+       to fetch_opcode() and decode_opcode(). */
+    struct chip8_decoded *d;
+
+    if ((p->pc & 1) != 0 || p->pc >= CHIP8_MEM_SIZE_BYTES)
+    {
+        return NULL;
+    }
+    d = &p->decoded[p->pc >> 1];
+    if (d->op == CHIP8_OP_NONE)
+    {
+        decode_instruction((uint16_t)(p->mem[p->pc] << 8 | p->mem[p->pc + 1]), d);
+    }
+    return d;
+}
+
+struct chip8_decoded *
+decoded_at(struct chip8 *p, uint32_t address)
+{
+    /* As fetch_decoded(), for any address */
+    struct chip8_decoded *d;
+
+    if ((address & 1) != 0 || address >= CHIP8_MEM_SIZE_BYTES)
+    {
+        return NULL;
+    }
+    d = &p->decoded[address >> 1];
+    if (d->op == CHIP8_OP_NONE)
+    {
+        decode_instruction((uint16_t)(p->mem[address] << 8 | p->mem[address + 1]), d);
+    }
+    return d;
+}
+
+/* Instructions that have to be the last in a basic block */
+static const uint8_t ends_block[CHIP8_OP_COUNT] = {
+    1, /* NONE */       0, /* 0nnn */       1, /* 00E0 */       1, /* 00EE */
+    1, /* 1nnn */       1, /* 2nnn */       1, /* 3xkk */       1, /* 4xkk */
+    1, /* 5xy0 */       0, /* 6xkk */       0, /* 7xkk */       0, /* 8xy0 */
+    0, /* 8xy1 */       0, /* 8xy2 */       0, /* 8xy3 */       0, /* 8xy4 */
+    0, /* 8xy5 */       0, /* 8xy6 */       0, /* 8xy7 */       0, /* 8xyE */
+    1, /* 9xy0 */       0, /* Annn */       1, /* Bnnn */       0, /* Cxkk */
+    1, /* Dxyn */       1, /* Ex9E */       1, /* ExA1 */       0, /* Fx07 */
+    1, /* Fx0A */       0, /* Fx15 */       0, /* Fx18 */       0, /* Fx1E */
+    0, /* Fx29 */       1, /* Fx33 */       1, /* Fx55 */       0, /* Fx65 */
+    1  /* ILLEGAL */
+};
+
+uint8_t
+translate_block(struct chip8 *p)
+{
+    /* Returns the number of instructions in the basic block at the program
+       counter, translating it first if needed. The block is the run of 
+       entries in p->decoded starting at the program counter. Returns 0 
+       where fetch_decoded() would return NULL. */
+    uint32_t start, i;
+    struct chip8_decoded *d;
+
+    if ((p->pc & 1) != 0 || p->pc >= CHIP8_MEM_SIZE_BYTES)
+    {
+        return 0;
+    }
+    start = p->pc >> 1;
+    if (p->block_len[start] != 0)
+    {
+        return p->block_len[start];
+    }
+    for (i = start; i < CHIP8_NUM_DECODED && i - start < CHIP8_MAX_BLOCK_LEN; i++)
+    {
+        d = &p->decoded[i];
+        if (d->op == CHIP8_OP_NONE)
+        {
+            decode_instruction((uint16_t)(p->mem[2 * i] << 8 | p->mem[2 * i + 1]), d);
+        }
+        if (ends_block[d->op])
+        {
+            i++;
+            break;
+        }
+    }
+    p->block_len[start] = (uint8_t)(i - start);
+    return p->block_len[start];
+}
+
+void
+invalidate_decoded(struct chip8 *p, uint32_t address, uint32_t num_bytes)
+{
+    /* Call this before writing num_bytes of RAM starting at address.
+       Each entry covers two bytes, the one at its even address and the next.
+       Any block that includes one of those entries has to go too, blocks
+       are never longer than CHIP8_MAX_BLOCK_LEN so we only need to look
+       that far back. */
+    uint32_t first, last, start;
+
+    if (num_bytes == 0)
+    {
+        return;
+    }
+    /* Every write to RAM comes through here first, so this is also where
+       a page shared with clones gets copied before it is changed */
+    if (p->mem_page != NULL)
+    {
+        unshare_mem(p);
+    }
+    address &= CHIP8_ADDRESS_MASK;
+    if (num_bytes > CHIP8_MEM_SIZE_BYTES)
+    {
+        num_bytes = CHIP8_MEM_SIZE_BYTES;
+    }
+    if (address + num_bytes > CHIP8_MEM_SIZE_BYTES)
+    {
+        /* the write wraps round to the start of RAM */
+        invalidate_decoded(p, 0, address + num_bytes - CHIP8_MEM_SIZE_BYTES);
+        num_bytes = CHIP8_MEM_SIZE_BYTES - address;
+    }
+    last = address + num_bytes - 1;
+    first = address >> 1;
+    last = last >> 1;
+    start = first >= CHIP8_MAX_BLOCK_LEN - 1 ? first - (CHIP8_MAX_BLOCK_LEN - 1) : 0;
+    for (; start < first; start++)
+    {
+        if (start + p->block_len[start] > first)
+        {
+            p->block_len[start] = 0;
+#ifdef CHIP8_ENABLE_JIT
+            if (p->jit != NULL)
+            {
+                invalidate_jit_block(p->jit, start);
+            }
+#endif
+        }
+    }
+    for (; first <= last; first++)
+    {
+        p->decoded[first].op = CHIP8_OP_NONE;
+        p->block_len[first] = 0;
+#ifdef CHIP8_ENABLE_JIT
+        if (p->jit != NULL)
+        {
+            invalidate_jit_block(p->jit, first);
+        }
+#endif
+    }
+}
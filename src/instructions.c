@@ -3,6 +3,8 @@
 #include <string.h>
 
 #include "instructions.h"
+#include "decode.h"
+#include "core.h"
 #include "chip8_priv.h"
 #include "chip8.h"
 
@@ -12,28 +14,29 @@ Chip-8 Technical Reference v1.0 by Thomas P. Greene available at
 http://devernay.free.fr/hacks/chip8/C8TECH10.HTM
 */
 
-/* Tables of function pointers to speed up instruction lookups */
+/* Tables of function pointers to speed up instruction lookups.
+   Opcodes that aren't instructions all go to op_illegal */
 static void (*op_FZZZ_table[102])(struct chip8 *, uint16_t) = {
-    NULL, NULL, NULL, NULL, NULL, NULL, NULL, op_Fx07,
-    NULL, NULL, op_Fx0A, NULL, NULL, NULL, NULL, NULL,
-    NULL, NULL, NULL, NULL, NULL, op_Fx15, NULL, NULL,
-    op_Fx18, NULL, NULL, NULL, NULL, NULL, op_Fx1E, NULL, 
-    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-    NULL, op_Fx29, NULL, NULL, NULL, NULL, NULL, NULL,
-    NULL, NULL, NULL, op_Fx33, NULL, NULL, NULL, NULL,
-    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 
-    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-    NULL, NULL, NULL, NULL, NULL, op_Fx55, NULL, NULL,
-    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-    NULL, NULL, NULL, NULL, NULL, op_Fx65
+    op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_Fx07,
+    op_illegal, op_illegal, op_Fx0A, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal,
+    op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_Fx15, op_illegal, op_illegal,
+    op_Fx18, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_Fx1E, op_illegal, 
+    op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal,
+    op_illegal, op_Fx29, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal,
+    op_illegal, op_illegal, op_illegal, op_Fx33, op_illegal, op_illegal, op_illegal, op_illegal,
+    op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, 
+    op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal,
+    op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal,
+    op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_Fx55, op_illegal, op_illegal,
+    op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_illegal,
+    op_illegal, op_illegal, op_illegal, op_illegal, op_illegal, op_Fx65
 };
 
 static void (*op_8ZZZ_table[16])(struct chip8 *, uint16_t) = {
     op_8xy0, op_8xy1, op_8xy2, op_8xy3, 
     op_8xy4, op_8xy5, op_8xy6, op_8xy7,
-    NULL, NULL, NULL, NULL,
-    NULL, NULL, op_8xyE, NULL
+    op_illegal, op_illegal, op_illegal, op_illegal,
+    op_illegal, op_illegal, op_8xyE, op_illegal
 };
 
 static void (*opcode4_table[16])(struct chip8 *, uint16_t) = {
@@ -43,6 +46,43 @@ static void (*opcode4_table[16])(struct chip8 *, uint16_t) = {
     op_Cxkk, op_Dxyn, op_EZZZ, op_FZZZ
 };
 
+/* Leaf instruction functions, indexed by enum chip8_op */
+void (*const op_handler_table[CHIP8_OP_COUNT])(struct chip8 *, uint16_t) = {
+    op_illegal, op_0ZZZ, op_0ZZZ, op_0ZZZ,
+    op_1nnn, op_2nnn, op_3xkk, op_4xkk,
+    op_5xy0, op_6xkk, op_7xkk, op_8xy0,
+    op_8xy1, op_8xy2, op_8xy3, op_8xy4,
+    op_8xy5, op_8xy6, op_8xy7, op_8xyE,
+    op_9xy0, op_Annn, op_Bnnn, op_Cxkk,
+    op_Dxyn, op_EZZZ, op_EZZZ, op_Fx07,
+    op_Fx0A, op_Fx15, op_Fx18, op_Fx1E,
+    op_Fx29, op_Fx33, op_Fx55, op_Fx65,
+    op_illegal
+};
+
+/* The name of each enum chip8_op */
+const char *const op_name_table[CHIP8_OP_COUNT] = {
+    "none", "0nnn", "00E0", "00EE",
+    "1nnn", "2nnn", "3xkk", "4xkk",
+    "5xy0", "6xkk", "7xkk", "8xy0",
+    "8xy1", "8xy2", "8xy3", "8xy4",
+    "8xy5", "8xy6", "8xy7", "8xyE",
+    "9xy0", "Annn", "Bnnn", "Cxkk",
+    "Dxyn", "Ex9E", "ExA1", "Fx07",
+    "Fx0A", "Fx15", "Fx18", "Fx1E",
+    "Fx29", "Fx33", "Fx55", "Fx65",
+    "illegal"
+};
+
+void
+op_illegal(struct chip8 *p, uint16_t opcode)
+{
+    /* The trap for every opcode that isn't a CHIP-8 instruction. 
+       These are ignored, the same as the unused 0nnn SYS calls. */
+    (void) p;
+    (void) opcode;
+}
+
 void 
 op_0ZZZ(struct chip8 *p, uint16_t opcode) 
 {
@@ -56,8 +96,8 @@ op_0ZZZ(struct chip8 *p, uint16_t opcode)
     if (op8 == 0x00E0)
     {
         /* Clear the display */
-        memset(p->chip8_io->fbuff, 0, CHIP8_SCREEN_HEIGHT * CHIP8_SCREEN_WIDTH * sizeof(uint8_t));
-        p->chip8_io->update_display = 1;
+        memset(p->fbuff, 0, CHIP8_SCREEN_HEIGHT * sizeof(uint64_t));
+        p->chip8_io.update_display = 1;
     }
     else if (op8 == 0x00EE)
     {
@@ -65,7 +105,7 @@ op_0ZZZ(struct chip8 *p, uint16_t opcode)
         /* first, move the stack pointer to the last used slot */
         p->sp--;
         /* then move the program counter to the address in that slot*/
-        p->pc = p->stack[p->sp];
+        p->pc = p->stack[p->sp & 0x0F];
     }
     else
     {
@@ -95,8 +135,9 @@ op_2nnn(struct chip8 *p, uint16_t opcode)
     uint16_t nnn;
 
     nnn = opcode & 0x0FFF;
-    /* put the current program counter onto the stack*/
-    p->stack[p->sp] = p->pc;
+    /* put the current program counter onto the stack, only the lower 4 bits
+       of the stack pointer index it so calls nested too deep wrap round */
+    p->stack[p->sp & 0x0F] = p->pc;
     /* the stack pointer always points to the next free slot */
     p->sp ++;
     p->pc = nnn;
@@ -431,6 +472,7 @@ op_Cxkk(struct chip8 *p, uint16_t opcode)
 
     kk = (opcode & 0x00FF);
     x = (opcode & 0x0F00) >> 8;
+    catch_up_rnd(p);
     p->V[x] = kk & p->rnd;
 }
 
@@ -450,7 +492,8 @@ op_Dxyn(struct chip8 *p, uint16_t opcode)
        more information on XOR, and section 2.4, Display, for more information 
        on the Chip-8 screen and sprites. */
 
-    uint8_t x, y, n, r, c, i, b, start_row, start_col, end_row, end_col, mask, sprite_chunk, sprite_bit, collision;
+    uint8_t x, y, n, r, i, start_row, start_col, end_row, collision;
+    uint64_t sprite_row;
 
     x = (opcode & 0x0F00) >> 8;
     y = (opcode & 0x00F0) >> 4;
@@ -460,24 +503,23 @@ op_Dxyn(struct chip8 *p, uint16_t opcode)
     start_row = p->V[y] % CHIP8_SCREEN_HEIGHT;
     start_col = p->V[x] % CHIP8_SCREEN_WIDTH;
     end_row = start_row + n < CHIP8_SCREEN_HEIGHT ?  start_row + n : CHIP8_SCREEN_HEIGHT;
-    end_col = start_col + 8 < CHIP8_SCREEN_WIDTH  ?  start_col + 8 : CHIP8_SCREEN_WIDTH;
     
+    /* Each display row is a 64 bit word with column 0 in the msb. Line the 8 
+       sprite pixels up with the row, any columns past the right edge are 
+       shifted out so the sprite is clipped rather than wrapped. */
     for(r=start_row, i=0; r<end_row; r++, i++)
     {
-        sprite_chunk = p->mem[p->I + i];
-        for(c=start_col, b=0; c<end_col; c++, b++)
+        sprite_row = ((uint64_t)p->mem[(p->I + i) & CHIP8_ADDRESS_MASK] << (CHIP8_SCREEN_WIDTH - 8)) >> start_col;
+        if (p->fbuff[r] & sprite_row)
         {
-            mask = 0x80 >> b;
-            sprite_bit = (sprite_chunk & mask) > 0 ? 1 : 0;
-            if (p->chip8_io->fbuff[c + r * CHIP8_SCREEN_WIDTH] && sprite_bit)
-            {
-                collision = 1;
-            }
-            p->chip8_io->fbuff[c + r * CHIP8_SCREEN_WIDTH] ^= sprite_bit;
+            collision = 1;
         }
+        PROFILE_SPRITE_ROW(p, sprite_row, p->fbuff[r]);
+        p->fbuff[r] ^= sprite_row;
     }
+    PROFILE_DRAW(p, collision);
     p->V[0xF] = collision;
-    p->chip8_io->update_display = 1;
+    p->chip8_io.update_display = 1;
 }
 
 
@@ -494,22 +536,24 @@ op_EZZZ(struct chip8 *p, uint16_t opcode)
        Checks the keyboard, and if the key corresponding to the value of Vx
        is currently in the up position, PC is increased by 2.  */
 
-    uint8_t x, subcode;
+    uint8_t x, key, subcode;
 
     x = (opcode & 0x0F00) >> 8;
     subcode = opcode & 0x00FF;
+    /* there are only 16 keys, don't read past the end of keypad_state */
+    key = p->V[x] & 0x0F;
 
     /* only two subcodes, no need for a table */
     if(subcode == 0x9E)
     {
-        if (p->chip8_io->keypad_state[p->V[x]] >= 1)
+        if (p->chip8_io.keypad_state[key] >= 1)
         {
             p->pc += 2;
         }
     }
     else if (subcode == 0xA1)
     {
-        if (p->chip8_io->keypad_state[p->V[x]] == 0)
+        if (p->chip8_io.keypad_state[key] == 0)
         {
             p->pc += 2;
         }
@@ -524,6 +568,11 @@ op_FZZZ(struct chip8 *p, uint16_t opcode)
     uint8_t subcode;
 
     subcode = opcode & 0x00FF;
+    if (subcode >= sizeof(op_FZZZ_table) / sizeof(op_FZZZ_table[0]))
+    {
+        op_illegal(p, opcode);
+        return;
+    }
     op_FZZZ_table[subcode](p, opcode);
 }
 
@@ -632,19 +681,20 @@ op_Fx33(struct chip8 *p, uint16_t opcode)
 
     x = (opcode & 0x0F00) >> 8;
     s = p->V[x];
-    p->mem[p->I + 0] = 0;
-    p->mem[p->I + 1] = 0;
+    invalidate_decoded(p, p->I, 3);
+    p->mem[(p->I + 0) & CHIP8_ADDRESS_MASK] = 0;
+    p->mem[(p->I + 1) & CHIP8_ADDRESS_MASK] = 0;
     while(s >= 100)
     {
-        p->mem[p->I + 0] ++;
+        p->mem[(p->I + 0) & CHIP8_ADDRESS_MASK] ++;
         s -= 100;
     }
     while(s >= 10)
     {
-        p->mem[p->I + 1] ++;
+        p->mem[(p->I + 1) & CHIP8_ADDRESS_MASK] ++;
         s -= 10;
     }
-    p->mem[p->I + 2] = s;
+    p->mem[(p->I + 2) & CHIP8_ADDRESS_MASK] = s;
 }
 
 void
@@ -664,9 +714,10 @@ op_Fx55(struct chip8 *p, uint16_t opcode)
     uint8_t x, n;
 
     x = (opcode & 0x0F00) >> 8;
+    invalidate_decoded(p, p->I, x + 1);
     for(n=0; n<x+1; n++, p->I++)
     {
-        p->mem[p->I] = p->V[n];
+        p->mem[p->I & CHIP8_ADDRESS_MASK] = p->V[n];
     }
 }
 
@@ -689,7 +740,7 @@ op_Fx65(struct chip8 *p, uint16_t opcode)
     x = (opcode & 0x0F00) >> 8;
     for(n=0; n<x+1; n++, p->I++)
     {
-        p->V[n] = p->mem[p->I];
+        p->V[n] = p->mem[p->I & CHIP8_ADDRESS_MASK];
     }
 }
 
@@ -698,7 +749,7 @@ fetch_opcode(struct chip8 *p)
 {
     uint16_t opcode;
     /* Opcode is  16 bit */
-    opcode = p->mem[p->pc] << 8 | p->mem[p->pc + 1];
+    opcode = p->mem[p->pc & CHIP8_ADDRESS_MASK] << 8 | p->mem[(p->pc + 1) & CHIP8_ADDRESS_MASK];
     /* increment the program counter  */
     p->pc += 2;
     return opcode;
@@ -714,3 +765,77 @@ void
        that is, this may not be returning an insstruction pointer */
     return opcode4_table[op4];
 }
+
+enum chip8_op
+classify_opcode(uint16_t opcode)
+{
+    /* Work out which instruction an opcode is, following the same rules as
+       the tables used by decode_opcode() */
+    uint8_t subcode;
+
+    switch ((opcode & 0xF000) >> 12)
+    {
+        case 0x0:
+            subcode = opcode & 0x00FF;
+            if (subcode == 0xE0)
+            {
+                return CHIP8_OP_00E0;
+            }
+            if (subcode == 0xEE)
+            {
+                return CHIP8_OP_00EE;
+            }
+            return CHIP8_OP_0nnn;
+        case 0x1: return CHIP8_OP_1nnn;
+        case 0x2: return CHIP8_OP_2nnn;
+        case 0x3: return CHIP8_OP_3xkk;
+        case 0x4: return CHIP8_OP_4xkk;
+        case 0x5: return CHIP8_OP_5xy0;
+        case 0x6: return CHIP8_OP_6xkk;
+        case 0x7: return CHIP8_OP_7xkk;
+        case 0x8:
+            switch (opcode & 0x000F)
+            {
+                case 0x0: return CHIP8_OP_8xy0;
+                case 0x1: return CHIP8_OP_8xy1;
+                case 0x2: return CHIP8_OP_8xy2;
+                case 0x3: return CHIP8_OP_8xy3;
+                case 0x4: return CHIP8_OP_8xy4;
+                case 0x5: return CHIP8_OP_8xy5;
+                case 0x6: return CHIP8_OP_8xy6;
+                case 0x7: return CHIP8_OP_8xy7;
+                case 0xE: return CHIP8_OP_8xyE;
+                default: return CHIP8_OP_ILLEGAL;
+            }
+        case 0x9: return CHIP8_OP_9xy0;
+        case 0xA: return CHIP8_OP_Annn;
+        case 0xB: return CHIP8_OP_Bnnn;
+        case 0xC: return CHIP8_OP_Cxkk;
+        case 0xD: return CHIP8_OP_Dxyn;
+        case 0xE:
+            subcode = opcode & 0x00FF;
+            if (subcode == 0x9E)
+            {
+                return CHIP8_OP_Ex9E;
+            }
+            if (subcode == 0xA1)
+            {
+                return CHIP8_OP_ExA1;
+            }
+            return CHIP8_OP_ILLEGAL;
+        default:
+            switch (opcode & 0x00FF)
+            {
+                case 0x07: return CHIP8_OP_Fx07;
+                case 0x0A: return CHIP8_OP_Fx0A;
+                case 0x15: return CHIP8_OP_Fx15;
+                case 0x18: return CHIP8_OP_Fx18;
+                case 0x1E: return CHIP8_OP_Fx1E;
+                case 0x29: return CHIP8_OP_Fx29;
+                case 0x33: return CHIP8_OP_Fx33;
+                case 0x55: return CHIP8_OP_Fx55;
+                case 0x65: return CHIP8_OP_Fx65;
+                default: return CHIP8_OP_ILLEGAL;
+            }
+    }
+}
@@ -0,0 +1,362 @@
+/* mmap and MAP_ANONYMOUS are not part of C90 */
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "chip8_priv.h"
+#include "instructions.h"
+
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/*
+The compiled blocks are System V x86-64 functions
+    uint32_t block(struct chip8 *p, uint32_t num_instructions)
+that run the first num_instructions of the block and return how many times
+they stepped the random number generator. The chip8 pointer is kept in rbx 
+and the count of instructions left to run in r12 for the whole block, all 
+of the chip8 registers are accessed as [rbx + offset]. rax, rcx, rdx, rsi 
+and rdi are scratch registers.
+*/
+
+/* a whole number of pages, the tests make it small to fill it up */
+#ifndef JIT_CODE_SIZE
+#define JIT_CODE_SIZE (1024 * 1024)
+#endif
+/* the most code a single instruction can compile to, with room to spare */
+#define JIT_MAX_INSTR_SIZE (72)
+#define JIT_MAX_BLOCK_SIZE (32 + JIT_MAX_INSTR_SIZE * CHIP8_MAX_BLOCK_LEN)
+
+#define V_OFFSET(r) ((uint32_t)(offsetof(struct chip8, V) + (r)))
+#define I_OFFSET ((uint32_t)offsetof(struct chip8, I))
+#define DT_OFFSET ((uint32_t)offsetof(struct chip8, delay_timer))
+#define ST_OFFSET ((uint32_t)offsetof(struct chip8, sound_timer))
+
+struct 
+chip8_jit
+{
+    uint8_t *   code;                       /* the executable buffer */
+    uint32_t    used;                       /* bytes of code used so far */
+    uint32_t    entry[CHIP8_NUM_DECODED];   /* code offset + 1 for each block, 0 if not compiled */
+};
+
+struct
+emitter
+{
+    uint8_t *   out;
+    uint32_t    n;
+};
+
+static void
+emit8(struct emitter *e, uint8_t b)
+{
+    e->out[e->n++] = b;
+}
+
+static void
+emit32(struct emitter *e, uint32_t v)
+{
+    emit8(e, (uint8_t)(v & 0xFF));
+    emit8(e, (uint8_t)((v >> 8) & 0xFF));
+    emit8(e, (uint8_t)((v >> 16) & 0xFF));
+    emit8(e, (uint8_t)((v >> 24) & 0xFF));
+}
+
+static void
+emit64(struct emitter *e, uint64_t v)
+{
+    emit32(e, (uint32_t)(v & 0xFFFFFFFF));
+    emit32(e, (uint32_t)(v >> 32));
+}
+
+static void
+emit_mem(struct emitter *e, uint8_t reg, uint32_t offset)
+{
+    /* ModRM for [rbx + disp32] with reg in the reg field */
+    emit8(e, (uint8_t)(0x83 | (reg << 3)));
+    emit32(e, offset);
+}
+
+static void
+emit_load_byte(struct emitter *e, uint8_t reg, uint32_t offset)
+{
+    /* movzx reg32, byte [rbx + offset] */
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit_mem(e, reg, offset);
+}
+
+static void
+emit_store_byte(struct emitter *e, uint8_t reg, uint32_t offset)
+{
+    /* mov byte [rbx + offset], reg8 (al, cl or dl) */
+    emit8(e, 0x88);
+    emit_mem(e, reg, offset);
+}
+
+static void
+emit_call(struct emitter *e, void (*fn)(struct chip8 *, uint16_t), uint32_t arg)
+{
+    /* fn(p, arg) */
+    uint64_t address;
+
+    memcpy(&address, &fn, sizeof(address));
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xDF);     /* mov rdi, rbx */
+    emit8(e, 0xBE); emit32(e, arg);                     /* mov esi, arg */
+    emit8(e, 0x48); emit8(e, 0xB8); emit64(e, address); /* mov rax, fn */
+    emit8(e, 0xFF); emit8(e, 0xD0);                     /* call rax */
+}
+
+#define EAX (0)
+#define ECX (1)
+#define EDX (2)
+
+static void
+step_prng(struct chip8 *p, uint16_t num_steps)
+{
+    /* one step per instruction, op_Cxkk() catches the generator up */
+    p->rnd_steps += num_steps;
+}
+
+static void
+emit_return(struct emitter *e, uint32_t num_steps)
+{
+    emit8(e, 0xB8); emit32(e, num_steps);               /* mov eax, num_steps */
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xC4); emit8(e, 0x08); /* add rsp, 8 */
+    emit8(e, 0x41); emit8(e, 0x5C);                     /* pop r12 */
+    emit8(e, 0x5B);                                     /* pop rbx */
+    emit8(e, 0xC3);                                     /* ret */
+}
+
+static void
+emit_instruction(struct emitter *e, const struct chip8_decoded *d)
+{
+    switch (d->op)
+    {
+        case CHIP8_OP_0nnn:
+            /* SYS addr, nothing to do */
+            break;
+        case CHIP8_OP_6xkk:
+            /* mov byte [Vx], kk */
+            emit8(e, 0xC6); emit_mem(e, 0, V_OFFSET(d->x)); emit8(e, d->kk);
+            break;
+        case CHIP8_OP_7xkk:
+            /* add byte [Vx], kk */
+            emit8(e, 0x80); emit_mem(e, 0, V_OFFSET(d->x)); emit8(e, d->kk);
+            break;
+        case CHIP8_OP_8xy0:
+            emit_load_byte(e, EAX, V_OFFSET(d->y));
+            emit_store_byte(e, EAX, V_OFFSET(d->x));
+            break;
+        case CHIP8_OP_8xy1:
+        case CHIP8_OP_8xy2:
+        case CHIP8_OP_8xy3:
+            /* VF is reset first, it may be one of the operands */
+            emit8(e, 0xC6); emit_mem(e, 0, V_OFFSET(0xF)); emit8(e, 0);
+            emit_load_byte(e, EAX, V_OFFSET(d->y));
+            /* or, and or xor byte [Vx], al */
+            emit8(e, d->op == CHIP8_OP_8xy1 ? 0x08 : d->op == CHIP8_OP_8xy2 ? 0x20 : 0x30);
+            emit_mem(e, EAX, V_OFFSET(d->x));
+            break;
+        case CHIP8_OP_8xy4:
+            emit_load_byte(e, EAX, V_OFFSET(d->x));
+            emit_load_byte(e, ECX, V_OFFSET(d->y));
+            emit8(e, 0x01); emit8(e, 0xC8);                 /* add eax, ecx */
+            emit_store_byte(e, EAX, V_OFFSET(d->x));
+            emit8(e, 0xC1); emit8(e, 0xE8); emit8(e, 8);    /* shr eax, 8 */
+            emit_store_byte(e, EAX, V_OFFSET(0xF));
+            break;
+        case CHIP8_OP_8xy5:
+        case CHIP8_OP_8xy7:
+            /* eax - ecx, with VF set if there was no borrow */
+            emit_load_byte(e, EAX, V_OFFSET(d->op == CHIP8_OP_8xy5 ? d->x : d->y));
+            emit_load_byte(e, ECX, V_OFFSET(d->op == CHIP8_OP_8xy5 ? d->y : d->x));
+            emit8(e, 0x31); emit8(e, 0xD2);                 /* xor edx, edx */
+            emit8(e, 0x39); emit8(e, 0xC8);                 /* cmp eax, ecx */
+            emit8(e, 0x0F); emit8(e, 0x93); emit8(e, 0xC2); /* setae dl */
+            emit8(e, 0x29); emit8(e, 0xC8);                 /* sub eax, ecx */
+            emit_store_byte(e, EAX, V_OFFSET(d->x));
+            emit_store_byte(e, EDX, V_OFFSET(0xF));
+            break;
+        case CHIP8_OP_8xy6:
+            emit_load_byte(e, EAX, V_OFFSET(d->y));
+            emit8(e, 0x89); emit8(e, 0xC2);                 /* mov edx, eax */
+            emit8(e, 0x83); emit8(e, 0xE2); emit8(e, 1);    /* and edx, 1 */
+            emit8(e, 0xD1); emit8(e, 0xE8);                 /* shr eax, 1 */
+            emit_store_byte(e, EAX, V_OFFSET(d->x));
+            emit_store_byte(e, EDX, V_OFFSET(0xF));
+            break;
+        case CHIP8_OP_8xyE:
+            emit_load_byte(e, EAX, V_OFFSET(d->y));
+            emit8(e, 0x89); emit8(e, 0xC2);                 /* mov edx, eax */
+            emit8(e, 0xC1); emit8(e, 0xEA); emit8(e, 7);    /* shr edx, 7 */
+            emit8(e, 0x01); emit8(e, 0xC0);                 /* add eax, eax */
+            emit_store_byte(e, EAX, V_OFFSET(d->x));
+            emit_store_byte(e, EDX, V_OFFSET(0xF));
+            break;
+        case CHIP8_OP_Annn:
+            /* mov word [I], nnn */
+            emit8(e, 0x66); emit8(e, 0xC7); emit_mem(e, 0, I_OFFSET);
+            emit8(e, (uint8_t)(d->nnn & 0xFF)); emit8(e, (uint8_t)(d->nnn >> 8));
+            break;
+        case CHIP8_OP_Fx07:
+            emit_load_byte(e, EAX, DT_OFFSET);
+            emit_store_byte(e, EAX, V_OFFSET(d->x));
+            break;
+        case CHIP8_OP_Fx15:
+            emit_load_byte(e, EAX, V_OFFSET(d->x));
+            emit_store_byte(e, EAX, DT_OFFSET);
+            break;
+        case CHIP8_OP_Fx18:
+            emit_load_byte(e, EAX, V_OFFSET(d->x));
+            emit_store_byte(e, EAX, ST_OFFSET);
+            break;
+        case CHIP8_OP_Fx1E:
+            /* add word [I], ax */
+            emit_load_byte(e, EAX, V_OFFSET(d->x));
+            emit8(e, 0x66); emit8(e, 0x01); emit_mem(e, EAX, I_OFFSET);
+            break;
+        case CHIP8_OP_Fx29:
+            /* I = FONT_START_ADDRESS + Vx * 5 */
+            emit_load_byte(e, EAX, V_OFFSET(d->x));
+            emit8(e, 0x8D); emit8(e, 0x04); emit8(e, 0x80); /* lea eax, [rax + rax * 4] */
+            emit8(e, 0x05); emit32(e, FONT_START_ADDRESS);  /* add eax, FONT_START_ADDRESS */
+            emit8(e, 0x66); emit8(e, 0x89); emit_mem(e, EAX, I_OFFSET);
+            break;
+        default:
+            /* anything else calls the instruction function */
+            emit_call(e, op_handler_table[d->op], d->opcode);
+            break;
+    }
+}
+
+static uint8_t *
+compile_block(struct chip8_jit *jit, struct chip8 *p, uint32_t index)
+{
+    struct emitter e;
+    uint32_t i, len, stepped;
+    const struct chip8_decoded *d;
+
+    if (jit->used + JIT_MAX_BLOCK_SIZE > JIT_CODE_SIZE)
+    {
+        /* out of space, start again from scratch */
+        memset(jit->entry, 0, sizeof(jit->entry));
+        jit->used = 0;
+    }
+    if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE) != 0)
+    {
+        return NULL;
+    }
+
+    e.out = jit->code + jit->used;
+    e.n = 0;
+    len = p->block_len[index];
+    d = &p->decoded[index];
+
+    emit8(&e, 0x53);                                    /* push rbx */
+    emit8(&e, 0x41); emit8(&e, 0x54);                   /* push r12 */
+    emit8(&e, 0x48); emit8(&e, 0x83); emit8(&e, 0xEC); emit8(&e, 0x08); /* sub rsp, 8 */
+    emit8(&e, 0x48); emit8(&e, 0x89); emit8(&e, 0xFB);  /* mov rbx, rdi */
+    emit8(&e, 0x41); emit8(&e, 0x89); emit8(&e, 0xF4);  /* mov r12d, esi */
+    for (i = 0, stepped = 0; i < len; i++, d++)
+    {
+        /* rnd_steps only needs to be up to date for Cxkk, the caller adds the rest
+           at the end */
+        if (d->op == CHIP8_OP_Cxkk)
+        {
+            emit_call(&e, step_prng, i + 1 - stepped);
+            stepped = i + 1;
+        }
+        emit_instruction(&e, d);
+        if (i < len - 1)
+        {
+            /* return early if that was the last instruction asked for */
+            emit8(&e, 0x41); emit8(&e, 0xFF); emit8(&e, 0xCC);  /* dec r12d */
+            emit8(&e, 0x75); emit8(&e, 13);                     /* jnz over the return */
+            emit_return(&e, stepped);
+        }
+    }
+    emit_return(&e, stepped);
+
+    if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC) != 0)
+    {
+        /* none of the code can be run now */
+        memset(jit->entry, 0, sizeof(jit->entry));
+        return NULL;
+    }
+    jit->entry[index] = jit->used + 1;
+    jit->used += e.n;
+    return e.out;
+}
+
+struct chip8_jit *
+initialise_jit(void)
+{
+    struct chip8_jit *jit;
+    void *code;
+
+    jit = calloc(1, sizeof(struct chip8_jit));
+    if (jit == NULL)
+    {
+        return NULL;
+    }
+    code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+    {
+        free(jit);
+        return NULL;
+    }
+    jit->code = code;
+    return jit;
+}
+
+int
+execute_jit_block(struct chip8 *p, uint16_t start_address, uint32_t num_instructions)
+{
+    struct chip8_jit *jit;
+    uint32_t index, stepped;
+    uint8_t *code;
+    uint32_t (*fn)(struct chip8 *, uint32_t);
+
+    jit = p->jit;
+    index = start_address >> 1;
+    if (jit->entry[index] != 0)
+    {
+        code = jit->code + jit->entry[index] - 1;
+    }
+    else
+    {
+        code = compile_block(jit, p, index);
+        if (code == NULL)
+        {
+            return 1;
+        }
+    }
+    /* ISO C has no way to convert a data pointer to a function pointer */
+    memcpy(&fn, &code, sizeof(fn));
+    stepped = fn(p, num_instructions);
+    step_prng(p, (uint16_t)(num_instructions - stepped));
+    return 0;
+}
+
+void
+invalidate_jit_block(struct chip8_jit *jit, uint32_t index)
+{
+    jit->entry[index] = 0;
+}
+
+void
+free_jit(struct chip8_jit *jit)
+{
+    if (jit != NULL)
+    {
+        munmap(jit->code, JIT_CODE_SIZE);
+        free(jit);
+    }
+}
@@ -0,0 +1,749 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_priv.h"
+#include "decode.h"
+#include "instructions.h"
+#include "prng.h"
+
+/*
+Many emulators running the same ROM in lockstep, one lane per emulator.
+The registers are held as one array per register indexed by lane, so while
+every lane's program counter (and the instruction there) agrees, the
+instruction is decoded once and executed for all lanes at once with SIMD.
+RAM, the stack, the display and the keypad stay in a struct chip8 per lane,
+and any instruction that uses those, or any cycle where the program
+counters disagree, runs lane by lane through the op_* functions instead.
+The results are exactly the same as running the lanes separately with
+execute_cycle_chip8().
+
+AVX2 is used when the compiler targets it (e.g. -mavx2 or -march=native),
+then SSE2, otherwise plain C one lane at a time.
+*/
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+typedef __m256i vec;
+#define LANES_PER_VEC8 (32)
+#define LANES_PER_VEC32 (8)
+#define VLOAD8(a) _mm256_loadu_si256((const __m256i *)(a))
+#define VSTORE8(a, v) _mm256_storeu_si256((__m256i *)(a), v)
+#define VLOAD32 VLOAD8
+#define VSTORE32 VSTORE8
+#define VSET8(b) _mm256_set1_epi8((char)(b))
+#define VSET32(w) _mm256_set1_epi32((int)(w))
+#define VZERO _mm256_setzero_si256()
+#define VADD8 _mm256_add_epi8
+#define VSUB8 _mm256_sub_epi8
+#define VSUBS8 _mm256_subs_epu8
+#define VCMPEQ8 _mm256_cmpeq_epi8
+#define VAND _mm256_and_si256
+#define VOR _mm256_or_si256
+#define VXOR _mm256_xor_si256
+#define VANDNOT _mm256_andnot_si256
+#define VSHR8(a, n) _mm256_and_si256(_mm256_srli_epi16(a, n), VSET8(0xFF >> (n)))
+#define VSHL1_8(a) _mm256_add_epi8(a, a)
+#define VSRL32 _mm256_srli_epi32
+#define VSUB32 _mm256_sub_epi32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+typedef __m128i vec;
+#define LANES_PER_VEC8 (16)
+#define LANES_PER_VEC32 (4)
+#define VLOAD8(a) _mm_loadu_si128((const __m128i *)(a))
+#define VSTORE8(a, v) _mm_storeu_si128((__m128i *)(a), v)
+#define VLOAD32 VLOAD8
+#define VSTORE32 VSTORE8
+#define VSET8(b) _mm_set1_epi8((char)(b))
+#define VSET32(w) _mm_set1_epi32((int)(w))
+#define VZERO _mm_setzero_si128()
+#define VADD8 _mm_add_epi8
+#define VSUB8 _mm_sub_epi8
+#define VSUBS8 _mm_subs_epu8
+#define VCMPEQ8 _mm_cmpeq_epi8
+#define VAND _mm_and_si128
+#define VOR _mm_or_si128
+#define VXOR _mm_xor_si128
+#define VANDNOT _mm_andnot_si128
+#define VSHR8(a, n) _mm_and_si128(_mm_srli_epi16(a, n), VSET8(0xFF >> (n)))
+#define VSHL1_8(a) _mm_add_epi8(a, a)
+#define VSRL32 _mm_srli_epi32
+#define VSUB32 _mm_sub_epi32
+#else
+/* one lane at a time, in the low bits of a uint32_t */
+typedef uint32_t vec;
+#define LANES_PER_VEC8 (1)
+#define LANES_PER_VEC32 (1)
+#define VLOAD8(a) ((vec) *(const uint8_t *)(a))
+#define VSTORE8(a, v) (*(uint8_t *)(a) = (uint8_t)(v))
+#define VLOAD32(a) (*(const uint32_t *)(a))
+#define VSTORE32(a, v) (*(uint32_t *)(a) = (v))
+#define VSET8(b) ((vec)(b))
+#define VSET32(w) ((vec)(w))
+#define VZERO ((vec)0)
+#define VADD8(a, b) (((a) + (b)) & 0xFF)
+#define VSUB8(a, b) (((a) - (b)) & 0xFF)
+#define VSUBS8(a, b) ((a) > (b) ? (a) - (b) : 0)
+#define VCMPEQ8(a, b) ((a) == (b) ? 0xFF : 0)
+#define VAND(a, b) ((a) & (b))
+#define VOR(a, b) ((a) | (b))
+#define VXOR(a, b) ((a) ^ (b))
+#define VANDNOT(a, b) (~(a) & (b))
+#define VSHR8(a, n) ((a) >> (n))
+#define VSHL1_8(a) (((a) << 1) & 0xFF)
+#define VSRL32(a, n) ((a) >> (n))
+#define VSUB32(a, b) ((a) - (b))
+#endif
+
+/* lane arrays are padded to a whole number of the widest vectors, the
+   padding lanes are computed along with the rest and never looked at */
+#define LANE_PADDING (32)
+
+struct chip8_lockstep
+{
+    uint32_t    num_lanes;
+    uint32_t    num_padded;
+    /* one array per register, indexed by lane */
+    uint8_t *   V[16];
+    uint16_t *  I;
+    uint16_t *  pc;
+    uint8_t *   sp;
+    uint8_t *   delay_timer;
+    uint8_t *   sound_timer;
+    uint32_t *  prng_buff;                  /* the random number is the low byte */
+    uint8_t *   skip;                       /* scratch for the skip instructions */
+    /* shared by every lane as they all run the same number of cycles */
+    uint32_t    clock_hz;
+    uint32_t    timer_acc;                  /* as in struct chip8 */
+    uint32_t    polynomial;
+    /* what we know about the lanes */
+    uint32_t    num_waiting;                /* lanes blocked on Fx0A */
+    char        same_pc;                    /* every lane's program counter is the same */
+    char        same_mem;                   /* every lane's RAM is the same */
+    char        display_flags_set;          /* some lane's update_display may be set */
+    /* everything else */
+    struct chip8 ** lanes;
+    uint8_t *   arena;                      /* the lanes, one after another from the first
+                                               cache line in it */
+};
+
+static void
+lane_to_chip8(struct chip8_lockstep *l, uint32_t lane)
+{
+    struct chip8 *p;
+    int r;
+
+    p = l->lanes[lane];
+    for (r = 0; r < 16; r++)
+    {
+        p->V[r] = l->V[r][lane];
+    }
+    p->I = l->I[lane];
+    p->pc = l->pc[lane];
+    p->sp = l->sp[lane];
+    p->delay_timer = l->delay_timer[lane];
+    p->sound_timer = l->sound_timer[lane];
+    p->rnd = (uint8_t) l->prng_buff[lane];
+}
+
+static void
+chip8_to_lane(struct chip8_lockstep *l, uint32_t lane)
+{
+    struct chip8 *p;
+    int r;
+
+    p = l->lanes[lane];
+    for (r = 0; r < 16; r++)
+    {
+        l->V[r][lane] = p->V[r];
+    }
+    l->I[lane] = p->I;
+    l->pc[lane] = p->pc;
+    l->sp[lane] = p->sp;
+    l->delay_timer[lane] = p->delay_timer;
+    l->sound_timer[lane] = p->sound_timer;
+}
+
+static void
+execute_lane(struct chip8_lockstep *l, uint32_t lane, struct chip8_decoded *d)
+{
+    /* run one instruction the same way as execute_cycle_chip8(), the program
+       counter has already been moved past it */
+    struct chip8 *p;
+
+    p = l->lanes[lane];
+    lane_to_chip8(l, lane);
+    op_handler_table[d->op](p, d->opcode);
+    chip8_to_lane(l, lane);
+    if (p->waiting_for_key)
+    {
+        l->num_waiting++;
+    }
+}
+
+static void
+step_lane(struct chip8_lockstep *l, uint32_t lane)
+{
+    /* a whole cycle for one lane, apart from the timers */
+    struct chip8 *p;
+    struct chip8_decoded *d, uncached;
+    uint32_t buff;
+    uint8_t n;
+
+    p = l->lanes[lane];
+    if (p->waiting_for_key)
+    {
+        for (n = 0; n < 16; n++)
+        {
+            if (p->chip8_io.keypad_state[n] == 1)
+            {
+                l->V[p->key_x][lane] = n;
+                p->waiting_for_key = 0;
+                l->num_waiting--;
+                break;
+            }
+        }
+        if (p->waiting_for_key)
+        {
+            return;
+        }
+    }
+
+    buff = l->prng_buff[lane];
+    l->prng_buff[lane] = (buff >> 1) ^ (buff & 1 ? l->polynomial : 0);
+
+    p->pc = l->pc[lane];
+    d = fetch_decoded(p);
+    if (d == NULL)
+    {
+        decode_instruction(fetch_opcode(p), &uncached);
+        d = &uncached;
+    }
+    l->pc[lane] = p->pc + (d == &uncached ? 0 : 2);
+    if (d->op == CHIP8_OP_Fx33 || d->op == CHIP8_OP_Fx55)
+    {
+        l->same_mem = 0;
+    }
+    execute_lane(l, lane, d);
+}
+
+static int
+find_same_pc(struct chip8_lockstep *l)
+{
+    uint32_t i;
+    uint16_t pc;
+
+    pc = l->pc[0];
+    for (i = 1; i < l->num_lanes; i++)
+    {
+        if (l->pc[i] != pc)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int
+same_opcode(struct chip8_lockstep *l, uint16_t pc)
+{
+    /* only needed once the lanes' RAM may have diverged */
+    uint32_t i;
+    const uint8_t *mem0;
+
+    mem0 = l->lanes[0]->mem;
+    for (i = 1; i < l->num_lanes; i++)
+    {
+        if (l->lanes[i]->mem[pc] != mem0[pc] || l->lanes[i]->mem[pc + 1] != mem0[pc + 1])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void
+check_same_mem(struct chip8_lockstep *l, uint16_t I, uint32_t num_bytes)
+{
+    /* Every lane has just written num_bytes to RAM, starting at I if the
+       lanes all had the same I. See whether they all wrote the same thing. */
+    uint32_t i;
+    const uint8_t *mem0;
+
+    for (i = 1; i < l->num_lanes; i++)
+    {
+        if (l->I[i] != l->I[0])
+        {
+            l->same_mem = 0;
+            return;
+        }
+    }
+    if (I + num_bytes > CHIP8_MEM_SIZE_BYTES)
+    {
+        l->same_mem = 0;
+        return;
+    }
+    mem0 = l->lanes[0]->mem;
+    for (i = 1; i < l->num_lanes; i++)
+    {
+        if (memcmp(&l->lanes[i]->mem[I], &mem0[I], num_bytes) != 0)
+        {
+            l->same_mem = 0;
+            return;
+        }
+    }
+}
+
+static int
+step_lockstep(struct chip8_lockstep *l)
+{
+    /* Execute one cycle on every lane together, returns 0 if the lanes can't
+       be run in lockstep this cycle (nothing has been done then) */
+    struct chip8 *p0;
+    struct chip8_decoded *d, op;
+    uint32_t i, n;
+    uint16_t pc, I0;
+    uint8_t *Vx, *Vy, *VF;
+    vec a, b, r;
+
+    if (l->num_waiting != 0 || !l->same_pc)
+    {
+        return 0;
+    }
+    pc = l->pc[0];
+    p0 = l->lanes[0];
+    p0->pc = pc;
+    d = fetch_decoded(p0);
+    if (d == NULL || (!l->same_mem && !same_opcode(l, pc)))
+    {
+        return 0;
+    }
+    /* lane 0 writing to RAM may throw its decoded copy away */
+    op = *d;
+    d = &op;
+
+    /* update the random number generators */
+    for (i = 0; i < l->num_padded; i += LANES_PER_VEC32)
+    {
+        a = VLOAD32(&l->prng_buff[i]);
+        b = VSUB32(VZERO, VAND(a, VSET32(1)));
+        VSTORE32(&l->prng_buff[i], VXOR(VSRL32(a, 1), VAND(b, VSET32(l->polynomial))));
+    }
+    for (i = 0; i < l->num_padded; i++)
+    {
+        l->pc[i] = pc + 2;
+    }
+
+    n = l->num_padded;
+    Vx = l->V[d->x];
+    Vy = l->V[d->y];
+    VF = l->V[0xF];
+    switch (d->op)
+    {
+        case CHIP8_OP_0nnn:
+            break;
+        case CHIP8_OP_1nnn:
+            for (i = 0; i < n; i++)
+            {
+                l->pc[i] = d->nnn;
+            }
+            break;
+        case CHIP8_OP_3xkk:
+        case CHIP8_OP_4xkk:
+        case CHIP8_OP_5xy0:
+        case CHIP8_OP_9xy0:
+            for (i = 0; i < n; i += LANES_PER_VEC8)
+            {
+                a = VLOAD8(&Vx[i]);
+                b = (d->op == CHIP8_OP_3xkk || d->op == CHIP8_OP_4xkk) ? VSET8(d->kk) : VLOAD8(&Vy[i]);
+                r = VCMPEQ8(a, b);
+                if (d->op == CHIP8_OP_3xkk || d->op == CHIP8_OP_5xy0)
+                {
+                    VSTORE8(&l->skip[i], VAND(r, VSET8(2)));
+                }
+                else
+                {
+                    VSTORE8(&l->skip[i], VANDNOT(r, VSET8(2)));
+                }
+            }
+            for (i = 0; i < n; i++)
+            {
+                l->pc[i] += l->skip[i];
+            }
+            l->same_pc = (char) find_same_pc(l);
+            break;
+        case CHIP8_OP_6xkk:
+            memset(Vx, d->kk, n);
+            break;
+        case CHIP8_OP_7xkk:
+            for (i = 0; i < n; i += LANES_PER_VEC8)
+            {
+                VSTORE8(&Vx[i], VADD8(VLOAD8(&Vx[i]), VSET8(d->kk)));
+            }
+            break;
+        case CHIP8_OP_8xy0:
+            memmove(Vx, Vy, n);
+            break;
+        case CHIP8_OP_8xy1:
+        case CHIP8_OP_8xy2:
+        case CHIP8_OP_8xy3:
+            for (i = 0; i < n; i += LANES_PER_VEC8)
+            {
+                VSTORE8(&VF[i], VZERO);
+                a = VLOAD8(&Vx[i]);
+                b = VLOAD8(&Vy[i]);
+                if (d->op == CHIP8_OP_8xy1)
+                {
+                    r = VOR(a, b);
+                }
+                else if (d->op == CHIP8_OP_8xy2)
+                {
+                    r = VAND(a, b);
+                }
+                else
+                {
+                    r = VXOR(a, b);
+                }
+                VSTORE8(&Vx[i], r);
+            }
+            break;
+        case CHIP8_OP_8xy4:
+            for (i = 0; i < n; i += LANES_PER_VEC8)
+            {
+                a = VLOAD8(&Vx[i]);
+                b = VLOAD8(&Vy[i]);
+                r = VADD8(a, b);
+                /* it carried if the sum wrapped round below Vx */
+                b = VANDNOT(VCMPEQ8(VSUBS8(a, r), VZERO), VSET8(1));
+                VSTORE8(&Vx[i], r);
+                VSTORE8(&VF[i], b);
+            }
+            break;
+        case CHIP8_OP_8xy5:
+        case CHIP8_OP_8xy7:
+            for (i = 0; i < n; i += LANES_PER_VEC8)
+            {
+                a = VLOAD8(&Vx[i]);
+                b = VLOAD8(&Vy[i]);
+                if (d->op == CHIP8_OP_8xy7)
+                {
+                    r = a;
+                    a = b;
+                    b = r;
+                }
+                /* not borrow is a >= b, when b - a saturates at 0 */
+                r = VAND(VCMPEQ8(VSUBS8(b, a), VZERO), VSET8(1));
+                VSTORE8(&Vx[i], VSUB8(a, b));
+                VSTORE8(&VF[i], r);
+            }
+            break;
+        case CHIP8_OP_8xy6:
+            for (i = 0; i < n; i += LANES_PER_VEC8)
+            {
+                b = VLOAD8(&Vy[i]);
+                VSTORE8(&Vx[i], VSHR8(b, 1));
+                VSTORE8(&VF[i], VAND(b, VSET8(1)));
+            }
+            break;
+        case CHIP8_OP_8xyE:
+            for (i = 0; i < n; i += LANES_PER_VEC8)
+            {
+                b = VLOAD8(&Vy[i]);
+                VSTORE8(&Vx[i], VSHL1_8(b));
+                VSTORE8(&VF[i], VSHR8(b, 7));
+            }
+            break;
+        case CHIP8_OP_Annn:
+            for (i = 0; i < n; i++)
+            {
+                l->I[i] = d->nnn;
+            }
+            break;
+        case CHIP8_OP_Cxkk:
+            for (i = 0; i < n; i++)
+            {
+                Vx[i] = d->kk & (uint8_t) l->prng_buff[i];
+            }
+            break;
+        case CHIP8_OP_Fx07:
+            memmove(Vx, l->delay_timer, n);
+            break;
+        case CHIP8_OP_Fx15:
+            memcpy(l->delay_timer, Vx, n);
+            break;
+        case CHIP8_OP_Fx18:
+            memcpy(l->sound_timer, Vx, n);
+            break;
+        case CHIP8_OP_Fx1E:
+            for (i = 0; i < n; i++)
+            {
+                l->I[i] = l->I[i] + Vx[i];
+            }
+            break;
+        case CHIP8_OP_Fx29:
+            for (i = 0; i < n; i++)
+            {
+                l->I[i] = FONT_START_ADDRESS + Vx[i] * 5;
+            }
+            break;
+        default:
+            /* everything that touches RAM, the stack, the display or the
+               keypad, or may jump somewhere different in each lane */
+            I0 = l->I[0];
+            for (i = 0; i < l->num_lanes; i++)
+            {
+                execute_lane(l, i, d);
+            }
+            l->display_flags_set = 1;
+            l->same_pc = (char) find_same_pc(l);
+            if (l->same_mem && d->op == CHIP8_OP_Fx33)
+            {
+                check_same_mem(l, I0, 3);
+            }
+            else if (l->same_mem && d->op == CHIP8_OP_Fx55)
+            {
+                check_same_mem(l, I0, d->x + 1u);
+            }
+            break;
+    }
+    return 1;
+}
+
+static void
+update_timers_lockstep(struct chip8_lockstep *l)
+{
+    uint32_t i;
+
+    l->timer_acc += 60;
+    if (l->timer_acc < l->clock_hz)
+    {
+        return;
+    }
+    l->timer_acc -= l->clock_hz;
+    for (i = 0; i < l->num_lanes; i++)
+    {
+        l->lanes[i]->chip8_io.buzzer_active = l->sound_timer[i] > 0;
+    }
+    for (i = 0; i < l->num_padded; i += LANES_PER_VEC8)
+    {
+        VSTORE8(&l->sound_timer[i], VSUBS8(VLOAD8(&l->sound_timer[i]), VSET8(1)));
+        VSTORE8(&l->delay_timer[i], VSUBS8(VLOAD8(&l->delay_timer[i]), VSET8(1)));
+    }
+}
+
+static uint32_t
+execute_lockstep(struct chip8_lockstep *l, uint32_t num_cycles)
+{
+    uint32_t c, i, in_lockstep;
+
+    in_lockstep = 0;
+    for (c = 0; c < num_cycles; c++)
+    {
+        if (l->display_flags_set)
+        {
+            for (i = 0; i < l->num_lanes; i++)
+            {
+                l->lanes[i]->chip8_io.update_display = 0;
+            }
+            l->display_flags_set = 0;
+        }
+        if (step_lockstep(l))
+        {
+            in_lockstep++;
+        }
+        else
+        {
+            for (i = 0; i < l->num_lanes; i++)
+            {
+                step_lane(l, i);
+            }
+            l->display_flags_set = 1;
+            l->same_pc = (char) find_same_pc(l);
+        }
+        update_timers_lockstep(l);
+    }
+    return in_lockstep;
+}
+
+struct chip8_lockstep *
+initialise_lockstep_chip8(uint32_t num_lanes, enum chip8_clock clock)
+{
+    struct chip8_lockstep *l;
+    uint8_t *lane_mem;
+    uint32_t i, buff;
+    int r;
+
+    if (num_lanes == 0 || clock < CHIP8_CLOCK_RATE_300Hz || clock > CHIP8_CLOCK_RATE_900Hz)
+    {
+        return NULL;
+    }
+    l = calloc(1, sizeof(struct chip8_lockstep));
+    if (l == NULL)
+    {
+        return NULL;
+    }
+    l->num_lanes = num_lanes;
+    l->num_padded = (num_lanes + LANE_PADDING - 1) / LANE_PADDING * LANE_PADDING;
+    l->lanes = calloc(num_lanes, sizeof(struct chip8 *));
+    l->arena = malloc(num_lanes * sizeof_chip8() + CHIP8_CACHE_LINE);
+    for (r = 0; r < 16; r++)
+    {
+        l->V[r] = calloc(l->num_padded, sizeof(uint8_t));
+    }
+    l->I = calloc(l->num_padded, sizeof(uint16_t));
+    l->pc = calloc(l->num_padded, sizeof(uint16_t));
+    l->sp = calloc(l->num_padded, sizeof(uint8_t));
+    l->delay_timer = calloc(l->num_padded, sizeof(uint8_t));
+    l->sound_timer = calloc(l->num_padded, sizeof(uint8_t));
+    l->prng_buff = calloc(l->num_padded, sizeof(uint32_t));
+    l->skip = calloc(l->num_padded, sizeof(uint8_t));
+    if (l->lanes == NULL || l->arena == NULL || l->I == NULL || l->pc == NULL || l->sp == NULL
+        || l->delay_timer == NULL || l->sound_timer == NULL
+        || l->prng_buff == NULL || l->skip == NULL)
+    {
+        free_lockstep_chip8(l);
+        return NULL;
+    }
+    for (r = 0; r < 16; r++)
+    {
+        if (l->V[r] == NULL)
+        {
+            free_lockstep_chip8(l);
+            return NULL;
+        }
+    }
+    lane_mem = l->arena + (CHIP8_CACHE_LINE - (size_t) l->arena % CHIP8_CACHE_LINE) % CHIP8_CACHE_LINE;
+    for (i = 0; i < num_lanes; i++)
+    {
+        l->lanes[i] = initialise_chip8_in_place(&lane_mem[i * sizeof_chip8()], clock);
+        if (l->lanes[i] == NULL)
+        {
+            free_lockstep_chip8(l);
+            return NULL;
+        }
+#ifdef CHIP8_ENABLE_PROFILE
+        /* the instructions done for every lane at once aren't counted, so
+           leave out the draws the lanes do themselves too */
+        l->lanes[i]->unprofiled = 1;
+#endif
+    }
+    /* every lane starts from a freshly initialised chip8 */
+    get_state_lfsr_prng(&l->lanes[0]->prng, &buff, &l->polynomial);
+    for (i = 0; i < l->num_padded; i++)
+    {
+        l->pc[i] = l->lanes[0]->pc;
+        l->prng_buff[i] = buff;
+    }
+    l->clock_hz = l->lanes[0]->clock_hz;
+    l->same_pc = 1;
+    l->same_mem = 1;
+    return l;
+}
+
+int
+load_rom_lockstep_chip8(struct chip8_lockstep *l, uint8_t *data, uint16_t num_bytes)
+{
+    uint32_t i;
+
+    if (l == NULL)
+    {
+        return 1;
+    }
+    for (i = 0; i < l->num_lanes; i++)
+    {
+        if (load_rom_chip8(l->lanes[i], data, num_bytes) != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+struct chip8_io *
+get_io_lockstep_chip8(struct chip8_lockstep *l, uint32_t lane)
+{
+    if (l == NULL || lane >= l->num_lanes)
+    {
+        return NULL;
+    }
+    return &l->lanes[lane]->chip8_io;
+}
+
+int
+set_prng_lockstep_chip8(struct chip8_lockstep *l, uint32_t lane, uint32_t seed)
+{
+    if (l == NULL || lane >= l->num_lanes)
+    {
+        return 1;
+    }
+    /* the lane's own generator is only brought up to date by 
+       get_lane_lockstep_chip8(), this is the one that runs */
+    set_prng_chip8(l->lanes[lane], seed, l->polynomial);
+    l->prng_buff[lane] = l->lanes[lane]->prng.buff;
+    return 0;
+}
+
+struct chip8 *
+get_lane_lockstep_chip8(struct chip8_lockstep *l, uint32_t lane)
+{
+    struct chip8 *p;
+
+    if (l == NULL || lane >= l->num_lanes)
+    {
+        return NULL;
+    }
+    p = l->lanes[lane];
+    lane_to_chip8(l, lane);
+    p->timer_acc = l->timer_acc;
+    set_state_lfsr_prng(&p->prng, l->prng_buff[lane], l->polynomial);
+    return p;
+}
+
+uint32_t
+execute_cycles_lockstep_chip8(struct chip8_lockstep *l, uint32_t num_cycles)
+{
+    if (l == NULL)
+    {
+        return 0;
+    }
+    return execute_lockstep(l, num_cycles);
+}
+
+void
+free_lockstep_chip8(struct chip8_lockstep *l)
+{
+    uint32_t i;
+    int r;
+
+    if (l == NULL)
+    {
+        return;
+    }
+    if (l->lanes != NULL)
+    {
+        for (i = 0; i < l->num_lanes; i++)
+        {
+            if (l->lanes[i] != NULL)
+            {
+                free_chip8(l->lanes[i]);
+            }
+        }
+    }
+    for (r = 0; r < 16; r++)
+    {
+        free(l->V[r]);
+    }
+    free(l->I);
+    free(l->pc);
+    free(l->sp);
+    free(l->delay_timer);
+    free(l->sound_timer);
+    free(l->prng_buff);
+    free(l->skip);
+    free(l->lanes);
+    free(l->arena);
+    free(l);
+}
@@ -0,0 +1,424 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_priv.h"
+
+/*
+Input movies: the keypad changes of a session, each stamped with the cycle it
+happened before, so the session can be replayed exactly. Keys can only change
+between calls to execute_cycles_movie_chip8(), which counts the cycles, so
+that is where the recorder looks for changes and the replayer makes them.
+
+A movie file is written as it goes and never rewritten:
+
+    "C8MV", a version byte, the state digest of the emulator at the start
+    then events, each the number of cycles since the last event (a LEB128
+    varint) followed by a code:
+        0x00 + key      the key is released (0)
+        0x10 + key      the key is pressed (1)
+        0x20 + key      the key is set to the value in the next byte
+        0x30            the clock is set to 60 Hz times the value in the next byte
+        0x31            the clock is set to the Hz in the next four bytes
+        0xFF            the end of the movie, followed by the state digest
+
+Multi-byte numbers are little endian. A movie that was never finished (e.g.
+the recorder crashed) replays up to its last event.
+*/
+
+#define MOVIE_VERSION (1)
+#define MOVIE_KEY_UP (0x00)
+#define MOVIE_KEY_DOWN (0x10)
+#define MOVIE_KEY_VALUE (0x20)
+#define MOVIE_CLOCK (0x30)
+#define MOVIE_CLOCK_HZ (0x31)
+#define MOVIE_END (0xFF)
+
+static const char movie_magic[4] = {'C', '8', 'M', 'V'};
+
+struct chip8_movie
+{
+    FILE *          file;
+    struct chip8 *  p;
+    int             replaying;
+    int             failed;                 /* a write failed or the file is bad */
+    int             done;                   /* the replay has reached the end */
+    int             finished;               /* the replay read the end of the movie */
+    uint64_t        cycle;                  /* cycles run since the start */
+    uint64_t        event_cycle;            /* the last event written, or the next to replay */
+    uint8_t         keypad[16];             /* the keypad as of the last event */
+    uint32_t        clock_hz;
+    /* the next event to replay */
+    uint8_t         code;
+    uint8_t         value;
+    uint32_t        hz;
+    uint64_t        end_digest;
+};
+
+static void
+write_bytes(struct chip8_movie *m, const uint8_t *bytes, size_t num_bytes)
+{
+    if (fwrite(bytes, 1, num_bytes, m->file) != num_bytes)
+    {
+        m->failed = 1;
+    }
+}
+
+static void
+write_u64(struct chip8_movie *m, uint64_t value)
+{
+    uint8_t bytes[8];
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        bytes[i] = (uint8_t) (value >> (8 * i));
+    }
+    write_bytes(m, bytes, 8);
+}
+
+static void
+write_u32(struct chip8_movie *m, uint32_t value)
+{
+    uint8_t bytes[4];
+
+    bytes[0] = (uint8_t) value;
+    bytes[1] = (uint8_t) (value >> 8);
+    bytes[2] = (uint8_t) (value >> 16);
+    bytes[3] = (uint8_t) (value >> 24);
+    write_bytes(m, bytes, 4);
+}
+
+static void
+write_event(struct chip8_movie *m, uint8_t code)
+{
+    /* the varint cycle delta then the code */
+    uint8_t bytes[11];
+    uint64_t delta;
+    size_t n = 0;
+
+    delta = m->cycle - m->event_cycle;
+    while (delta >= 0x80)
+    {
+        bytes[n++] = (uint8_t) (delta | 0x80);
+        delta >>= 7;
+    }
+    bytes[n++] = (uint8_t) delta;
+    bytes[n++] = code;
+    write_bytes(m, bytes, n);
+    m->event_cycle = m->cycle;
+}
+
+static void
+write_changes(struct chip8_movie *m)
+{
+    /* write an event for everything that changed since the last call */
+    const uint8_t *keypad;
+    uint8_t value;
+    int key;
+
+    keypad = m->p->chip8_io.keypad_state;
+    for (key = 0; key < 16; key++)
+    {
+        value = keypad[key];
+        if (value == m->keypad[key])
+        {
+            continue;
+        }
+        if (value <= 1)
+        {
+            write_event(m, (uint8_t) ((value ? MOVIE_KEY_DOWN : MOVIE_KEY_UP) + key));
+        }
+        else
+        {
+            write_event(m, (uint8_t) (MOVIE_KEY_VALUE + key));
+            write_bytes(m, &value, 1);
+        }
+        m->keypad[key] = value;
+    }
+    if (m->p->clock_hz != m->clock_hz)
+    {
+        m->clock_hz = m->p->clock_hz;
+        if (m->clock_hz % 60 == 0 && m->clock_hz / 60 <= 0xFF)
+        {
+            value = (uint8_t) (m->clock_hz / 60);
+            write_event(m, MOVIE_CLOCK);
+            write_bytes(m, &value, 1);
+        }
+        else
+        {
+            write_event(m, MOVIE_CLOCK_HZ);
+            write_u32(m, m->clock_hz);
+        }
+    }
+}
+
+static int
+read_u32(struct chip8_movie *m, uint32_t *value)
+{
+    uint8_t bytes[4];
+
+    if (fread(bytes, 1, 4, m->file) != 4)
+    {
+        return 1;
+    }
+    *value = (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8
+           | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+    return 0;
+}
+
+static int
+read_u64(struct chip8_movie *m, uint64_t *value)
+{
+    uint8_t bytes[8];
+    int i;
+
+    if (fread(bytes, 1, 8, m->file) != 8)
+    {
+        return 1;
+    }
+    *value = 0;
+    for (i = 0; i < 8; i++)
+    {
+        *value |= (uint64_t) bytes[i] << (8 * i);
+    }
+    return 0;
+}
+
+static void
+read_event(struct chip8_movie *m)
+{
+    /* read the next event to replay, at the end of the file the replay is
+       done once it reaches the last event */
+    uint64_t delta;
+    int c, shift;
+
+    delta = 0;
+    shift = 0;
+    do
+    {
+        c = fgetc(m->file);
+        if (c == EOF || shift > 63)
+        {
+            m->code = MOVIE_END;
+            return;
+        }
+        delta |= (uint64_t) (c & 0x7F) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    c = fgetc(m->file);
+    if (c == EOF)
+    {
+        m->code = MOVIE_END;
+        return;
+    }
+    m->event_cycle += delta;
+    m->code = (uint8_t) c;
+    if (m->code == MOVIE_END)
+    {
+        m->finished = read_u64(m, &m->end_digest) == 0;
+        return;
+    }
+    if ((m->code & 0xF0) == MOVIE_KEY_VALUE || m->code == MOVIE_CLOCK)
+    {
+        c = fgetc(m->file);
+        m->value = (uint8_t) c;
+        if (c == EOF)
+        {
+            m->code = MOVIE_END;
+            return;
+        }
+        m->hz = 60u * m->value;
+    }
+    else if (m->code == MOVIE_CLOCK_HZ && read_u32(m, &m->hz) != 0)
+    {
+        m->code = MOVIE_END;
+        return;
+    }
+    if (m->code > MOVIE_CLOCK_HZ)
+    {
+        /* not a movie this build can play */
+        m->failed = 1;
+        m->code = MOVIE_END;
+    }
+}
+
+static void
+replay_events(struct chip8_movie *m)
+{
+    /* make every change due before the next cycle */
+    uint8_t *keypad;
+
+    keypad = m->p->chip8_io.keypad_state;
+    while (m->code != MOVIE_END && m->event_cycle == m->cycle)
+    {
+        switch (m->code & 0xF0)
+        {
+            case MOVIE_KEY_UP:
+                keypad[m->code & 0x0F] = 0;
+                break;
+            case MOVIE_KEY_DOWN:
+                keypad[m->code & 0x0F] = 1;
+                break;
+            case MOVIE_KEY_VALUE:
+                keypad[m->code & 0x0F] = m->value;
+                break;
+            default:
+                if (change_clock_hz_chip8(m->p, m->hz) != 0)
+                {
+                    m->failed = 1;
+                }
+                break;
+        }
+        read_event(m);
+    }
+    if (m->code == MOVIE_END && m->event_cycle <= m->cycle)
+    {
+        m->done = 1;
+    }
+}
+
+struct chip8_movie *
+record_movie_chip8(struct chip8 *p, const char *path)
+{
+    struct chip8_movie *m;
+    uint8_t version = MOVIE_VERSION;
+
+    if (p == NULL || path == NULL)
+    {
+        return NULL;
+    }
+    m = calloc(1, sizeof(struct chip8_movie));
+    if (m == NULL)
+    {
+        return NULL;
+    }
+    m->file = fopen(path, "wb");
+    if (m->file == NULL)
+    {
+        free(m);
+        return NULL;
+    }
+    m->p = p;
+    m->clock_hz = p->clock_hz;
+    write_bytes(m, (const uint8_t *) movie_magic, 4);
+    write_bytes(m, &version, 1);
+    write_u64(m, get_state_digest_chip8(p));
+    /* the keypad starts with nothing pressed, record any keys that are down */
+    write_changes(m);
+    if (m->failed)
+    {
+        end_movie_chip8(m);
+        return NULL;
+    }
+    return m;
+}
+
+struct chip8_movie *
+replay_movie_chip8(struct chip8 *p, const char *path)
+{
+    struct chip8_movie *m;
+    char magic[4];
+    int version;
+    uint64_t digest;
+
+    if (p == NULL || path == NULL)
+    {
+        return NULL;
+    }
+    m = calloc(1, sizeof(struct chip8_movie));
+    if (m == NULL)
+    {
+        return NULL;
+    }
+    m->file = fopen(path, "rb");
+    if (m->file == NULL)
+    {
+        free(m);
+        return NULL;
+    }
+    m->p = p;
+    m->replaying = 1;
+    if (fread(magic, 1, 4, m->file) != 4 || memcmp(magic, movie_magic, 4) != 0
+        || (version = fgetc(m->file)) != MOVIE_VERSION
+        || read_u64(m, &digest) != 0 || digest != get_state_digest_chip8(p))
+    {
+        /* not a movie, or it was recorded from a different starting state */
+        fclose(m->file);
+        free(m);
+        return NULL;
+    }
+    memset(p->chip8_io.keypad_state, 0, sizeof(p->chip8_io.keypad_state));
+    read_event(m);
+    replay_events(m);
+    return m;
+}
+
+uint32_t
+execute_cycles_movie_chip8(struct chip8_movie *m, uint32_t num_cycles, unsigned int *exit_reason)
+{
+    uint32_t executed, n;
+    uint64_t budget;
+    unsigned int reason;
+
+    reason = CHIP8_EXIT_BUDGET;
+    executed = 0;
+    if (m != NULL && !m->replaying)
+    {
+        write_changes(m);
+        executed = execute_cycles_chip8(m->p, num_cycles, &reason);
+        m->cycle += executed;
+    }
+    else if (m != NULL)
+    {
+        /* run up to each change in turn */
+        while (executed < num_cycles && reason == CHIP8_EXIT_BUDGET && !m->done)
+        {
+            budget = m->event_cycle - m->cycle;
+            if (budget > num_cycles - executed)
+            {
+                budget = num_cycles - executed;
+            }
+            n = execute_cycles_chip8(m->p, (uint32_t) budget, &reason);
+            executed += n;
+            m->cycle += n;
+            replay_events(m);
+        }
+    }
+    if (exit_reason != NULL)
+    {
+        *exit_reason = reason;
+    }
+    return executed;
+}
+
+int
+end_movie_chip8(struct chip8_movie *m)
+{
+    int failed;
+
+    if (m == NULL)
+    {
+        return 1;
+    }
+    if (!m->replaying)
+    {
+        write_changes(m);
+        write_event(m, MOVIE_END);
+        write_u64(m, get_state_digest_chip8(m->p));
+        failed = m->failed;
+    }
+    else
+    {
+        failed = m->failed || !m->finished || m->cycle != m->event_cycle
+                 || get_state_digest_chip8(m->p) != m->end_digest;
+    }
+    if (fclose(m->file) != 0)
+    {
+        failed = 1;
+    }
+    free(m);
+    return failed;
+}
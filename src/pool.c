@@ -0,0 +1,253 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_priv.h"
+
+/*
+An instance pool: emulators placed one after another in slabs, handed out
+already initialised. A freshly initialised emulator is kept as an image, so
+resetting one is a single copy of that image rather than initialising it
+from scratch. Everything after the font in a fresh emulator is 0 (RAM, the
+decoded instructions), so only the image up to there is copied and the rest
+is cleared, which is much cheaper than copying all of it. The free emulators
+are kept on a stack, so the most recently released (and most likely still in
+cache) is handed out first.
+
+Emulators are numbered slab by slab. The free stack holds those numbers, and
+a flag per emulator records whether it is handed out, so releasing one that
+isn't (twice, or from somewhere else) is caught rather than corrupting the
+stack.
+*/
+
+struct chip8_pool
+{
+    uint32_t    slab_size;                  /* emulators per slab */
+    uint8_t *   image;                      /* a freshly initialised emulator */
+    size_t      image_bytes;                /* up to the last byte of image that isn't 0 */
+    uint8_t **  slabs;                      /* as allocated, not aligned */
+    uint32_t    num_slabs;
+    uint32_t *  free_list;                  /* room for every emulator in every slab */
+    uint32_t    num_free;
+    uint8_t *   out;                        /* per emulator, 1 if it is handed out */
+    uint32_t    in_use;
+    uint32_t    high_water;
+};
+
+static void
+reset_instance(struct chip8_pool *pool, struct chip8 *p)
+{
+    memcpy(p, pool->image, pool->image_bytes);
+    memset((uint8_t *) p + pool->image_bytes, 0, sizeof_chip8() - pool->image_bytes);
+    /* the only pointer in a fresh emulator is to its own RAM */
+    p->mem = p->own_mem;
+}
+
+static uint8_t *
+slab_start(uint8_t *slab)
+{
+    /* the first emulator starts on a cache line, sizeof_chip8() keeps the
+       rest there */
+    return slab + (CHIP8_CACHE_LINE - (size_t) slab % CHIP8_CACHE_LINE) % CHIP8_CACHE_LINE;
+}
+
+static struct chip8 *
+get_instance(struct chip8_pool *pool, uint32_t n)
+{
+    return (struct chip8 *) (slab_start(pool->slabs[n / pool->slab_size])
+                             + (n % pool->slab_size) * sizeof_chip8());
+}
+
+/* The number of the emulator at p, or the pool's capacity if p isn't one */
+static uint32_t
+find_instance(struct chip8_pool *pool, struct chip8 *p)
+{
+    size_t offset, size;
+    uint32_t i;
+
+    size = sizeof_chip8();
+    for (i = 0; i < pool->num_slabs; i++)
+    {
+        /* wraps round to something huge if p is before the slab */
+        offset = (size_t) p - (size_t) slab_start(pool->slabs[i]);
+        if (offset < pool->slab_size * size)
+        {
+            if (offset % size != 0)
+            {
+                break;
+            }
+            return i * pool->slab_size + (uint32_t) (offset / size);
+        }
+    }
+    return pool->num_slabs * pool->slab_size;
+}
+
+static int
+add_slab(struct chip8_pool *pool)
+{
+    uint8_t *slab, **slabs, *out;
+    uint32_t *free_list;
+    size_t size;
+    uint32_t i, n, capacity;
+
+    size = sizeof_chip8();
+    if ((uint64_t) (pool->num_slabs + 1) * pool->slab_size > UINT32_MAX
+        || pool->slab_size > ((size_t) -1 - CHIP8_CACHE_LINE) / size)
+    {
+        return 1;
+    }
+    capacity = (pool->num_slabs + 1) * pool->slab_size;
+    slabs = realloc(pool->slabs, (pool->num_slabs + 1) * sizeof(uint8_t *));
+    if (slabs == NULL)
+    {
+        return 1;
+    }
+    pool->slabs = slabs;
+    free_list = realloc(pool->free_list, capacity * sizeof(uint32_t));
+    if (free_list == NULL)
+    {
+        return 1;
+    }
+    pool->free_list = free_list;
+    out = realloc(pool->out, capacity * sizeof(uint8_t));
+    if (out == NULL)
+    {
+        return 1;
+    }
+    pool->out = out;
+    slab = malloc(pool->slab_size * size + CHIP8_CACHE_LINE);
+    if (slab == NULL)
+    {
+        return 1;
+    }
+    pool->slabs[pool->num_slabs++] = slab;
+    /* pushed last to first so they are handed out in address order */
+    for (i = pool->slab_size; i > 0; i--)
+    {
+        n = capacity - pool->slab_size + i - 1;
+        reset_instance(pool, get_instance(pool, n));
+        pool->out[n] = 0;
+        pool->free_list[pool->num_free++] = n;
+    }
+    return 0;
+}
+
+struct chip8_pool *
+initialise_pool_chip8(uint32_t slab_size, enum chip8_clock clock)
+{
+    struct chip8_pool *pool;
+
+    if (slab_size == 0)
+    {
+        return NULL;
+    }
+    pool = calloc(1, sizeof(struct chip8_pool));
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+    pool->slab_size = slab_size;
+    pool->image = malloc(sizeof_chip8());
+    if (pool->image == NULL || initialise_chip8_in_place(pool->image, clock) == NULL)
+    {
+        free_pool_chip8(pool);
+        return NULL;
+    }
+    pool->image_bytes = sizeof_chip8();
+    while (pool->image[pool->image_bytes - 1] == 0)
+    {
+        pool->image_bytes--;
+    }
+    if (add_slab(pool) != 0)
+    {
+        free_pool_chip8(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+struct chip8 *
+acquire_pool_chip8(struct chip8_pool *pool)
+{
+    uint32_t n;
+
+    if (pool == NULL || (pool->num_free == 0 && add_slab(pool) != 0))
+    {
+        return NULL;
+    }
+    n = pool->free_list[--pool->num_free];
+    pool->out[n] = 1;
+    pool->in_use++;
+    if (pool->in_use > pool->high_water)
+    {
+        pool->high_water = pool->in_use;
+    }
+    return get_instance(pool, n);
+}
+
+void
+release_pool_chip8(struct chip8_pool *pool, struct chip8 *p)
+{
+    uint32_t n;
+
+    if (pool == NULL || p == NULL || pool->in_use == 0)
+    {
+        return;
+    }
+    /* ignore anything that isn't one of ours, or is already back */
+    n = find_instance(pool, p);
+    if (n == pool->num_slabs * pool->slab_size || !pool->out[n])
+    {
+        return;
+    }
+    /* let go of anything the emulator allocated, the memory stays put */
+    free_chip8(p);
+    reset_instance(pool, p);
+    pool->out[n] = 0;
+    pool->free_list[pool->num_free++] = n;
+    pool->in_use--;
+}
+
+void
+get_stats_pool_chip8(struct chip8_pool *pool, struct chip8_pool_stats *stats)
+{
+    if (pool == NULL || stats == NULL)
+    {
+        return;
+    }
+    stats->in_use = pool->in_use;
+    stats->capacity = pool->num_slabs * pool->slab_size;
+    stats->high_water = pool->high_water;
+    stats->num_slabs = pool->num_slabs;
+}
+
+void
+free_pool_chip8(struct chip8_pool *pool)
+{
+    uint8_t *first;
+    size_t size;
+    uint32_t i, j;
+
+    if (pool == NULL)
+    {
+        return;
+    }
+    size = sizeof_chip8();
+    for (i = 0; i < pool->num_slabs; i++)
+    {
+        /* anything the emulators still out allocated */
+        first = slab_start(pool->slabs[i]);
+        for (j = 0; j < pool->slab_size; j++)
+        {
+            free_chip8((struct chip8 *) (first + j * size));
+        }
+        free(pool->slabs[i]);
+    }
+    free(pool->slabs);
+    free(pool->free_list);
+    free(pool->out);
+    free(pool->image);
+    free(pool);
+}
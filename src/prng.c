@@ -1,20 +1,77 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "prng.h"
 
 /*
 A simple 32 bit linear feedback shift register pseudo random number generator
 that outputs the least significant 8 bits only.
+
+Jumping ahead: with the bits of buff taken as the coefficients of a 
+polynomial over GF(2), highest bit lowest power, each step multiplies buff
+by x modulo x^32 + polynomial (bit reversed). So n steps are a 
+multiplication by x^n, which is built from x^(2^k) for each bit k of n. These
+powers are worked out once per polynomial.
 */
 
-struct 
-lfsr_prng
+#define DEFAULT_SEED (0x8FF00F00)
+#define DEFAULT_POLYNOMIAL (0x80200003)
+/* fewer steps than this are quicker taken one at a time */
+#define JUMP_MIN_BITS (6)
+
+/* x^(2^k) for DEFAULT_POLYNOMIAL */
+static const uint32_t default_jump[32] =
 {
-    uint32_t buff;
-    uint32_t polynomial;
+    0x40000000, 0x20000000, 0x08000000, 0x00800000,
+    0x00008000, 0x80200003, 0xC5279ED9, 0xA241C6C9,
+    0x6ABE638E, 0x92A58A73, 0x1C41C6FA, 0x93E72D8C,
+    0x097E4B44, 0x2508F126, 0x92DF03D6, 0x7B58C29E,
+    0xFE6722B7, 0x29663D9C, 0x6EA02629, 0xF210F382,
+    0x7551EF57, 0x92B4DA3A, 0x7E023217, 0xA9BD7B68,
+    0xFDC70916, 0xE5319BA5, 0xCFE312EE, 0xA272263C,
+    0x5832F15C, 0x7FFA31B1, 0xD0CFBFDC, 0x4401CE70
 };
 
+static uint32_t
+multiply(uint32_t a, uint32_t b, uint32_t polynomial)
+{
+    /* a times b modulo the polynomial, Horner's rule from b's highest power
+       (its lowest bit) down, multiplying by x is a step */
+    uint32_t result;
+    int i;
+
+    result = 0;
+    for (i = 0; i < 32; i++)
+    {
+        result = (result >> 1) ^ ((result & 1) ? polynomial : 0);
+        if ((b >> i) & 1)
+        {
+            result ^= a;
+        }
+    }
+    return result;
+}
+
+static void
+set_polynomial(struct lfsr_prng *p, uint32_t polynomial)
+{
+    int k;
+
+    p->polynomial = polynomial;
+    if (polynomial == DEFAULT_POLYNOMIAL)
+    {
+        memcpy(p->jump, default_jump, sizeof(default_jump));
+        return;
+    }
+    /* x, then keep squaring */
+    p->jump[0] = 0x40000000;
+    for (k = 1; k < 32; k++)
+    {
+        p->jump[k] = multiply(p->jump[k - 1], p->jump[k - 1], polynomial);
+    }
+}
+
 struct
 lfsr_prng *
 initialise_lfsr_prng(uint32_t seed, uint32_t polynomial)
@@ -25,25 +82,17 @@ initialise_lfsr_prng(uint32_t seed, uint32_t polynomial)
     {
         return NULL;
     }
-    if (seed == 0)
-    {
-        p->buff = 0x8FF00F00;
-    }
-    else
-    {
-        p->buff = seed;
-    }
-    if (polynomial == 0)
-    {
-        p->polynomial = 0x80200003;
-    }
-    else
-    {
-        p->polynomial = polynomial;
-    }
+    init_lfsr_prng(p, seed, polynomial);
     return p;
 }
 
+void
+init_lfsr_prng(struct lfsr_prng *p, uint32_t seed, uint32_t polynomial)
+{
+    p->buff = seed != 0 ? seed : DEFAULT_SEED;
+    set_polynomial(p, polynomial != 0 ? polynomial : DEFAULT_POLYNOMIAL);
+}
+
 uint8_t
 lfsr_prng_process(struct lfsr_prng * p)
 {
@@ -61,6 +110,51 @@ lfsr_prng_process(struct lfsr_prng * p)
     return (uint8_t) (p->buff & 0x000000FF);
 }
 
+uint8_t
+lfsr_prng_skip(struct lfsr_prng * p, uint32_t num_steps)
+{
+    uint32_t buff, polynomial;
+    int k;
+
+    if (p == NULL)
+    {
+        return 0;
+    }
+    buff = p->buff;
+    polynomial = p->polynomial;
+    for (; (num_steps & ((1u << JUMP_MIN_BITS) - 1)) != 0; num_steps--)
+    {
+        buff = (buff >> 1) ^ ((buff & 1) ? polynomial : 0);
+    }
+    for (k = JUMP_MIN_BITS; k < 32 && num_steps != 0; k++)
+    {
+        if ((num_steps >> k) & 1)
+        {
+            buff = multiply(buff, p->jump[k], polynomial);
+            num_steps ^= 1u << k;
+        }
+    }
+    p->buff = buff;
+    return (uint8_t) (buff & 0x000000FF);
+}
+
+void
+get_state_lfsr_prng(const struct lfsr_prng *p, uint32_t *buff, uint32_t *polynomial)
+{
+    *buff = p->buff;
+    *polynomial = p->polynomial;
+}
+
+void
+set_state_lfsr_prng(struct lfsr_prng *p, uint32_t buff, uint32_t polynomial)
+{
+    p->buff = buff;
+    if (polynomial != p->polynomial)
+    {
+        set_polynomial(p, polynomial);
+    }
+}
+
 void 
 free_lfsr_prng(struct lfsr_prng *p)
 {
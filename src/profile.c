@@ -0,0 +1,85 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_priv.h"
+#include "instructions.h"
+#include "decode.h"
+#include "core.h"
+
+/*
+Profiling counts, only kept when built with CHIP8_ENABLE_PROFILE. The counts
+are made by the PROFILE_* hooks in core.h, placed wherever an instruction is
+dispatched.
+*/
+
+#ifdef CHIP8_ENABLE_PROFILE
+/* the public array has to be big enough for every enum chip8_op */
+typedef char profile_num_ops_check[CHIP8_PROFILE_NUM_OPS == CHIP8_OP_COUNT ? 1 : -1];
+
+static uint32_t
+count_bits(uint64_t bits)
+{
+    uint32_t count;
+
+    for (count = 0; bits != 0; count++)
+    {
+        bits &= bits - 1;
+    }
+    return count;
+}
+
+void
+profile_idle_loop(struct chip8 *p, uint32_t start, uint32_t loop_len, uint32_t trips)
+{
+    struct chip8_decoded *d;
+    uint32_t i;
+
+    for (i = 0; i < loop_len; i++)
+    {
+        /* skip_idle_loop() only takes loops that are already decoded */
+        d = decoded_at(p, start + 2 * i);
+        p->profile.op_count[d->op] += trips;
+        p->profile.pc_count[(start + 2 * i) & CHIP8_ADDRESS_MASK] += trips;
+    }
+    p->profile.idle_cycles += (uint64_t) loop_len * trips;
+}
+
+void
+profile_sprite_row(struct chip8 *p, uint64_t sprite_row, uint64_t screen_row)
+{
+    p->profile.pixels_drawn += count_bits(sprite_row);
+    p->profile.pixels_erased += count_bits(sprite_row & screen_row);
+}
+#endif
+
+int
+get_profile_chip8(struct chip8 *p, struct chip8_profile *profile)
+{
+#ifdef CHIP8_ENABLE_PROFILE
+    if (p == NULL || profile == NULL)
+    {
+        return 1;
+    }
+    memcpy(profile, &p->profile, sizeof(struct chip8_profile));
+    return 0;
+#else
+    (void) p;
+    (void) profile;
+    return 1;
+#endif
+}
+
+void
+reset_profile_chip8(struct chip8 *p)
+{
+#ifdef CHIP8_ENABLE_PROFILE
+    if (p != NULL)
+    {
+        memset(&p->profile, 0, sizeof(struct chip8_profile));
+    }
+#else
+    (void) p;
+#endif
+}
@@ -0,0 +1,322 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+
+/*
+Rewind: a snapshot of the emulator every few frames, kept in a fixed size
+ring. Only the newest snapshot is kept whole, every older one is stored as
+the difference from the snapshot after it: the two saved states XORed
+together, with the runs of zeros (everything that didn't change) squeezed
+out. Going back n snapshots undoes the n newest differences in turn.
+
+A difference is a list of (zeros to skip, bytes to XOR, the bytes) with the
+counts as LEB128 varints. Runs of fewer than MIN_ZERO_RUN zeros are left in
+with the bytes, so a difference is never more than a few bytes larger than
+the state itself.
+
+In the ring each difference is stored with its length before and after it,
+so it can be walked back from the newest and forward from the oldest.
+*/
+
+#define MIN_ZERO_RUN (4)
+#define MAX_DELTA_OVERHEAD (16)
+
+struct chip8_rewind
+{
+    uint32_t    state_size;
+    uint32_t    interval;                   /* frames between snapshots */
+    uint32_t    frame;                      /* frames since the last snapshot */
+    uint8_t *   newest;                     /* the newest snapshot, whole */
+    uint8_t *   scratch;                    /* a state being saved or rewound */
+    uint8_t *   delta;                      /* a difference being built or read */
+    int         have_newest;
+    /* the ring of differences */
+    uint8_t *   ring;
+    uint32_t    ring_size;
+    uint32_t    head;                       /* where the next difference goes */
+    uint32_t    tail;                       /* the oldest difference */
+    uint32_t    used;
+    uint32_t    num_deltas;
+};
+
+static void
+ring_write(struct chip8_rewind *r, uint32_t pos, const uint8_t *data, uint32_t num_bytes)
+{
+    uint32_t first;
+
+    pos %= r->ring_size;
+    first = r->ring_size - pos < num_bytes ? r->ring_size - pos : num_bytes;
+    memcpy(&r->ring[pos], data, first);
+    memcpy(r->ring, data + first, num_bytes - first);
+}
+
+static void
+ring_read(struct chip8_rewind *r, uint32_t pos, uint8_t *data, uint32_t num_bytes)
+{
+    uint32_t first;
+
+    pos %= r->ring_size;
+    first = r->ring_size - pos < num_bytes ? r->ring_size - pos : num_bytes;
+    memcpy(data, &r->ring[pos], first);
+    memcpy(data + first, r->ring, num_bytes - first);
+}
+
+static uint32_t
+ring_read_length(struct chip8_rewind *r, uint32_t pos)
+{
+    uint8_t bytes[4];
+
+    ring_read(r, pos, bytes, 4);
+    return (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8
+         | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+}
+
+static void
+ring_write_length(struct chip8_rewind *r, uint32_t pos, uint32_t length)
+{
+    uint8_t bytes[4];
+
+    bytes[0] = (uint8_t) length;
+    bytes[1] = (uint8_t) (length >> 8);
+    bytes[2] = (uint8_t) (length >> 16);
+    bytes[3] = (uint8_t) (length >> 24);
+    ring_write(r, pos, bytes, 4);
+}
+
+static uint32_t
+put_varint(uint8_t *out, uint32_t value)
+{
+    uint32_t n = 0;
+
+    while (value >= 0x80)
+    {
+        out[n++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t) value;
+    return n;
+}
+
+static uint32_t
+get_varint(const uint8_t *in, uint32_t *value)
+{
+    uint32_t n = 0, shift = 0;
+
+    *value = 0;
+    do
+    {
+        *value |= (uint32_t) (in[n] & 0x7F) << shift;
+        shift += 7;
+    } while (in[n++] & 0x80);
+    return n;
+}
+
+static uint32_t
+encode_delta(const uint8_t *a, const uint8_t *b, uint32_t size, uint8_t *out)
+{
+    /* write the difference between a and b to out, returns its length */
+    uint32_t i, start, zeros, length, end, n;
+
+    n = 0;
+    i = 0;
+    while (i < size)
+    {
+        start = i;
+        while (i < size && a[i] == b[i])
+        {
+            i++;
+        }
+        if (i == size)
+        {
+            break;
+        }
+        zeros = i - start;
+        /* the run of bytes goes on until there are enough zeros in a row */
+        start = i;
+        end = i;
+        while (i < size && i - end < MIN_ZERO_RUN)
+        {
+            if (a[i] != b[i])
+            {
+                end = i + 1;
+            }
+            i++;
+        }
+        length = end - start;
+        i = end;
+        n += put_varint(&out[n], zeros);
+        n += put_varint(&out[n], length);
+        for (; start < end; start++)
+        {
+            out[n++] = a[start] ^ b[start];
+        }
+    }
+    return n;
+}
+
+static void
+apply_delta(uint8_t *state, const uint8_t *delta, uint32_t length)
+{
+    uint32_t pos, n, zeros, run;
+
+    pos = 0;
+    n = 0;
+    while (n < length)
+    {
+        n += get_varint(&delta[n], &zeros);
+        n += get_varint(&delta[n], &run);
+        pos += zeros;
+        for (; run > 0; run--)
+        {
+            state[pos++] ^= delta[n++];
+        }
+    }
+}
+
+static void
+drop_oldest(struct chip8_rewind *r)
+{
+    uint32_t length;
+
+    length = ring_read_length(r, r->tail);
+    r->tail = (r->tail + length + 8) % r->ring_size;
+    r->used -= length + 8;
+    r->num_deltas--;
+}
+
+struct chip8_rewind *
+initialise_rewind_chip8(uint32_t budget_bytes, uint32_t interval_frames)
+{
+    struct chip8_rewind *r;
+    uint32_t state_size, fixed;
+
+    state_size = state_size_chip8();
+    fixed = sizeof(struct chip8_rewind) + 3 * state_size + MAX_DELTA_OVERHEAD;
+    /* leave room in the ring for at least one whole difference */
+    if (interval_frames == 0 || budget_bytes < fixed + state_size + MAX_DELTA_OVERHEAD + 8)
+    {
+        return NULL;
+    }
+    r = calloc(1, sizeof(struct chip8_rewind));
+    if (r == NULL)
+    {
+        return NULL;
+    }
+    r->state_size = state_size;
+    r->interval = interval_frames;
+    r->ring_size = budget_bytes - fixed;
+    r->newest = malloc(state_size);
+    r->scratch = malloc(state_size);
+    r->delta = malloc(state_size + MAX_DELTA_OVERHEAD);
+    r->ring = malloc(r->ring_size);
+    if (r->newest == NULL || r->scratch == NULL || r->delta == NULL || r->ring == NULL)
+    {
+        free_rewind_chip8(r);
+        return NULL;
+    }
+    return r;
+}
+
+int
+record_rewind_chip8(struct chip8_rewind *r, struct chip8 *p)
+{
+    uint32_t length;
+    uint8_t *swap;
+
+    if (r == NULL || p == NULL)
+    {
+        return 1;
+    }
+    if (r->have_newest && ++r->frame < r->interval)
+    {
+        return 0;
+    }
+    r->frame = 0;
+    if (save_state_chip8(p, r->scratch) != 0)
+    {
+        return 1;
+    }
+    if (r->have_newest)
+    {
+        /* store how to get from the new snapshot back to the old one */
+        length = encode_delta(r->newest, r->scratch, r->state_size, r->delta);
+        while (r->num_deltas > 0 && r->ring_size - r->used < length + 8)
+        {
+            drop_oldest(r);
+        }
+        ring_write_length(r, r->head, length);
+        ring_write(r, r->head + 4, r->delta, length);
+        ring_write_length(r, r->head + 4 + length, length);
+        r->head = (r->head + length + 8) % r->ring_size;
+        r->used += length + 8;
+        r->num_deltas++;
+    }
+    swap = r->newest;
+    r->newest = r->scratch;
+    r->scratch = swap;
+    r->have_newest = 1;
+    return 0;
+}
+
+uint32_t
+num_snapshots_rewind_chip8(struct chip8_rewind *r)
+{
+    if (r == NULL || !r->have_newest)
+    {
+        return 0;
+    }
+    return r->num_deltas + 1;
+}
+
+int
+rewind_chip8(struct chip8_rewind *r, struct chip8 *p, uint32_t num_back)
+{
+    uint32_t i, length, pos, freed;
+    uint8_t *swap;
+
+    if (r == NULL || p == NULL || num_back >= num_snapshots_rewind_chip8(r))
+    {
+        return 1;
+    }
+    memcpy(r->scratch, r->newest, r->state_size);
+    pos = r->head;
+    freed = 0;
+    for (i = 0; i < num_back; i++)
+    {
+        length = ring_read_length(r, pos + r->ring_size - 4);
+        pos = (pos + r->ring_size - (length + 8)) % r->ring_size;
+        ring_read(r, pos + 4, r->delta, length);
+        apply_delta(r->scratch, r->delta, length);
+        freed += length + 8;
+    }
+    if (load_state_chip8(p, r->scratch) != 0)
+    {
+        return 1;
+    }
+    /* the snapshots after this one are gone */
+    r->head = pos;
+    r->used -= freed;
+    r->num_deltas -= num_back;
+    swap = r->newest;
+    r->newest = r->scratch;
+    r->scratch = swap;
+    r->frame = 0;
+    return 0;
+}
+
+void
+free_rewind_chip8(struct chip8_rewind *r)
+{
+    if (r == NULL)
+    {
+        return;
+    }
+    free(r->newest);
+    free(r->scratch);
+    free(r->delta);
+    free(r->ring);
+    free(r);
+}
@@ -0,0 +1,200 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_priv.h"
+#include "core.h"
+#include "atomics.h"
+
+/*
+The trace ring. head only moves when the emulator adds a record and tail
+only when the reader takes some, so neither needs a lock (see atomics.h).
+Each side keeps its own copy of the other's index and only reloads it when
+the ring looks full (or empty), and the two sides are kept on separate cache
+lines, so they don't fight over the same line on every record.
+*/
+
+#define MAX_CAPACITY (0x80000000u)
+
+static uint8_t written_register(uint16_t opcode);
+
+struct chip8_trace
+{
+    struct chip8_trace_record * records;    /* capacity of them, cache line aligned */
+    void *      allocation;                 /* records as allocated */
+    uint32_t    mask;                       /* capacity - 1 */
+    uint8_t     pad0[CHIP8_CACHE_LINE];
+    /* written by the emulator */
+    uint32_t    head;                       /* where the next record goes */
+    uint32_t    tail_seen;                  /* the emulator's copy of tail */
+    uint64_t    cycle;
+    uint64_t    dropped;
+    uint8_t     pad1[CHIP8_CACHE_LINE];
+    /* written by the reader */
+    uint32_t    tail;                       /* the next record to read */
+    uint32_t    head_seen;                  /* the reader's copy of head */
+};
+
+struct chip8_trace *
+initialise_trace_chip8(uint32_t capacity)
+{
+    struct chip8_trace *t;
+    uint32_t size;
+
+    if (capacity == 0 || capacity > MAX_CAPACITY)
+    {
+        return NULL;
+    }
+    for (size = 1; size < capacity; size <<= 1)
+    {
+    }
+    t = calloc(1, sizeof(struct chip8_trace));
+    if (t == NULL)
+    {
+        return NULL;
+    }
+    t->allocation = malloc((size_t) size * sizeof(struct chip8_trace_record) + CHIP8_CACHE_LINE);
+    if (t->allocation == NULL)
+    {
+        free(t);
+        return NULL;
+    }
+    t->records = (struct chip8_trace_record *) ((uint8_t *) t->allocation
+        + (CHIP8_CACHE_LINE - (size_t) t->allocation % CHIP8_CACHE_LINE) % CHIP8_CACHE_LINE);
+    t->mask = size - 1;
+    return t;
+}
+
+int
+attach_trace_chip8(struct chip8 *p, struct chip8_trace *t)
+{
+    if (p == NULL)
+    {
+        return 1;
+    }
+    if (t != NULL)
+    {
+        t->cycle = 0;
+    }
+    p->trace = t;
+    return 0;
+}
+
+void
+record_trace(struct chip8 *p, uint16_t pc, uint16_t opcode)
+{
+    struct chip8_trace *t;
+    struct chip8_trace_record *r;
+    uint32_t head;
+    uint8_t x;
+
+    t = p->trace;
+    head = t->head;
+    if (head - t->tail_seen > t->mask)
+    {
+        t->tail_seen = LOAD_ACQUIRE_U32(t->tail);
+        if (head - t->tail_seen > t->mask)
+        {
+            /* still full, the reader has fallen behind */
+            STORE_RELAXED_U64(t->dropped, t->dropped + 1);
+            t->cycle++;
+            return;
+        }
+    }
+    r = &t->records[head & t->mask];
+    r->cycle = t->cycle++;
+    r->pc = pc;
+    r->opcode = opcode;
+    r->I = p->I;
+    x = written_register(opcode);
+    r->reg = x;
+    r->value = x == CHIP8_TRACE_NO_REG ? 0 : p->V[x];
+    STORE_RELEASE_U32(t->head, head + 1);
+}
+
+void
+skip_trace(struct chip8 *p, uint32_t num_cycles)
+{
+    p->trace->cycle += num_cycles;
+}
+
+uint32_t
+read_trace_chip8(struct chip8_trace *t, struct chip8_trace_record *records, uint32_t max_records)
+{
+    uint32_t tail, n, first;
+
+    if (t == NULL || records == NULL)
+    {
+        return 0;
+    }
+    tail = t->tail;
+    if (t->head_seen == tail)
+    {
+        t->head_seen = LOAD_ACQUIRE_U32(t->head);
+    }
+    n = t->head_seen - tail;
+    if (n > max_records)
+    {
+        n = max_records;
+    }
+    if (n == 0)
+    {
+        return 0;
+    }
+    /* in up to two pieces, if the records wrap round the end of the ring */
+    first = t->mask + 1 - (tail & t->mask);
+    if (first > n)
+    {
+        first = n;
+    }
+    memcpy(records, &t->records[tail & t->mask], first * sizeof(struct chip8_trace_record));
+    memcpy(records + first, t->records, (n - first) * sizeof(struct chip8_trace_record));
+    STORE_RELEASE_U32(t->tail, tail + n);
+    return n;
+}
+
+uint64_t
+get_dropped_trace_chip8(struct chip8_trace *t)
+{
+    if (t == NULL)
+    {
+        return 0;
+    }
+    return LOAD_RELAXED_U64(t->dropped);
+}
+
+void
+free_trace_chip8(struct chip8_trace *t)
+{
+    if (t == NULL)
+    {
+        return;
+    }
+    free(t->allocation);
+    free(t);
+}
+
+static uint8_t
+written_register(uint16_t opcode)
+{
+    /* The register an instruction writes, or CHIP8_TRACE_NO_REG. Straight
+       from the opcode rather than classify_opcode(), as this runs for every
+       instruction traced. */
+    uint8_t x = (opcode >> 8) & 0xF;
+
+    switch (opcode >> 12)
+    {
+        case 0x6: case 0x7: case 0xC:
+            return x;
+        case 0x8:
+            return (opcode & 0xF) <= 0x7 || (opcode & 0xF) == 0xE ? x : CHIP8_TRACE_NO_REG;
+        case 0xD:
+            return 0xF;
+        case 0xF:
+            return (opcode & 0xFF) == 0x07 || (opcode & 0xFF) == 0x65 ? x : CHIP8_TRACE_NO_REG;
+        default:
+            return CHIP8_TRACE_NO_REG;
+    }
+}
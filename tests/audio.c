@@ -0,0 +1,353 @@
+/*
+Checks the buzzer audio in audio.c. A ROM beeps for random lengths with
+random gaps, rendering into a small ring that is read in odd sized pieces so
+it wraps round many times, at sample rates that are and aren't a whole
+number of samples per 60Hz clock. Clock n must have been given samples
+rate * (n - 1) / 60 up to rate * n / 60 (rounded down), all square wave or
+all silence as the buzzer was at that clock, and running in batches must
+give the same samples as single cycles. A ring that is never read must
+keep the oldest samples and count every one it dropped. Finally an emulator
+blocked on a key wait has the time skipped with skip_key_wait_chip8(),
+which renders the clocks with the sound timer running and the ones after it
+in two pieces, and that must give the same samples as stepping through.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "random_rom.h"
+
+#define SMALL_RING 1024
+#define LARGE_RING 65536
+#define NUM_CLOCKS 600
+#define CYCLES_PER_CLOCK 10                 /* at 600Hz */
+#define AMPLITUDE 1000
+#define MAX_SAMPLES (48000 / 60 * NUM_CLOCKS)
+
+/* a random beep (ST = rnd & 0xF) then a random wait on the delay timer,
+   over and over */
+static uint8_t beep_rom[] = {
+    0xC1, 0x0F, 0xF1, 0x18, 0xC2, 0x1F, 0xF2, 0x15, 0xF2, 0x07, 0x32, 0x00, 0x12, 0x08, 0x12, 0x00
+};
+/* set the sound and delay timers then wait for a key for ever */
+static uint8_t wait_rom[] = {
+    0x60, 0x00, 0xF0, 0x18, 0x61, 0x00, 0xF1, 0x15, 0xF2, 0x0A, 0x12, 0x0A
+};
+
+static const uint32_t sample_rates[] = { 44100, 48000, 22050, 11025, 8000, 44111 };
+
+struct ring
+{
+    void *              mem;
+    struct chip8_audio *audio;
+};
+
+static int check_beeps(uint32_t sample_rate, struct rng *r);
+static int check_dropped(void);
+static int check_key_wait(uint32_t sample_rate, uint8_t sound, uint32_t num_cycles, uint32_t capacity);
+
+int
+main(void)
+{
+    static const uint8_t sounds[] = { 0, 1, 7, 200 };
+    static const uint32_t waits[] = { 9, 10, 95, 537, 3001 };
+    struct rng r;
+    size_t i, j, k;
+    int failed = 0;
+
+    r.state = 1;
+    for (i = 0; i < sizeof(sample_rates) / sizeof(sample_rates[0]); i++)
+    {
+        failed |= check_beeps(sample_rates[i], &r);
+        for (j = 0; j < sizeof(sounds) / sizeof(sounds[0]); j++)
+        {
+            for (k = 0; k < sizeof(waits) / sizeof(waits[0]); k++)
+            {
+                failed |= check_key_wait(sample_rates[i], sounds[j], waits[k], LARGE_RING);
+                failed |= check_key_wait(sample_rates[i], sounds[j], waits[k], SMALL_RING);
+            }
+        }
+    }
+    failed |= check_dropped();
+    printf("%s\n", failed ? "FAILED" : "passed");
+    return failed;
+}
+
+static int
+open_ring(struct ring *ring, uint32_t capacity, uint32_t sample_rate)
+{
+    ring->mem = malloc(sizeof_audio_chip8(capacity));
+    ring->audio = ring->mem == NULL ? NULL : initialise_audio_chip8(ring->mem, capacity, sample_rate);
+    return ring->audio == NULL || set_tone_audio_chip8(ring->audio, 440, AMPLITUDE) != 0;
+}
+
+static struct chip8 *
+start(uint8_t *rom, uint16_t rom_bytes, struct ring *ring)
+{
+    struct chip8 *p;
+
+    p = initialise_chip8(CHIP8_CLOCK_RATE_600Hz);
+    if (p != NULL && (load_rom_chip8(p, rom, rom_bytes) != 0 || attach_audio_chip8(p, ring->audio) != 0))
+    {
+        free_chip8(p);
+        p = NULL;
+    }
+    return p;
+}
+
+static uint32_t
+drain(struct ring *ring, int16_t *samples, uint32_t num_samples, uint32_t max_samples, struct rng *r)
+{
+    /* read everything waiting on to the end of samples, in pieces of random
+       sizes when r is given */
+    uint32_t n;
+
+    do
+    {
+        n = r == NULL ? max_samples - num_samples : 1 + next_random(r, 300);
+        if (n > max_samples - num_samples)
+        {
+            n = max_samples - num_samples;
+        }
+        n = read_audio_chip8(ring->audio, samples + num_samples, n);
+        num_samples += n;
+    } while (n > 0);
+    return num_samples;
+}
+
+static int
+check_beeps(uint32_t sample_rate, struct rng *r)
+{
+    struct ring stepped_ring, batched_ring;
+    struct chip8 *stepped, *batched;
+    int16_t *samples, *batched_samples;
+    uint8_t on[NUM_CLOCKS];
+    uint32_t clock, cycle, n, start_sample, end_sample, i, num_samples, num_batched;
+    int failed = 0;
+
+    samples = malloc(MAX_SAMPLES * sizeof(int16_t));
+    batched_samples = malloc(MAX_SAMPLES * sizeof(int16_t));
+    stepped = batched = NULL;
+    stepped_ring.mem = batched_ring.mem = NULL;
+    if (samples == NULL || batched_samples == NULL || open_ring(&stepped_ring, SMALL_RING, sample_rate) != 0
+        || open_ring(&batched_ring, SMALL_RING, sample_rate) != 0
+        || (stepped = start(beep_rom, sizeof(beep_rom), &stepped_ring)) == NULL
+        || (batched = start(beep_rom, sizeof(beep_rom), &batched_ring)) == NULL)
+    {
+        fprintf(stderr, "%u Hz: could not set up\n", (unsigned int)sample_rate);
+        failed = 1;
+        goto done;
+    }
+
+    /* a clock at the end of every CYCLES_PER_CLOCK cycles, read after each */
+    num_samples = 0;
+    for (clock = 0; clock < NUM_CLOCKS; clock++)
+    {
+        for (cycle = 0; cycle < CYCLES_PER_CLOCK; cycle++)
+        {
+            execute_cycle_chip8(stepped);
+        }
+        on[clock] = get_io_chip8(stepped)->buzzer_active;
+        num_samples = drain(&stepped_ring, samples, num_samples, MAX_SAMPLES, r);
+    }
+    num_batched = 0;
+    for (cycle = 0; cycle < NUM_CLOCKS * CYCLES_PER_CLOCK; cycle += n)
+    {
+        n = execute_cycles_chip8(batched, NUM_CLOCKS * CYCLES_PER_CLOCK - cycle, NULL);
+        num_batched = drain(&batched_ring, batched_samples, num_batched, MAX_SAMPLES, r);
+    }
+
+    if (num_samples != (uint64_t)sample_rate * NUM_CLOCKS / 60 || get_dropped_audio_chip8(stepped_ring.audio) != 0)
+    {
+        fprintf(stderr, "%u Hz: %u samples for %u clocks\n", (unsigned int)sample_rate, (unsigned int)num_samples,
+                (unsigned int)NUM_CLOCKS);
+        failed = 1;
+        goto done;
+    }
+    for (clock = 0; clock < NUM_CLOCKS; clock++)
+    {
+        start_sample = (uint32_t)((uint64_t)sample_rate * clock / 60);
+        end_sample = (uint32_t)((uint64_t)sample_rate * (clock + 1) / 60);
+        /* a beep after silence starts at the top of the wave */
+        if (on[clock] && (clock == 0 || !on[clock - 1]) && samples[start_sample] != AMPLITUDE)
+        {
+            fprintf(stderr, "%u Hz: the beep at clock %u doesn't start at the top\n", (unsigned int)sample_rate,
+                    (unsigned int)clock);
+            failed = 1;
+        }
+        for (i = start_sample; i < end_sample; i++)
+        {
+            if (on[clock] ? samples[i] != AMPLITUDE && samples[i] != -AMPLITUDE : samples[i] != 0)
+            {
+                fprintf(stderr, "%u Hz: sample %u is %d but the buzzer is %s at clock %u\n",
+                        (unsigned int)sample_rate, (unsigned int)i, samples[i], on[clock] ? "on" : "off",
+                        (unsigned int)clock);
+                failed = 1;
+                break;
+            }
+        }
+    }
+    if (num_batched != num_samples || memcmp(batched_samples, samples, num_samples * sizeof(int16_t)) != 0)
+    {
+        fprintf(stderr, "%u Hz: batches rendered different samples\n", (unsigned int)sample_rate);
+        failed = 1;
+    }
+
+done:
+    if (stepped != NULL)
+    {
+        free_chip8(stepped);
+    }
+    if (batched != NULL)
+    {
+        free_chip8(batched);
+    }
+    free(stepped_ring.mem);
+    free(batched_ring.mem);
+    free(samples);
+    free(batched_samples);
+    return failed;
+}
+
+static int
+check_dropped(void)
+{
+    /* 800 samples a clock into a ring that is never read */
+    struct ring ring;
+    struct chip8 *p, *reference;
+    struct ring reference_ring;
+    int16_t *samples, *expected;
+    uint32_t cycle, num_samples;
+    int failed = 0;
+
+    samples = malloc(SMALL_RING * sizeof(int16_t));
+    expected = malloc(LARGE_RING * sizeof(int16_t));
+    p = reference = NULL;
+    ring.mem = reference_ring.mem = NULL;
+    if (samples == NULL || expected == NULL || open_ring(&ring, SMALL_RING, 48000) != 0
+        || open_ring(&reference_ring, LARGE_RING, 48000) != 0
+        || (p = start(beep_rom, sizeof(beep_rom), &ring)) == NULL
+        || (reference = start(beep_rom, sizeof(beep_rom), &reference_ring)) == NULL)
+    {
+        fprintf(stderr, "could not set up the ring to drop from\n");
+        failed = 1;
+        goto done;
+    }
+    for (cycle = 0; cycle < 5 * CYCLES_PER_CLOCK; cycle++)
+    {
+        execute_cycle_chip8(p);
+        execute_cycle_chip8(reference);
+    }
+    if (available_audio_chip8(ring.audio) != SMALL_RING || get_dropped_audio_chip8(ring.audio) != 5 * 800 - SMALL_RING)
+    {
+        fprintf(stderr, "%u samples kept and %u dropped, not %u and %u\n",
+                (unsigned int)available_audio_chip8(ring.audio), (unsigned int)get_dropped_audio_chip8(ring.audio),
+                (unsigned int)SMALL_RING, (unsigned int)(5 * 800 - SMALL_RING));
+        failed = 1;
+    }
+    /* the oldest are kept, and once there is room the newest come after them */
+    num_samples = drain(&ring, samples, 0, SMALL_RING, NULL);
+    drain(&reference_ring, expected, 0, LARGE_RING, NULL);
+    if (num_samples != SMALL_RING || memcmp(samples, expected, SMALL_RING * sizeof(int16_t)) != 0)
+    {
+        fprintf(stderr, "the ring didn't keep the oldest samples\n");
+        failed = 1;
+    }
+    for (cycle = 0; cycle < CYCLES_PER_CLOCK; cycle++)
+    {
+        execute_cycle_chip8(p);
+        execute_cycle_chip8(reference);
+    }
+    num_samples = drain(&ring, samples, 0, SMALL_RING, NULL);
+    drain(&reference_ring, expected, 0, LARGE_RING, NULL);
+    if (num_samples != 800 || memcmp(samples, expected, 800 * sizeof(int16_t)) != 0
+        || get_dropped_audio_chip8(ring.audio) != 5 * 800 - SMALL_RING)
+    {
+        fprintf(stderr, "the ring didn't carry on after dropping\n");
+        failed = 1;
+    }
+
+done:
+    if (p != NULL)
+    {
+        free_chip8(p);
+    }
+    if (reference != NULL)
+    {
+        free_chip8(reference);
+    }
+    free(ring.mem);
+    free(reference_ring.mem);
+    free(samples);
+    free(expected);
+    return failed;
+}
+
+static int
+check_key_wait(uint32_t sample_rate, uint8_t sound, uint32_t num_cycles, uint32_t capacity)
+{
+    struct ring skipped_ring, stepped_ring;
+    struct chip8 *skipped, *stepped;
+    int16_t *skipped_samples, *stepped_samples;
+    uint32_t cycle, num_skipped, num_stepped;
+    int failed = 0;
+
+    wait_rom[1] = sound;
+    wait_rom[5] = (uint8_t)(sound / 2);
+    skipped_samples = malloc(LARGE_RING * sizeof(int16_t));
+    stepped_samples = malloc(LARGE_RING * sizeof(int16_t));
+    skipped = stepped = NULL;
+    skipped_ring.mem = stepped_ring.mem = NULL;
+    if (skipped_samples == NULL || stepped_samples == NULL || open_ring(&skipped_ring, capacity, sample_rate) != 0
+        || open_ring(&stepped_ring, capacity, sample_rate) != 0
+        || (skipped = start(wait_rom, sizeof(wait_rom), &skipped_ring)) == NULL
+        || (stepped = start(wait_rom, sizeof(wait_rom), &stepped_ring)) == NULL)
+    {
+        fprintf(stderr, "%u Hz: could not set up the key wait\n", (unsigned int)sample_rate);
+        failed = 1;
+        goto done;
+    }
+    /* part way to the next clock once blocked */
+    for (cycle = 0; cycle < 7; cycle++)
+    {
+        execute_cycle_chip8(skipped);
+        execute_cycle_chip8(stepped);
+    }
+    if (!get_key_wait_chip8(skipped, NULL) || skip_key_wait_chip8(skipped, num_cycles, NULL) != num_cycles)
+    {
+        fprintf(stderr, "%u Hz: the key wait wasn't skipped\n", (unsigned int)sample_rate);
+        failed = 1;
+        goto done;
+    }
+    for (cycle = 0; cycle < num_cycles; cycle++)
+    {
+        execute_cycle_chip8(stepped);
+    }
+    num_skipped = drain(&skipped_ring, skipped_samples, 0, LARGE_RING, NULL);
+    num_stepped = drain(&stepped_ring, stepped_samples, 0, LARGE_RING, NULL);
+    if (num_skipped != num_stepped || memcmp(skipped_samples, stepped_samples, num_skipped * sizeof(int16_t)) != 0
+        || get_dropped_audio_chip8(skipped_ring.audio) != get_dropped_audio_chip8(stepped_ring.audio)
+        || get_state_digest_chip8(skipped) != get_state_digest_chip8(stepped))
+    {
+        fprintf(stderr, "%u Hz, %u samples: skipping %u cycles with the sound timer at %u went differently\n",
+                (unsigned int)sample_rate, (unsigned int)capacity, (unsigned int)num_cycles, (unsigned int)sound);
+        failed = 1;
+    }
+
+done:
+    if (skipped != NULL)
+    {
+        free_chip8(skipped);
+    }
+    if (stepped != NULL)
+    {
+        free_chip8(stepped);
+    }
+    free(skipped_ring.mem);
+    free(stepped_ring.mem);
+    free(skipped_samples);
+    free(stepped_samples);
+    return failed;
+}
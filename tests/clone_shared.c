@@ -0,0 +1,197 @@
+/*
+Checks the copy-on-write RAM of clone_shared_chip8(). Three clones share a
+page: a writer, an observer that has decoded (and translated into blocks)
+the program before sharing, and a bystander. The writer writes over the
+program with Fx33 or Fx55, or loads a ROM or a state. The observer's and
+bystander's RAM, decoded instructions and digests must be untouched, and
+the observer must then run on exactly like an emulator that never shared.
+The clones are freed in every order, so the page is let go of by each of
+them last.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_priv.h"
+
+#define NUM_RUN_ON 200
+
+enum write_kind
+{
+    WRITE_FX33,
+    WRITE_FX55,
+    WRITE_LOAD_ROM,
+    WRITE_LOAD_STATE,
+    NUM_WRITE_KINDS
+};
+
+static const char *write_names[NUM_WRITE_KINDS] = { "Fx33", "Fx55", "load_rom_chip8", "load_state_chip8" };
+
+/* I = 0x200, V0 = 0x12, then Fx33 or Fx55 over the start of the program,
+   then a loop of arithmetic */
+static uint8_t rom[] = {
+    0xA2, 0x00, 0x60, 0x12, 0xF0, 0x33, 0x71, 0x01, 0x82, 0x14, 0x12, 0x06
+};
+static uint8_t other_rom[] = { 0x63, 0x45, 0x12, 0x02 };
+
+static int run_case(enum write_kind kind, int free_order);
+
+int
+main(void)
+{
+    int kind, order, failed = 0;
+
+    for (kind = 0; kind < NUM_WRITE_KINDS; kind++)
+    {
+        for (order = 0; order < 6; order++)
+        {
+            failed |= run_case((enum write_kind)kind, order);
+        }
+    }
+    printf("%s\n", failed ? "FAILED" : "passed");
+    return failed;
+}
+
+static void
+run_cycles(struct chip8 *p, uint32_t num_cycles)
+{
+    uint32_t cycle;
+
+    for (cycle = 0; cycle < num_cycles; )
+    {
+        cycle += execute_cycles_chip8(p, num_cycles - cycle, NULL);
+    }
+}
+
+static struct chip8 *
+start(enum write_kind kind, enum chip8_exec_mode mode)
+{
+    /* a fresh emulator run up to the write */
+    struct chip8 *p;
+
+    rom[5] = kind == WRITE_FX55 ? 0x55 : 0x33;
+    p = initialise_chip8(CHIP8_CLOCK_RATE_600Hz);
+    if (p != NULL && load_rom_chip8(p, rom, sizeof(rom)) == 0 && set_exec_mode_chip8(p, mode) == 0)
+    {
+        run_cycles(p, 2);
+    }
+    return p;
+}
+
+static int
+run_case(enum write_kind kind, int free_order)
+{
+    static const int orders[6][3] = { { 0, 1, 2 }, { 0, 2, 1 }, { 1, 0, 2 }, { 1, 2, 0 }, { 2, 0, 1 }, { 2, 1, 0 } };
+    struct chip8 *clones[3], *writer, *observer, *bystander, *reference;
+    uint8_t *mem, *state;
+    struct chip8_decoded *decoded;
+    uint8_t block_len[CHIP8_NUM_DECODED];
+    uint64_t observer_digest, bystander_digest;
+    uint32_t i;
+    int failed = 0;
+
+    writer = start(kind, CHIP8_EXEC_INTERPRETER);
+    observer = start(kind, CHIP8_EXEC_BLOCKS);
+    bystander = start(kind, CHIP8_EXEC_INTERPRETER);
+    reference = start(kind, CHIP8_EXEC_INTERPRETER);
+    mem = malloc(CHIP8_MEM_SIZE_BYTES);
+    decoded = malloc(sizeof(observer->decoded));
+    state = malloc(state_size_chip8());
+    if (writer == NULL || observer == NULL || bystander == NULL || reference == NULL || mem == NULL
+        || decoded == NULL || state == NULL)
+    {
+        fprintf(stderr, "could not set up the emulators\n");
+        return 1;
+    }
+    /* the observer has translated the start of the program, which the
+       writer is about to write over */
+    if (observer->block_len[0x200 >> 1] == 0)
+    {
+        fprintf(stderr, "%s: the observer has no block to keep\n", write_names[kind]);
+        failed = 1;
+    }
+    if (clone_shared_chip8(observer, writer) != 0 || clone_shared_chip8(bystander, observer) != 0)
+    {
+        fprintf(stderr, "%s: could not share RAM\n", write_names[kind]);
+        failed = 1;
+    }
+    if (writer->mem != observer->mem || bystander->mem != observer->mem)
+    {
+        fprintf(stderr, "%s: the clones aren't sharing RAM\n", write_names[kind]);
+        failed = 1;
+    }
+    memcpy(mem, observer->mem, CHIP8_MEM_SIZE_BYTES);
+    memcpy(decoded, observer->decoded, sizeof(observer->decoded));
+    memcpy(block_len, observer->block_len, sizeof(block_len));
+    observer_digest = get_state_digest_chip8(observer);
+    bystander_digest = get_state_digest_chip8(bystander);
+
+    switch (kind)
+    {
+        case WRITE_FX33:
+        case WRITE_FX55:
+            execute_cycle_chip8(writer);
+            break;
+        case WRITE_LOAD_ROM:
+            load_rom_chip8(writer, other_rom, sizeof(other_rom));
+            break;
+        default:
+            load_rom_chip8(reference, other_rom, sizeof(other_rom));
+            save_state_chip8(reference, state);
+            load_state_chip8(writer, state);
+            load_rom_chip8(reference, rom, sizeof(rom));
+            break;
+    }
+    if (writer->mem == observer->mem || writer->mem[0x200] == mem[0x200])
+    {
+        fprintf(stderr, "%s: the writer didn't get RAM of its own\n", write_names[kind]);
+        failed = 1;
+    }
+    if (memcmp(observer->mem, mem, CHIP8_MEM_SIZE_BYTES) != 0 || bystander->mem != observer->mem
+        || memcmp(observer->decoded, decoded, sizeof(observer->decoded)) != 0
+        || memcmp(observer->block_len, block_len, sizeof(block_len)) != 0
+        || get_state_digest_chip8(observer) != observer_digest
+        || get_state_digest_chip8(bystander) != bystander_digest)
+    {
+        fprintf(stderr, "%s: the write reached the other clones\n", write_names[kind]);
+        failed = 1;
+    }
+
+    /* the observer carries on from the shared RAM like the reference, which
+       was in the same state */
+    run_cycles(observer, NUM_RUN_ON);
+    for (i = 0; i < NUM_RUN_ON; i++)
+    {
+        execute_cycle_chip8(reference);
+    }
+    if (get_state_digest_chip8(observer) != get_state_digest_chip8(reference))
+    {
+        fprintf(stderr, "%s: the observer ran differently after the write\n", write_names[kind]);
+        failed = 1;
+    }
+
+    /* the bystander's RAM must be intact until it is freed itself */
+    clones[0] = writer;
+    clones[1] = observer;
+    clones[2] = bystander;
+    for (i = 0; i < 3 && clones[orders[free_order][i]] != bystander; i++)
+    {
+        free_chip8(clones[orders[free_order][i]]);
+        if (get_state_digest_chip8(bystander) != bystander_digest)
+        {
+            fprintf(stderr, "%s: the bystander's RAM changed as the others were freed\n", write_names[kind]);
+            failed = 1;
+        }
+    }
+    for (; i < 3; i++)
+    {
+        free_chip8(clones[orders[free_order][i]]);
+    }
+    free_chip8(reference);
+    free(mem);
+    free(decoded);
+    free(state);
+    return failed;
+}
@@ -0,0 +1,118 @@
+/*
+Checks that the interpreter core the library was built with (and the blocks
+execution mode) gives exactly the same results as single stepping, which
+always goes through the table of op_* functions. The build compiles this
+against a library for every CHIP8_CORE.
+
+Built with CORE_TEST_JIT it checks the JIT modes instead, against a library
+with the JIT in it, and that CHIP8_EXEC_JIT_CHECKED never finds a compiled
+block that disagrees with the interpreter (it would fall back to
+CHIP8_EXEC_BLOCKS).
+
+Runs random ROMs (see random_rom.c) with keys pressed at random, comparing
+the state digests after every batch of cycles.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#ifdef CORE_TEST_JIT
+#include "chip8_priv.h"
+#endif
+#include "random_rom.h"
+
+#define NUM_ROMS 150
+#define NUM_BATCHES 400
+#define MAX_BATCH 300
+
+static int run_rom(uint32_t seed, enum chip8_clock clock, enum chip8_exec_mode mode);
+
+int
+main(void)
+{
+    static const enum chip8_clock clocks[] = { CHIP8_CLOCK_RATE_300Hz, CHIP8_CLOCK_RATE_600Hz,
+                                               CHIP8_CLOCK_RATE_900Hz };
+#ifdef CORE_TEST_JIT
+    static const enum chip8_exec_mode modes[] = { CHIP8_EXEC_JIT, CHIP8_EXEC_JIT_CHECKED };
+#else
+    static const enum chip8_exec_mode modes[] = { CHIP8_EXEC_INTERPRETER, CHIP8_EXEC_BLOCKS };
+#endif
+    uint32_t seed;
+    int failed = 0;
+    size_t c, m;
+
+    for (seed = 1; seed <= NUM_ROMS; seed++)
+    {
+        c = seed % (sizeof(clocks) / sizeof(clocks[0]));
+        for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+        {
+            failed |= run_rom(seed, clocks[c], modes[m]);
+        }
+    }
+    printf("%d ROMs %s\n", NUM_ROMS, failed ? "FAILED" : "passed");
+    return failed;
+}
+
+static int
+run_rom(uint32_t seed, enum chip8_clock clock, enum chip8_exec_mode mode)
+{
+    struct rng r;
+    uint8_t rom[MAX_ROM_SIZE];
+    uint16_t rom_bytes;
+    struct chip8 *batched, *stepped;
+    uint32_t batch, n, i, cycle = 0;
+    uint8_t key;
+    int failed = 0;
+
+    r.state = seed;
+    rom_bytes = build_random_rom(&r, rom);
+    batched = initialise_chip8(clock);
+    stepped = initialise_chip8(clock);
+    if (batched == NULL || stepped == NULL || load_rom_chip8(batched, rom, rom_bytes) != 0
+        || load_rom_chip8(stepped, rom, rom_bytes) != 0 || set_exec_mode_chip8(batched, mode) != 0)
+    {
+        fprintf(stderr, "seed %u: could not set up the emulators\n", (unsigned int)seed);
+        failed = 1;
+    }
+    for (batch = 0; batch < NUM_BATCHES && !failed; batch++)
+    {
+        if (next_random(&r, 8) == 0)
+        {
+            key = (uint8_t)next_random(&r, 16);
+            i = next_random(&r, 2);
+            set_key_chip8(batched, key, (int)i);
+            set_key_chip8(stepped, key, (int)i);
+        }
+        /* the batch may stop early on a draw, key wait or timer clock */
+        n = execute_cycles_chip8(batched, 1 + next_random(&r, MAX_BATCH), NULL);
+        for (i = 0; i < n; i++)
+        {
+            execute_cycle_chip8(stepped);
+        }
+        cycle += n;
+        if (get_state_digest_chip8(batched) != get_state_digest_chip8(stepped))
+        {
+            fprintf(stderr, "seed %u, clock %d, mode %d: the states differ after cycle %u\n",
+                    (unsigned int)seed, (int)clock, (int)mode, (unsigned int)cycle);
+            failed = 1;
+        }
+#ifdef CORE_TEST_JIT
+        if (batched->exec_mode != mode)
+        {
+            fprintf(stderr, "seed %u, clock %d, mode %d: fell back to mode %d after cycle %u\n",
+                    (unsigned int)seed, (int)clock, (int)mode, (int)batched->exec_mode, (unsigned int)cycle);
+            failed = 1;
+        }
+#endif
+    }
+    if (batched != NULL)
+    {
+        free_chip8(batched);
+    }
+    if (stepped != NULL)
+    {
+        free_chip8(stepped);
+    }
+    return failed;
+}
@@ -0,0 +1,126 @@
+/*
+Checks that lockstep lanes give exactly the same results as separate
+emulators calling execute_cycle_chip8(). The build compiles the library for
+this with AVX2, with SSE2 and with neither, so every way of running the lanes
+together is covered.
+
+Each lane has its own random number seed and keys pressed at random, so the
+lanes branch apart and come back together, and the random ROMs (see
+random_rom.c) overwrite their own code. The state digests of every lane are
+compared with its reference emulator after every cycle.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "random_rom.h"
+
+#define NUM_ROMS 4
+#define NUM_LANES 35                        /* not a whole number of vectors */
+#define NUM_CYCLES 1200
+
+static int run_rom(uint32_t seed, uint32_t *in_lockstep);
+
+int
+main(void)
+{
+    uint32_t seed, in_lockstep = 0;
+    int failed = 0;
+
+#if defined(LOCKSTEP_TEST_AVX2) && defined(__GNUC__)
+    if (!__builtin_cpu_supports("avx2"))
+    {
+        printf("no AVX2, skipped\n");
+        return 77;
+    }
+#endif
+    for (seed = 1; seed <= NUM_ROMS; seed++)
+    {
+        failed |= run_rom(seed, &in_lockstep);
+    }
+    /* the lanes must have spent some of the time together for this to test
+       anything */
+    if (in_lockstep < NUM_ROMS * NUM_CYCLES / 10)
+    {
+        fprintf(stderr, "only %u cycles ran in lockstep\n", (unsigned int)in_lockstep);
+        failed = 1;
+    }
+    printf("%d ROMs, %u of %d cycles in lockstep, %s\n", NUM_ROMS, (unsigned int)in_lockstep,
+           NUM_ROMS * NUM_CYCLES, failed ? "FAILED" : "passed");
+    return failed;
+}
+
+static int
+run_rom(uint32_t seed, uint32_t *in_lockstep)
+{
+    static const enum chip8_clock clocks[] = { CHIP8_CLOCK_RATE_300Hz, CHIP8_CLOCK_RATE_600Hz,
+                                               CHIP8_CLOCK_RATE_900Hz };
+    struct rng r;
+    uint8_t rom[MAX_ROM_SIZE];
+    uint16_t rom_bytes;
+    enum chip8_clock clock;
+    struct chip8_lockstep *l;
+    struct chip8 *ref[NUM_LANES];
+    uint32_t lane, cycle, prng_seed;
+    uint8_t key;
+    int pressed, failed = 0;
+
+    r.state = seed;
+    rom_bytes = build_random_rom(&r, rom);
+    clock = clocks[seed % (sizeof(clocks) / sizeof(clocks[0]))];
+    l = initialise_lockstep_chip8(NUM_LANES, clock);
+    if (l == NULL || load_rom_lockstep_chip8(l, rom, rom_bytes) != 0)
+    {
+        fprintf(stderr, "seed %u: could not set up the lanes\n", (unsigned int)seed);
+        free_lockstep_chip8(l);
+        return 1;
+    }
+    for (lane = 0; lane < NUM_LANES; lane++)
+    {
+        ref[lane] = initialise_chip8(clock);
+        /* some lanes keep the default seed so they only differ by keys */
+        prng_seed = next_random(&r, 3) == 0 ? 0 : 1 + next_random(&r, 0xFFFFFFFEu);
+        if (ref[lane] == NULL || load_rom_chip8(ref[lane], rom, rom_bytes) != 0
+            || set_prng_chip8(ref[lane], prng_seed, 0) != 0
+            || set_prng_lockstep_chip8(l, lane, prng_seed) != 0)
+        {
+            fprintf(stderr, "seed %u: could not set up lane %u\n", (unsigned int)seed, (unsigned int)lane);
+            failed = 1;
+        }
+    }
+    for (cycle = 0; cycle < NUM_CYCLES && !failed; cycle++)
+    {
+        for (lane = 0; lane < NUM_LANES; lane++)
+        {
+            if (next_random(&r, 400) == 0)
+            {
+                key = (uint8_t)next_random(&r, 16);
+                pressed = (int)next_random(&r, 2);
+                set_key_chip8(ref[lane], key, pressed);
+                get_io_lockstep_chip8(l, lane)->keypad_state[key] = (uint8_t)pressed;
+            }
+        }
+        *in_lockstep += execute_cycles_lockstep_chip8(l, 1);
+        for (lane = 0; lane < NUM_LANES; lane++)
+        {
+            execute_cycle_chip8(ref[lane]);
+            if (get_state_digest_chip8(get_lane_lockstep_chip8(l, lane)) != get_state_digest_chip8(ref[lane]))
+            {
+                fprintf(stderr, "seed %u, clock %d: lane %u differs after cycle %u\n", (unsigned int)seed,
+                        (int)clock, (unsigned int)lane, (unsigned int)cycle + 1);
+                failed = 1;
+                break;
+            }
+        }
+    }
+    for (lane = 0; lane < NUM_LANES; lane++)
+    {
+        if (ref[lane] != NULL)
+        {
+            free_chip8(ref[lane]);
+        }
+    }
+    free_lockstep_chip8(l);
+    return failed;
+}
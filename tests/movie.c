@@ -0,0 +1,278 @@
+/*
+Checks movie.c: random ROMs (see random_rom.c) are recorded running in
+batches of random sizes with scripted changes to the keypad (pressed,
+released and other values) and the clock rate in between. Each movie is
+replayed into a fresh emulator in batches of other sizes, which must end in
+the recorded state with end_movie_chip8() returning 0. Then the movie is
+truncated at many points and has its header, an event and the final digest
+corrupted, and every one of these must be refused by replay_movie_chip8()
+or fail in end_movie_chip8().
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "chip8_priv.h"
+#include "random_rom.h"
+
+#define NUM_ROMS 12
+#define NUM_BATCHES 400
+#define MAX_BATCH 300
+#define MAX_MOVIE_SIZE 65536
+#define NUM_TRUNCATIONS 40
+#define MOVIE_PATH "movie_test.c8mv"
+#define BAD_MOVIE_PATH "movie_test_bad.c8mv"
+
+static int run_rom(uint32_t seed);
+
+int
+main(void)
+{
+    uint32_t seed;
+    int failed = 0;
+
+    for (seed = 1; seed <= NUM_ROMS; seed++)
+    {
+        failed |= run_rom(seed);
+    }
+    remove(MOVIE_PATH);
+    remove(BAD_MOVIE_PATH);
+    printf("%d ROMs %s\n", NUM_ROMS, failed ? "FAILED" : "passed");
+    return failed;
+}
+
+static struct chip8 *
+start(const uint8_t *rom, uint16_t rom_bytes)
+{
+    struct chip8 *p;
+
+    p = initialise_chip8(CHIP8_CLOCK_RATE_600Hz);
+    if (p != NULL && load_rom_chip8(p, (uint8_t *)rom, rom_bytes) != 0)
+    {
+        free_chip8(p);
+        p = NULL;
+    }
+    return p;
+}
+
+static int
+replay(const uint8_t *rom, uint16_t rom_bytes, const char *path, struct rng *r, uint64_t *digest)
+{
+    /* replay a movie to its end, returns what end_movie_chip8() does or -1 if
+       it wouldn't start */
+    struct chip8 *p;
+    struct chip8_movie *m;
+    int result;
+
+    p = start(rom, rom_bytes);
+    if (p == NULL)
+    {
+        return -1;
+    }
+    m = replay_movie_chip8(p, path);
+    if (m == NULL)
+    {
+        free_chip8(p);
+        return -1;
+    }
+    while (execute_cycles_movie_chip8(m, 1 + next_random(r, 2 * MAX_BATCH), NULL) > 0)
+    {
+    }
+    result = end_movie_chip8(m);
+    if (digest != NULL)
+    {
+        *digest = get_state_digest_chip8(p);
+    }
+    free_chip8(p);
+    return result;
+}
+
+static int
+write_movie(const char *path, const uint8_t *movie, long num_bytes)
+{
+    FILE *f;
+    int failed;
+
+    f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        return 1;
+    }
+    failed = fwrite(movie, 1, (size_t)num_bytes, f) != (size_t)num_bytes;
+    return fclose(f) != 0 || failed;
+}
+
+static int
+check_rejected(const uint8_t *rom, uint16_t rom_bytes, const uint8_t *movie, long num_bytes, struct rng *r,
+               uint32_t seed, const char *what)
+{
+    if (write_movie(BAD_MOVIE_PATH, movie, num_bytes) != 0)
+    {
+        fprintf(stderr, "seed %u: could not write %s\n", (unsigned int)seed, BAD_MOVIE_PATH);
+        return 1;
+    }
+    if (replay(rom, rom_bytes, BAD_MOVIE_PATH, r, NULL) == 0)
+    {
+        fprintf(stderr, "seed %u: a movie with %s replayed\n", (unsigned int)seed, what);
+        return 1;
+    }
+    return 0;
+}
+
+static int
+check_bad_movies(const uint8_t *rom, uint16_t rom_bytes, uint8_t *movie, long num_bytes, long last_event,
+                 struct rng *r, uint32_t seed)
+{
+    char what[64];
+    long length;
+    int i, failed = 0;
+    uint8_t saved;
+
+    /* cut off anywhere, including in the header and the final digest */
+    for (i = 0; i < NUM_TRUNCATIONS; i++)
+    {
+        length = i < 16 ? num_bytes - 1 - i : (long)next_random(r, (uint32_t)num_bytes);
+        sprintf(what, "only %ld of %ld bytes", length, num_bytes);
+        failed |= check_rejected(rom, rom_bytes, movie, length, r, seed, what);
+    }
+
+    /* the magic, the version, the starting digest, an event the replay
+       doesn't know and the final digest */
+    movie[0] ^= 0x01;
+    failed |= check_rejected(rom, rom_bytes, movie, num_bytes, r, seed, "the wrong magic");
+    movie[0] ^= 0x01;
+    movie[4]++;
+    failed |= check_rejected(rom, rom_bytes, movie, num_bytes, r, seed, "the wrong version");
+    movie[4]--;
+    movie[5 + next_random(r, 8)] ^= 0x40;
+    failed |= check_rejected(rom, rom_bytes, movie, num_bytes, r, seed, "the wrong starting digest");
+    movie[5 + next_random(r, 8)] ^= 0x40;
+    saved = movie[last_event];
+    movie[last_event] = 0x40;
+    failed |= check_rejected(rom, rom_bytes, movie, num_bytes, r, seed, "an unknown event");
+    movie[last_event] = saved;
+    movie[num_bytes - 1 - next_random(r, 8)] ^= 0x01;
+    failed |= check_rejected(rom, rom_bytes, movie, num_bytes, r, seed, "the wrong final digest");
+    return failed;
+}
+
+static void
+change_inputs(struct chip8 *p, struct rng *r)
+{
+    static const uint32_t clocks[] = { 600, 540, 1200, 61, 44100 };
+    uint8_t key;
+
+    if (next_random(r, 3) == 0)
+    {
+        key = (uint8_t)next_random(r, 16);
+        if (next_random(r, 6) == 0)
+        {
+            /* anything but 0 counts as pressed, but it is replayed as it was */
+            p->chip8_io.keypad_state[key] = (uint8_t)(2 + next_random(r, 254));
+        }
+        else
+        {
+            set_key_chip8(p, key, (int)next_random(r, 2));
+        }
+    }
+    if (next_random(r, 40) == 0)
+    {
+        change_clock_hz_chip8(p, clocks[next_random(r, sizeof(clocks) / sizeof(clocks[0]))]);
+    }
+}
+
+static int
+run_rom(uint32_t seed)
+{
+    struct rng r;
+    uint8_t rom[MAX_ROM_SIZE], *movie;
+    uint16_t rom_bytes;
+    struct chip8 *p, *other;
+    struct chip8_movie *m;
+    uint64_t recorded, replayed;
+    uint32_t batch;
+    long num_bytes, last_event;
+    FILE *f;
+    int failed = 0;
+
+    r.state = seed;
+    rom_bytes = build_random_rom(&r, rom);
+    p = start(rom, rom_bytes);
+    movie = malloc(MAX_MOVIE_SIZE);
+    if (p == NULL || movie == NULL)
+    {
+        fprintf(stderr, "seed %u: could not set up the emulator\n", (unsigned int)seed);
+        failed = 1;
+        goto done;
+    }
+    /* a key already down when the recording starts is recorded too */
+    set_key_chip8(p, (uint8_t)next_random(&r, 16), 1);
+    m = record_movie_chip8(p, MOVIE_PATH);
+    if (m == NULL)
+    {
+        fprintf(stderr, "seed %u: could not record %s\n", (unsigned int)seed, MOVIE_PATH);
+        failed = 1;
+        goto done;
+    }
+    for (batch = 0; batch < NUM_BATCHES; batch++)
+    {
+        change_inputs(p, &r);
+        execute_cycles_movie_chip8(m, 1 + next_random(&r, MAX_BATCH), NULL);
+    }
+    change_inputs(p, &r);
+    recorded = get_state_digest_chip8(p);
+    if (end_movie_chip8(m) != 0)
+    {
+        fprintf(stderr, "seed %u: the recording failed\n", (unsigned int)seed);
+        failed = 1;
+        goto done;
+    }
+
+    /* a replay into a fresh emulator, which has to set the key that was
+       down at the start */
+    if (replay(rom, rom_bytes, MOVIE_PATH, &r, &replayed) != 0 || replayed != recorded)
+    {
+        fprintf(stderr, "seed %u: the replay didn't end in the recorded state\n", (unsigned int)seed);
+        failed = 1;
+    }
+
+    /* not from the state the recording started from */
+    other = start(rom, rom_bytes);
+    if (other != NULL)
+    {
+        execute_cycle_chip8(other);
+        m = replay_movie_chip8(other, MOVIE_PATH);
+        if (m != NULL)
+        {
+            fprintf(stderr, "seed %u: a movie replayed from the wrong starting state\n", (unsigned int)seed);
+            end_movie_chip8(m);
+            failed = 1;
+        }
+        free_chip8(other);
+    }
+
+    f = fopen(MOVIE_PATH, "rb");
+    num_bytes = f == NULL ? 0 : (long)fread(movie, 1, MAX_MOVIE_SIZE, f);
+    if (f != NULL)
+    {
+        fclose(f);
+    }
+    /* the code of the end event is before the 8 byte final digest */
+    last_event = num_bytes - 9;
+    if (num_bytes < 14 || num_bytes == MAX_MOVIE_SIZE || movie[last_event] != 0xFF)
+    {
+        fprintf(stderr, "seed %u: the movie is %ld bytes and not finished\n", (unsigned int)seed, num_bytes);
+        failed = 1;
+        goto done;
+    }
+    failed |= check_bad_movies(rom, rom_bytes, movie, num_bytes, last_event, &r, seed);
+
+done:
+    if (p != NULL)
+    {
+        free_chip8(p);
+    }
+    free(movie);
+    return failed;
+}
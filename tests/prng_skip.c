@@ -0,0 +1,217 @@
+/*
+Checks the random number generator's jumps ahead (lfsr_prng_skip(), built
+from the x^(2^k) table each polynomial gets) against stepping it one step at
+a time, for the default and other polynomials and several seeds. Then runs
+a ROM that is mostly Cxkk, with wait loops on the delay timer for the
+emulator to skip over, and checks every Cxkk gets the number a generator
+stepped every cycle would give it.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "chip8_priv.h"
+#include "prng.h"
+#include "random_rom.h"
+
+#define MAX_STEPPED_BITS 22                 /* stepped one at a time up to 2^22 + 1 */
+#define NUM_SPLIT_JUMPS 200
+#define NUM_CYCLES 20000
+
+static const uint32_t polynomials[] = { 0, 0x80000057, 0xB4BCD35C, 0xE0000200, 0xFFFFFFFF, 0x80000001 };
+static const uint32_t seeds[] = { 0, 1, 0xDEADBEEF, 0x80000000 };
+
+static int check_jumps(uint32_t seed, uint32_t polynomial, struct rng *r);
+static int check_rom(uint32_t seed, uint32_t polynomial, struct rng *r);
+
+int
+main(void)
+{
+    struct rng r;
+    size_t i, j;
+    int failed = 0;
+
+    r.state = 1;
+    for (i = 0; i < sizeof(polynomials) / sizeof(polynomials[0]); i++)
+    {
+        for (j = 0; j < sizeof(seeds) / sizeof(seeds[0]); j++)
+        {
+            failed |= check_jumps(seeds[j], polynomials[i], &r);
+            failed |= check_rom(seeds[j], polynomials[i], &r);
+        }
+    }
+    printf("%s\n", failed ? "FAILED" : "passed");
+    return failed;
+}
+
+static int
+compare(const struct lfsr_prng *jumped, const struct lfsr_prng *stepped, uint32_t seed, uint32_t polynomial,
+        uint32_t num_steps)
+{
+    if (jumped->buff != stepped->buff)
+    {
+        fprintf(stderr, "seed 0x%08X, polynomial 0x%08X: %u steps gave 0x%08X, not 0x%08X\n",
+                (unsigned int)seed, (unsigned int)polynomial, (unsigned int)num_steps,
+                (unsigned int)jumped->buff, (unsigned int)stepped->buff);
+        return 1;
+    }
+    return 0;
+}
+
+static int
+check_jumps(uint32_t seed, uint32_t polynomial, struct rng *r)
+{
+    struct lfsr_prng stepped, jumped, split;
+    uint32_t targets[3 * (MAX_STEPPED_BITS + 1) + 1], n, steps, a;
+    size_t num_targets, t;
+    int k, failed = 0;
+
+    /* 0, 1, 2 and 2^k - 1, 2^k, 2^k + 1 in increasing order */
+    num_targets = 0;
+    targets[num_targets++] = 0;
+    targets[num_targets++] = 1;
+    targets[num_targets++] = 2;
+    for (k = 2; k <= MAX_STEPPED_BITS; k++)
+    {
+        targets[num_targets++] = (1u << k) - 1;
+        targets[num_targets++] = 1u << k;
+        targets[num_targets++] = (1u << k) + 1;
+    }
+    init_lfsr_prng(&stepped, seed, polynomial);
+    steps = 0;
+    for (t = 0; t < num_targets; t++)
+    {
+        for (; steps < targets[t]; steps++)
+        {
+            lfsr_prng_process(&stepped);
+        }
+        init_lfsr_prng(&jumped, seed, polynomial);
+        if (lfsr_prng_skip(&jumped, targets[t]) != (uint8_t)jumped.buff)
+        {
+            fprintf(stderr, "lfsr_prng_skip() didn't return the low byte\n");
+            failed = 1;
+        }
+        failed |= compare(&jumped, &stepped, seed, polynomial, targets[t]);
+    }
+
+    /* anything longer in two jumps, the first checked above, must land in the
+       same place as one */
+    for (t = 0; t < NUM_SPLIT_JUMPS; t++)
+    {
+        n = (uint32_t)next_random(r, 0x7FFFFFFF) * 2 + (uint32_t)next_random(r, 2);
+        a = next_random(r, 1u << MAX_STEPPED_BITS);
+        if (a > n)
+        {
+            a = n;
+        }
+        init_lfsr_prng(&jumped, seed, polynomial);
+        lfsr_prng_skip(&jumped, n);
+        init_lfsr_prng(&split, seed, polynomial);
+        lfsr_prng_skip(&split, n - a);
+        lfsr_prng_skip(&split, a);
+        failed |= compare(&jumped, &split, seed, polynomial, n);
+    }
+    return failed;
+}
+
+static uint16_t
+build_cxkk_rom(struct rng *r, uint8_t *rom)
+{
+    /* Cxkk for V0 to VD at random, with a few other instructions and the
+       occasional wait on the delay timer (VE) in between */
+    uint16_t n, address;
+    uint32_t k;
+
+    n = 0;
+    while (n < MAX_ROM_SIZE - 16)
+    {
+        address = (uint16_t)(0x200 + n);
+        k = next_random(r, 20);
+        if (k < 12)
+        {
+            rom[n++] = (uint8_t)(0xC0 | next_random(r, 14));
+            rom[n++] = (uint8_t)next_random(r, 256);
+        }
+        else if (k < 18)
+        {
+            rom[n++] = 0x7F;
+            rom[n++] = (uint8_t)next_random(r, 256);
+        }
+        else
+        {
+            /* VE = 1 to 4, DT = VE, then loop until DT is 0 */
+            rom[n++] = 0x6E;
+            rom[n++] = (uint8_t)(1 + next_random(r, 4));
+            rom[n++] = 0xFE;
+            rom[n++] = 0x15;
+            rom[n++] = 0xFE;
+            rom[n++] = 0x07;
+            rom[n++] = 0x3E;
+            rom[n++] = 0x00;
+            rom[n++] = (uint8_t)(0x10 | ((address + 4) >> 8));
+            rom[n++] = (uint8_t)(address + 4);
+        }
+    }
+    rom[n++] = 0x12;
+    rom[n++] = 0x00;
+    return n;
+}
+
+static int
+check_rom(uint32_t seed, uint32_t polynomial, struct rng *r)
+{
+    struct lfsr_prng eager;
+    struct chip8 *stepped, *batched;
+    uint8_t rom[MAX_ROM_SIZE], expected;
+    uint16_t rom_bytes, opcode;
+    uint32_t cycle, n;
+    int failed = 0;
+
+    rom_bytes = build_cxkk_rom(r, rom);
+    stepped = initialise_chip8(CHIP8_CLOCK_RATE_600Hz);
+    batched = initialise_chip8(CHIP8_CLOCK_RATE_600Hz);
+    if (stepped == NULL || batched == NULL || load_rom_chip8(stepped, rom, rom_bytes) != 0
+        || load_rom_chip8(batched, rom, rom_bytes) != 0 || set_prng_chip8(stepped, seed, polynomial) != 0
+        || set_prng_chip8(batched, seed, polynomial) != 0)
+    {
+        fprintf(stderr, "could not set up the emulators\n");
+        failed = 1;
+    }
+    init_lfsr_prng(&eager, seed, polynomial);
+    for (cycle = 0; cycle < NUM_CYCLES && !failed; cycle++)
+    {
+        /* the generator steps every cycle, before the instruction */
+        opcode = (uint16_t)(stepped->mem[stepped->pc] << 8 | stepped->mem[stepped->pc + 1]);
+        lfsr_prng_process(&eager);
+        execute_cycle_chip8(stepped);
+        expected = (uint8_t)eager.buff & (uint8_t)opcode;
+        if ((opcode & 0xF000) == 0xC000 && stepped->V[(opcode >> 8) & 0xF] != expected)
+        {
+            fprintf(stderr, "seed 0x%08X, polynomial 0x%08X: cycle %u gave 0x%02X, not 0x%02X\n",
+                    (unsigned int)seed, (unsigned int)polynomial, (unsigned int)cycle + 1,
+                    (unsigned int)stepped->V[(opcode >> 8) & 0xF], (unsigned int)expected);
+            failed = 1;
+        }
+    }
+    /* and in batches, where the wait loops are jumped over in one go */
+    for (cycle = 0; cycle < NUM_CYCLES && !failed; cycle += n)
+    {
+        n = execute_cycles_chip8(batched, NUM_CYCLES - cycle < 1000 ? NUM_CYCLES - cycle : 1000, NULL);
+    }
+    if (!failed && get_state_digest_chip8(batched) != get_state_digest_chip8(stepped))
+    {
+        fprintf(stderr, "seed 0x%08X, polynomial 0x%08X: batches differ from single steps\n",
+                (unsigned int)seed, (unsigned int)polynomial);
+        failed = 1;
+    }
+    if (stepped != NULL)
+    {
+        free_chip8(stepped);
+    }
+    if (batched != NULL)
+    {
+        free_chip8(batched);
+    }
+    return failed;
+}
@@ -0,0 +1,159 @@
+#include <stdint.h>
+
+#include "chip8.h"
+#include "random_rom.h"
+
+/*
+A main loop of two instruction units jumping back to its start, and a few
+subroutines after it that the main loop calls. Every unit is two
+instructions so jumps can land on any of them.
+*/
+
+#define MAIN_UNITS 120
+#define NUM_SUBS 4
+#define SUB_UNITS 6
+#define START_ADDRESS 0x200
+
+struct rom_builder
+{
+    struct rng *r;
+    uint8_t *data;
+    uint16_t num_bytes;
+    uint16_t sub_addresses[NUM_SUBS];
+};
+
+uint32_t
+next_random(struct rng *r, uint32_t range)
+{
+    /* 64 bit LCG, the top bits are good enough for this */
+    r->state = r->state * 6364136223846793005ull + 1442695040888963407ull;
+    return (uint32_t)((r->state >> 33) % range);
+}
+
+static void
+add_word(struct rom_builder *b, uint16_t word)
+{
+    b->data[b->num_bytes++] = (uint8_t)(word >> 8);
+    b->data[b->num_bytes++] = (uint8_t)word;
+}
+
+static uint16_t
+random_alu(struct rng *r)
+{
+    static const uint16_t ops_8xy[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+    uint16_t x = (uint16_t)(next_random(r, 16) << 8), y = (uint16_t)(next_random(r, 16) << 4);
+    uint16_t kk = (uint16_t)next_random(r, 256);
+    uint32_t k = next_random(r, 20);
+
+    if (k < 3) return 0x6000 | x | kk;
+    if (k < 6) return 0x7000 | x | kk;
+    if (k < 12) return 0x8000 | x | y | ops_8xy[next_random(r, 9)];
+    if (k < 13) return 0xC000 | x | kk;
+    if (k < 14) return 0xF007 | x;
+    if (k < 15) return 0xF015 | x;
+    if (k < 16) return 0xF018 | x;
+    if (k < 17) return 0x3000 | x | (next_random(r, 2) ? kk : 0);
+    if (k < 18) return 0x4000 | x | (next_random(r, 2) ? kk : 0);
+    if (k < 19) return 0x5000 | x | y;
+    return 0x9000 | x | y;
+}
+
+static void
+add_unit(struct rom_builder *b, int in_sub)
+{
+    /* two instructions, so jumps can land on any unit */
+    struct rng *r = b->r;
+    uint16_t x = (uint16_t)(next_random(r, 16) << 8), y = (uint16_t)(next_random(r, 16) << 4);
+    /* loads and stores hit the program itself as well as data */
+    uint16_t data_address = (uint16_t)(next_random(r, 4) == 0 ? START_ADDRESS + next_random(r, 0x200)
+                                                              : 0x800 + next_random(r, 0x600));
+    uint32_t k = next_random(r, 20);
+
+    if (k < 8)
+    {
+        add_word(b, random_alu(r));
+        add_word(b, random_alu(r));
+    }
+    else if (k < 11)
+    {
+        add_word(b, (uint16_t)(0xA000 | (next_random(r, 5) < 2 ? next_random(r, 0x100) : data_address)));
+        add_word(b, (uint16_t)(0xD000 | x | y | next_random(r, 16)));
+    }
+    else if (k < 15)
+    {
+        static const uint16_t ops_Fx[] = { 0xF033, 0xF055, 0xF065, 0xF01E };
+
+        add_word(b, (uint16_t)(0xA000 | data_address));
+        add_word(b, (uint16_t)(ops_Fx[k - 11] | x));
+    }
+    else if (k < 16)
+    {
+        add_word(b, (uint16_t)(0x6000 | x | next_random(r, 16)));
+        add_word(b, (uint16_t)((next_random(r, 2) ? 0xE09E : 0xE0A1) | x));
+    }
+    else if (k < 17)
+    {
+        add_word(b, random_alu(r));
+        add_word(b, (uint16_t)(0xF029 | x));
+    }
+    else if (k < 18 && !in_sub)
+    {
+        add_word(b, random_alu(r));
+        add_word(b, (uint16_t)(0x2000 | b->sub_addresses[next_random(r, NUM_SUBS)]));
+    }
+    else if (k < 19 && !in_sub)
+    {
+        add_word(b, random_alu(r));
+        add_word(b, (uint16_t)(0x1000 | (START_ADDRESS + 4 * next_random(r, MAIN_UNITS))));
+    }
+    else if (k < 19)
+    {
+        add_word(b, random_alu(r));
+        add_word(b, 0x00E0);
+    }
+    else if (next_random(r, 100) < 15)
+    {
+        add_word(b, random_alu(r));
+        add_word(b, (uint16_t)(0xF00A | x));
+    }
+    else
+    {
+        /* a delay loop, the sort of thing skip_idle_loop() looks for */
+        add_word(b, (uint16_t)(0xF007 | x));
+        add_word(b, (uint16_t)(0x3000 | x));
+    }
+}
+
+uint16_t
+build_random_rom(struct rng *r, uint8_t *data)
+{
+    struct rom_builder b;
+    uint16_t address;
+    int i, s;
+
+    b.r = r;
+    b.data = data;
+    b.num_bytes = 0;
+    address = START_ADDRESS + MAIN_UNITS * 4 + 4;
+    for (s = 0; s < NUM_SUBS; s++)
+    {
+        b.sub_addresses[s] = address;
+        address += SUB_UNITS * 4 + 4;
+    }
+    for (i = 0; i < MAIN_UNITS; i++)
+    {
+        add_unit(&b, 0);
+    }
+    add_word(&b, 0x1200);
+    add_word(&b, 0x1200);
+    for (s = 0; s < NUM_SUBS; s++)
+    {
+        for (i = 0; i < SUB_UNITS; i++)
+        {
+            add_unit(&b, 1);
+        }
+        add_word(&b, 0x00EE);
+        add_word(&b, 0x00EE);
+    }
+    return b.num_bytes;
+}
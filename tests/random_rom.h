@@ -0,0 +1,26 @@
+#ifndef CHIP8_TESTS_RANDOM_ROM_H
+#define CHIP8_TESTS_RANDOM_ROM_H
+
+#include <stdint.h>
+
+/*
+Random ROMs for the tests, made of the kinds of code real programs have
+(arithmetic, skips, calls, jumps back, draws, BCD, loads and stores that
+overwrite the program, key waits, delay loops).
+*/
+
+struct rng
+{
+    uint64_t state;
+};
+
+/* A random number from 0 to range - 1 */
+uint32_t
+next_random(struct rng *r, uint32_t range);
+
+/* Fill data (at least MAX_ROM_SIZE bytes) with a random ROM.
+   Returns its size in bytes. */
+uint16_t
+build_random_rom(struct rng *r, uint8_t *data);
+
+#endif /* CHIP8_TESTS_RANDOM_ROM_H */
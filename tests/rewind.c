@@ -0,0 +1,178 @@
+/*
+Checks rewind.c: random ROMs (see random_rom.c) are run a frame at a time,
+recording every frame, with the digest of the emulator noted whenever a
+snapshot is due. Far more snapshots are taken than the ring can hold, so it
+wraps and drops the oldest many times over, then going back k snapshots
+for several k must give the digest noted k snapshots ago. Recording carries
+on after each rewind, over the snapshots that were forgotten. The budgets
+go down to the documented minimum of 5 * state_size_chip8().
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "random_rom.h"
+
+#define NUM_ROMS 4
+#define CYCLES_PER_FRAME 10
+#define NUM_ROUNDS 6
+#define FRAMES_PER_ROUND 1000
+#define MAX_SNAPSHOTS (NUM_ROUNDS * FRAMES_PER_ROUND + 1)
+
+static int run_rom(uint32_t seed, uint32_t budget_bytes, uint32_t interval);
+
+int
+main(void)
+{
+    uint32_t state_size, budgets[3], intervals[2] = { 1, 3 }, seed;
+    size_t b, i;
+    int failed = 0;
+
+    state_size = state_size_chip8();
+    budgets[0] = 5 * state_size;
+    budgets[1] = 5 * state_size + 13;
+    budgets[2] = 8 * state_size;
+    /* not enough for a single difference */
+    if (initialise_rewind_chip8(state_size, 1) != NULL || initialise_rewind_chip8(budgets[0], 0) != NULL)
+    {
+        fprintf(stderr, "a rewind buffer too small to use was made\n");
+        failed = 1;
+    }
+    for (b = 0; b < sizeof(budgets) / sizeof(budgets[0]); b++)
+    {
+        for (i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++)
+        {
+            for (seed = 1; seed <= NUM_ROMS; seed++)
+            {
+                failed |= run_rom(seed, budgets[b], intervals[i]);
+            }
+        }
+    }
+    printf("%s\n", failed ? "FAILED" : "passed");
+    return failed;
+}
+
+static int
+rewind_to(struct chip8_rewind *r, struct chip8 *p, uint64_t *digests, uint32_t *num_digests,
+          uint32_t num_back, uint32_t seed, uint32_t budget_bytes)
+{
+    if (rewind_chip8(r, p, num_back) != 0)
+    {
+        fprintf(stderr, "seed %u, budget %u: couldn't go back %u of %u snapshots\n", (unsigned int)seed,
+                (unsigned int)budget_bytes, (unsigned int)num_back, (unsigned int)num_snapshots_rewind_chip8(r));
+        return 1;
+    }
+    *num_digests -= num_back;
+    if (get_state_digest_chip8(p) != digests[*num_digests - 1])
+    {
+        fprintf(stderr, "seed %u, budget %u: going back %u snapshots gave the wrong state\n",
+                (unsigned int)seed, (unsigned int)budget_bytes, (unsigned int)num_back);
+        return 1;
+    }
+    if (num_snapshots_rewind_chip8(r) > *num_digests)
+    {
+        fprintf(stderr, "seed %u, budget %u: the snapshots after the rewind weren't forgotten\n",
+                (unsigned int)seed, (unsigned int)budget_bytes);
+        return 1;
+    }
+    return 0;
+}
+
+static int
+run_rom(uint32_t seed, uint32_t budget_bytes, uint32_t interval)
+{
+    struct rng r;
+    uint8_t rom[MAX_ROM_SIZE];
+    uint16_t rom_bytes;
+    struct chip8 *p;
+    struct chip8_rewind *rw;
+    uint64_t *digests, before;
+    uint32_t num_digests, round, frame, cycle, num_snapshots, num_back, since;
+    int wrapped = 0, failed = 0;
+
+    r.state = seed * 11 + budget_bytes;
+    rom_bytes = build_random_rom(&r, rom);
+    p = initialise_chip8(CHIP8_CLOCK_RATE_600Hz);
+    rw = initialise_rewind_chip8(budget_bytes, interval);
+    digests = malloc(MAX_SNAPSHOTS * sizeof(uint64_t));
+    if (p == NULL || rw == NULL || digests == NULL || load_rom_chip8(p, rom, rom_bytes) != 0)
+    {
+        fprintf(stderr, "seed %u, budget %u: could not set up\n", (unsigned int)seed, (unsigned int)budget_bytes);
+        failed = 1;
+        goto done;
+    }
+    num_digests = 0;
+    since = 0;
+    for (round = 0; round < NUM_ROUNDS && !failed; round++)
+    {
+        for (frame = 0; frame < FRAMES_PER_ROUND; frame++)
+        {
+            /* the first call takes a snapshot, then every interval calls */
+            if (num_digests == 0 || ++since == interval)
+            {
+                digests[num_digests++] = get_state_digest_chip8(p);
+                since = 0;
+            }
+            if (record_rewind_chip8(rw, p) != 0)
+            {
+                fprintf(stderr, "seed %u, budget %u: could not record\n", (unsigned int)seed,
+                        (unsigned int)budget_bytes);
+                failed = 1;
+                goto done;
+            }
+            if (next_random(&r, 8) == 0)
+            {
+                set_key_chip8(p, (uint8_t)next_random(&r, 16), (int)next_random(&r, 2));
+            }
+            for (cycle = 0; cycle < CYCLES_PER_FRAME; )
+            {
+                cycle += execute_cycles_chip8(p, CYCLES_PER_FRAME - cycle, NULL);
+            }
+        }
+        num_snapshots = num_snapshots_rewind_chip8(rw);
+        if (num_snapshots < 2 || num_snapshots > num_digests)
+        {
+            fprintf(stderr, "seed %u, budget %u: %u snapshots of %u taken\n", (unsigned int)seed,
+                    (unsigned int)budget_bytes, (unsigned int)num_snapshots, (unsigned int)num_digests);
+            failed = 1;
+            break;
+        }
+        wrapped |= num_snapshots < num_digests;
+
+        /* one too far is refused and leaves the emulator alone */
+        before = get_state_digest_chip8(p);
+        if (rewind_chip8(rw, p, num_snapshots) == 0 || get_state_digest_chip8(p) != before)
+        {
+            fprintf(stderr, "seed %u, budget %u: going back past the oldest snapshot wasn't refused\n",
+                    (unsigned int)seed, (unsigned int)budget_bytes);
+            failed = 1;
+        }
+
+        /* back to the newest, one, a few and (last round) the oldest */
+        failed |= rewind_to(rw, p, digests, &num_digests, 0, seed, budget_bytes);
+        num_back = round == NUM_ROUNDS - 1 ? num_snapshots - 1 : 1 + next_random(&r, num_snapshots - 1);
+        if (num_back > 1 && num_back < num_snapshots - 1)
+        {
+            failed |= rewind_to(rw, p, digests, &num_digests, 1, seed, budget_bytes);
+            num_back--;
+        }
+        failed |= rewind_to(rw, p, digests, &num_digests, num_back, seed, budget_bytes);
+        since = 0;
+    }
+    if (!failed && !wrapped)
+    {
+        fprintf(stderr, "seed %u, budget %u: the ring never filled up\n", (unsigned int)seed,
+                (unsigned int)budget_bytes);
+        failed = 1;
+    }
+
+done:
+    if (p != NULL)
+    {
+        free_chip8(p);
+    }
+    free_rewind_chip8(rw);
+    free(digests);
+    return failed;
+}
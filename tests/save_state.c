@@ -0,0 +1,214 @@
+/*
+Checks that a saved state carries a run on exactly where it left off: saved
+part way through a random ROM (see random_rom.c), run on, loaded back and
+run on again with the same keys gives the same digest. It is loaded into a
+second emulator too, one that has run a different ROM in the blocks mode
+with a different random number polynomial, so the decoded instructions
+have to be thrown away and the generator restored. States with the wrong
+magic, version or size must be rejected and leave the emulator alone.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "random_rom.h"
+
+#define NUM_ROMS 40
+#define MAX_BEFORE 5000
+#define NUM_AFTER 3000
+#define MAGIC_OFFSET 0
+#define VERSION_OFFSET 4
+#define SIZE_OFFSET 8
+
+static int run_rom(uint32_t seed, uint8_t *state);
+static int check_rejected(uint8_t *state);
+
+int
+main(void)
+{
+    uint8_t *state;
+    uint32_t seed;
+    int failed = 0;
+
+    state = malloc(state_size_chip8());
+    if (state == NULL)
+    {
+        return 1;
+    }
+    for (seed = 1; seed <= NUM_ROMS; seed++)
+    {
+        failed |= run_rom(seed, state);
+    }
+    failed |= check_rejected(state);
+    free(state);
+    printf("%d ROMs %s\n", NUM_ROMS, failed ? "FAILED" : "passed");
+    return failed;
+}
+
+static void
+run_with_keys(struct chip8 *p, uint64_t key_seed, uint32_t num_cycles)
+{
+    struct rng r;
+    uint32_t cycle, n;
+
+    r.state = key_seed;
+    for (cycle = 0; cycle < num_cycles; cycle += n)
+    {
+        if (next_random(&r, 4) == 0)
+        {
+            set_key_chip8(p, (uint8_t)next_random(&r, 16), (int)next_random(&r, 2));
+        }
+        n = execute_cycles_chip8(p, 1 + next_random(&r, num_cycles - cycle), NULL);
+    }
+}
+
+static int
+run_rom(uint32_t seed, uint8_t *state)
+{
+    struct rng r;
+    uint8_t rom[MAX_ROM_SIZE];
+    uint16_t rom_bytes;
+    struct chip8 *p, *other;
+    uint64_t saved, after, key_seed;
+    int failed = 0;
+
+    r.state = seed;
+    rom_bytes = build_random_rom(&r, rom);
+    p = initialise_chip8(CHIP8_CLOCK_RATE_600Hz);
+    other = initialise_chip8(seed % 2 ? CHIP8_CLOCK_RATE_300Hz : CHIP8_CLOCK_RATE_900Hz);
+    if (p == NULL || other == NULL || load_rom_chip8(p, rom, rom_bytes) != 0
+        || set_prng_chip8(p, 1 + next_random(&r, 1000), 0x80000057) != 0)
+    {
+        fprintf(stderr, "seed %u: could not set up the emulators\n", (unsigned int)seed);
+        failed = 1;
+        goto done;
+    }
+    run_with_keys(p, seed * 3, 1 + next_random(&r, MAX_BEFORE));
+    if (save_state_chip8(p, state) != 0)
+    {
+        fprintf(stderr, "seed %u: could not save\n", (unsigned int)seed);
+        failed = 1;
+        goto done;
+    }
+    saved = get_state_digest_chip8(p);
+    key_seed = seed * 5;
+    run_with_keys(p, key_seed, NUM_AFTER);
+    after = get_state_digest_chip8(p);
+
+    /* back to the save in the same emulator */
+    if (load_state_chip8(p, state) != 0 || get_state_digest_chip8(p) != saved)
+    {
+        fprintf(stderr, "seed %u: loading the state didn't restore it\n", (unsigned int)seed);
+        failed = 1;
+    }
+    run_with_keys(p, key_seed, NUM_AFTER);
+    if (get_state_digest_chip8(p) != after)
+    {
+        fprintf(stderr, "seed %u: the run after loading went differently\n", (unsigned int)seed);
+        failed = 1;
+    }
+
+    /* and in another emulator with a different ROM decoded */
+    rom_bytes = build_random_rom(&r, rom);
+    if (load_rom_chip8(other, rom, rom_bytes) != 0 || set_exec_mode_chip8(other, CHIP8_EXEC_BLOCKS) != 0
+        || set_prng_chip8(other, 0, 0xB4BCD35C) != 0)
+    {
+        fprintf(stderr, "seed %u: could not set up the other emulator\n", (unsigned int)seed);
+        failed = 1;
+        goto done;
+    }
+    run_with_keys(other, seed * 7, 2000);
+    if (load_state_chip8(other, state) != 0 || get_state_digest_chip8(other) != saved)
+    {
+        fprintf(stderr, "seed %u: loading the state into another emulator didn't restore it\n",
+                (unsigned int)seed);
+        failed = 1;
+    }
+    run_with_keys(other, key_seed, NUM_AFTER);
+    if (get_state_digest_chip8(other) != after)
+    {
+        fprintf(stderr, "seed %u: the run in another emulator went differently\n", (unsigned int)seed);
+        failed = 1;
+    }
+
+done:
+    if (p != NULL)
+    {
+        free_chip8(p);
+    }
+    if (other != NULL)
+    {
+        free_chip8(other);
+    }
+    return failed;
+}
+
+static int
+try_load(struct chip8 *p, const uint8_t *state, const char *what)
+{
+    uint64_t before;
+
+    before = get_state_digest_chip8(p);
+    if (load_state_chip8(p, state) == 0)
+    {
+        fprintf(stderr, "a state with the wrong %s was loaded\n", what);
+        return 1;
+    }
+    if (get_state_digest_chip8(p) != before)
+    {
+        fprintf(stderr, "a state with the wrong %s changed the emulator\n", what);
+        return 1;
+    }
+    return 0;
+}
+
+static int
+check_rejected(uint8_t *state)
+{
+    /* state holds the last good state saved */
+    struct chip8 *p;
+    uint8_t *bad;
+    uint32_t word;
+    int failed = 0;
+
+    p = initialise_chip8(CHIP8_CLOCK_RATE_600Hz);
+    bad = malloc(state_size_chip8());
+    if (p == NULL || bad == NULL)
+    {
+        fprintf(stderr, "could not set up the emulator\n");
+        failed = 1;
+        goto done;
+    }
+    memcpy(bad, state, state_size_chip8());
+    bad[MAGIC_OFFSET] ^= 0x20;
+    failed |= try_load(p, bad, "magic");
+
+    memcpy(bad, state, state_size_chip8());
+    memcpy(&word, &bad[VERSION_OFFSET], sizeof(word));
+    word++;
+    memcpy(&bad[VERSION_OFFSET], &word, sizeof(word));
+    failed |= try_load(p, bad, "version");
+
+    memcpy(bad, state, state_size_chip8());
+    memcpy(&word, &bad[SIZE_OFFSET], sizeof(word));
+    word--;
+    memcpy(&bad[SIZE_OFFSET], &word, sizeof(word));
+    failed |= try_load(p, bad, "size");
+
+    /* and the untouched state still loads */
+    if (load_state_chip8(p, state) != 0)
+    {
+        fprintf(stderr, "the good state wasn't loaded\n");
+        failed = 1;
+    }
+
+done:
+    if (p != NULL)
+    {
+        free_chip8(p);
+    }
+    free(bad);
+    return failed;
+}